@@ -3,8 +3,9 @@
 # Automatically generated by qmake (2.00a) Mon 24. Apr 13:13:37 2006
 ######################################################################
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
 TEMPLATE = app
+CONFIG += c++11
 TARGET += 
 win32 {
 DEPENDPATH += . \
@@ -20,9 +21,15 @@ win32 {
 
 # Input
 HEADERS += mainwindow.h mdichild.h ndworkspace.h quill.h \
-    version.h
-SOURCES += main.cpp mainwindow.cpp mdichild.cpp ndworkspace.cpp quill.cpp  
+    version.h quillscan.h quillexport.h batch.h bundle.h cache.h container.h report.h \
+    errorreporter.h dialogreporter.h isolate.h
+SOURCES += main.cpp mainwindow.cpp mdichild.cpp ndworkspace.cpp quill.cpp  \
+    quillscan.cpp quillexport.cpp batch.cpp bundle.cpp cache.cpp container.cpp report.cpp \
+    errorreporter.cpp dialogreporter.cpp isolate.cpp
 RESOURCES += qstripper.qrc
 
+# The command line version, qstripper-cli, is built from QStripperCli.pro. It
+# shares the parser and the exporters with this one.
+
 # Make the app link statically to the various DLLs. (Appears to be ignored!)
 #QMAKE_LFLAGS += -static
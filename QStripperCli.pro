@@ -0,0 +1,23 @@
+######################################################################
+# qstripper-cli - command line exports, no main window, no display.
+######################################################################
+
+# Qt 5 needs gui for QTextDocument, but not widgets. Qt 4 has it in gui.
+# The server needs network for QLocalServer.
+QT += network
+greaterThan(QT_MAJOR_VERSION, 4): QT += concurrent
+TEMPLATE = app
+CONFIG += c++11 console
+CONFIG -= app_bundle
+TARGET = qstripper-cli
+INCLUDEPATH += .
+
+# Force 32 bit compilations on Windows.
+win32 {
+    CFLAGS += -m32
+    QMAKE_CXXFLAGS += -m32
+}
+
+# Input
+HEADERS += batch.h bundle.h cache.h container.h errorreporter.h isolate.h report.h quill.h quillexport.h quillscan.h version.h watch.h serve.h
+SOURCES += cli.cpp batch.cpp bundle.cpp cache.cpp container.cpp errorreporter.cpp isolate.cpp report.cpp quill.cpp quillexport.cpp quillscan.cpp watch.cpp serve.cpp
@@ -0,0 +1,1520 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#include <QBuffer>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QPair>
+#include <QRegExp>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QScopedPointer>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrentMap>
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+#ifdef Q_OS_WIN
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "batch.h"
+#include "bundle.h"
+#include "cache.h"
+#include "container.h"
+#include "errorreporter.h"
+#include "isolate.h"
+#include "quill.h"
+
+// A worker just keeps taking files until there are none left, anywhere.
+class batchWorker : public QRunnable {
+public:
+    batchWorker(QuillBatch *Batch, const int Worker) { fBatch = Batch; fWorker = Worker; }
+    void run() { fBatch->work(fWorker); }
+
+private:
+    QuillBatch *fBatch;
+    int fWorker;
+};
+
+
+QuillBatch::QuillBatch(const batchOptions &Options)
+{
+    fOptions = Options;
+    fParallelWriters = true;
+    fCache = nullptr;
+    fBundle = nullptr;
+    fReport = nullptr;
+    fReporter = nullptr;
+    fOwnsReporter = false;
+    fNextReport = 0;
+    fFailures = 0;
+    fAborting = false;
+    fBusy = 0;
+}
+
+QuillBatch::~QuillBatch()
+{
+    qDeleteAll(fContainers);
+
+    if (fOwnsReporter) {
+        delete fReporter;
+    }
+}
+
+//------------------------------------------------------------------------------
+// The command line format is the same as the GUI version's:
+//
+// qstripper-cli --help
+//
+// or
+//
+// qstripper-cli [--export] [-j N] --fmt [--fmt ...] list_of_files
+// qstripper-cli [--export] [-j N] --formats fmt,fmt,... list_of_files
+//
+// Fmt is one or more of the following:
+// --pdf --docbook --odf --html --text --rst --asc
+//
+// -j N (or -jN, or --jobs N) exports N files at once, the default being one
+// per core.
+//
+// --max-rss size, in bytes or with a K, M or G suffix, stops workers starting
+// new files while the process is bigger than that. One file is always allowed
+// to carry on, so the batch never stalls.
+//
+// --recursive dir adds every Quill file in dir, and below. Only files matching
+// an --include glob, but no --exclude glob, are looked at. The default is to
+// include "*.doc" and QL style "*_doc". Only the first 20 bytes of each are
+// read, anything that isn't a Quill file is quietly skipped. All three can be
+// given more than once.
+//
+// --cache dir keeps a manifest of what has been exported in dir. Files that
+// haven't changed since, going by their content hash, aren't exported again.
+// Outputs of files that have been deleted are listed, or with --prune, deleted.
+//
+// --watch dir keeps running, and exports Quill files as they turn up in dir,
+// once they've stopped changing for --settle milliseconds, 2000 by default.
+//
+// --from file --to fmt converts one document and writes it to stdout. A file
+// of - reads the document from stdin, so we can sit in a pipeline.
+//
+// --serve [--socket name] [-j N] runs a conversion server on a local socket,
+// see serve.cpp.
+//
+// --bundle file.zip, or file.tar, writes all the exports into that one file
+// instead of next to the inputs.
+//
+// --report file.jsonl writes a JSON record for each file, then a summary, see
+// report.cpp.
+//
+// --on-error continue, the default, carries on after a bad file. --on-error
+// abort stops starting new files after the first error. --error-log file adds
+// the errors to the end of file, as JSON lines, instead of writing to stderr.
+//
+// A file that's a QXL.WIN or QL floppy disc image, or a zip file, is read for
+// the Quill files in it. Found by --recursive too, if the globs let it through,
+// --include *.win for example.
+//
+// --isolate exports in -j N worker processes, rather than threads, and
+// --timeout seconds, 60 by default, 0 for none, is how long one file may take
+// before its worker is killed. See isolate.cpp. --worker is how those
+// processes are started, it isn't for people.
+//------------------------------------------------------------------------------
+bool QuillBatch::parseArgs(const QStringList &args, batchOptions &Options, QString &error)
+{
+    Options.help = false;
+    Options.jobs = QThread::idealThreadCount();
+    Options.maxRSS = 0;
+    Options.formats.clear();
+    Options.files.clear();
+    Options.directories.clear();
+    Options.include.clear();
+    Options.exclude.clear();
+    Options.cacheDirectory.clear();
+    Options.prune = false;
+    Options.watchDirectory.clear();
+    Options.settle = 2000;
+    Options.from.clear();
+    Options.serve = false;
+    Options.serverName = "qstripper";
+    Options.bundle.clear();
+    Options.report.clear();
+    Options.errorLog.clear();
+    Options.onError = ErrorReporter::Continue;
+    Options.isolate = false;
+    Options.timeout = 60;
+    Options.worker = false;
+
+    bool timeoutGiven = false;
+    int arg = 0;
+
+    if (arg < args.size() && args.at(arg).toLower() == "--help") {
+        Options.help = true;
+        return true;
+    }
+
+    // --export is optional here, we can't do anything else.
+    if (arg < args.size() && args.at(arg).toLower() == "--export") {
+        arg++;
+    }
+
+    // Formats, until we run out of options.
+    for (; arg < args.size() && args.at(arg).startsWith("-"); arg++) {
+        QString option = args.at(arg).toLower();
+
+        if (option == "--jobs" || option.startsWith("-j")) {
+            QString count = option.mid(2);
+            if (option == "-j" || option == "--jobs") {
+                if (++arg >= args.size()) {
+                    error = option + " needs the number of files to export at once.";
+                    return false;
+                }
+                count = args.at(arg);
+            }
+
+            bool ok = false;
+            Options.jobs = count.toInt(&ok);
+            if (!ok || Options.jobs < 1) {
+                error = count + " is not a valid number of jobs!";
+                return false;
+            }
+            continue;
+        }
+
+        if (option == "--max-rss") {
+            if (++arg >= args.size()) {
+                error = "--max-rss needs a memory budget, like 256M.";
+                return false;
+            }
+
+            if (!parseSize(args.at(arg), Options.maxRSS)) {
+                error = args.at(arg) + " is not a valid memory budget!";
+                return false;
+            }
+            continue;
+        }
+
+        if (option == "--recursive" || option == "--include" || option == "--exclude") {
+            if (++arg >= args.size()) {
+                error = option + (option == "--recursive" ? " needs a directory." : " needs a glob, like \"*_doc\".");
+                return false;
+            }
+
+            if (option == "--recursive") {
+                Options.directories.append(args.at(arg));
+            } else if (option == "--include") {
+                Options.include.append(args.at(arg));
+            } else {
+                Options.exclude.append(args.at(arg));
+            }
+            continue;
+        }
+
+        if (option == "--cache") {
+            if (++arg >= args.size()) {
+                error = "--cache needs a directory for the manifest.";
+                return false;
+            }
+
+            Options.cacheDirectory = args.at(arg);
+            continue;
+        }
+
+        if (option == "--bundle") {
+            if (++arg >= args.size() || !BundleWriter::isBundleName(args.at(arg))) {
+                error = "--bundle needs a .zip or .tar file to write.";
+                return false;
+            }
+
+            Options.bundle = args.at(arg);
+            continue;
+        }
+
+        if (option == "--on-error") {
+            if (++arg >= args.size() || !ErrorReporter::policyFromName(args.at(arg), Options.onError)) {
+                error = "--on-error needs continue or abort.";
+                return false;
+            }
+            continue;
+        }
+
+        if (option == "--error-log") {
+            if (++arg >= args.size()) {
+                error = "--error-log needs a file to write.";
+                return false;
+            }
+
+            Options.errorLog = args.at(arg);
+            continue;
+        }
+
+        if (option == "--report") {
+            if (++arg >= args.size()) {
+                error = "--report needs a file to write.";
+                return false;
+            }
+
+            Options.report = args.at(arg);
+            continue;
+        }
+
+        if (option == "--serve") {
+            Options.serve = true;
+            continue;
+        }
+
+        if (option == "--isolate") {
+            Options.isolate = true;
+            continue;
+        }
+
+        if (option == "--timeout") {
+            bool ok = false;
+            if (++arg < args.size()) {
+                Options.timeout = args.at(arg).toInt(&ok);
+            }
+
+            if (!ok || Options.timeout < 0) {
+                error = "--timeout needs a time in seconds, or 0 for none.";
+                return false;
+            }
+
+            timeoutGiven = true;
+            continue;
+        }
+
+        if (option == "--worker") {
+            Options.worker = true;
+            continue;
+        }
+
+        if (option == "--socket") {
+            if (++arg >= args.size()) {
+                error = "--socket needs a name for the server.";
+                return false;
+            }
+
+            Options.serverName = args.at(arg);
+            continue;
+        }
+
+        if (option == "--from") {
+            if (++arg >= args.size()) {
+                error = "--from needs a Quill file, or - for stdin.";
+                return false;
+            }
+
+            Options.from = args.at(arg);
+            continue;
+        }
+
+        if (option == "--to") {
+            QuillExporter::Format format;
+            if (++arg >= args.size() ||
+                !QuillExporter::formatFromOption("--" + args.at(arg), format)) {
+                error = "--to needs one of text, html, rst, adoc, docbook, odf or pdf.";
+                return false;
+            }
+
+            Options.formats.clear();
+            Options.formats.append(format);
+            continue;
+        }
+
+        if (option == "--watch") {
+            if (++arg >= args.size()) {
+                error = "--watch needs a directory to watch.";
+                return false;
+            }
+
+            Options.watchDirectory = args.at(arg);
+            continue;
+        }
+
+        if (option == "--settle") {
+            bool ok = false;
+            if (++arg < args.size()) {
+                Options.settle = args.at(arg).toInt(&ok);
+            }
+
+            if (!ok || Options.settle < 0) {
+                error = "--settle needs a time in milliseconds.";
+                return false;
+            }
+            continue;
+        }
+
+        if (option == "--prune") {
+            Options.prune = true;
+            continue;
+        }
+
+        if (option == "--formats") {
+            if (++arg >= args.size()) {
+                error = "--formats needs a list of formats, like pdf,html,rst.";
+                return false;
+            }
+
+            if (!parseFormatList(args.at(arg), Options, error)) {
+                return false;
+            }
+            continue;
+        }
+
+        QuillExporter::Format format;
+        if (!QuillExporter::formatFromOption(option, format)) {
+            error = args.at(arg) + " is not a valid export format!";
+            return false;
+        }
+
+        if (!Options.formats.contains(format)) {
+            Options.formats.append(format);
+        }
+    }
+
+    if (Options.jobs < 1) {
+        Options.jobs = 1;
+    }
+
+    // The files come down a pipe, one at a time, see isolate.cpp.
+    if (Options.worker) {
+        if (arg < args.size()) {
+            error = "--worker doesn't take any files.";
+            return false;
+        }
+        return true;
+    }
+
+    if (timeoutGiven && !Options.isolate) {
+        error = "--timeout needs --isolate.";
+        return false;
+    }
+
+    if (Options.isolate && (Options.serve || !Options.from.isEmpty())) {
+        error = "--isolate is for batches, not --serve or --from.";
+        return false;
+    }
+
+    // The formats etc come with each request.
+    if (Options.serve) {
+        if (arg < args.size() || !Options.report.isEmpty()) {
+            error = "--serve doesn't take any files, or a --report.";
+            return false;
+        }
+        return true;
+    }
+
+    if (Options.formats.isEmpty()) {
+        error = "No export format given.";
+        return false;
+    }
+
+    for (; arg < args.size(); arg++) {
+        Options.files.append(args.at(arg));
+    }
+
+    // Converting one document to stdout? Nothing else makes sense with that.
+    if (!Options.from.isEmpty()) {
+        if (Options.formats.size() != 1 || !Options.files.isEmpty() || !Options.report.isEmpty()) {
+            error = "--from converts one document to one format, given with --to.";
+            return false;
+        }
+        return true;
+    }
+
+    if (Options.include.isEmpty()) {
+        Options.include << "*.doc" << "*_doc";
+    }
+
+    if (!Options.bundle.isEmpty() &&
+        (!Options.cacheDirectory.isEmpty() || !Options.watchDirectory.isEmpty())) {
+        error = "--bundle can't be used with --cache or --watch.";
+        return false;
+    }
+
+    if (Options.prune && Options.cacheDirectory.isEmpty()) {
+        error = "--prune needs a --cache.";
+        return false;
+    }
+
+    if (Options.files.isEmpty() && Options.directories.isEmpty() &&
+        Options.watchDirectory.isEmpty()) {
+        error = "No Quill files given.";
+        return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// "256M" etc. Plain numbers are bytes.
+//------------------------------------------------------------------------------
+bool QuillBatch::parseSize(const QString &size, qint64 &bytes)
+{
+    QString number = size.trimmed().toUpper();
+    qint64 multiplier = 1;
+
+    if (number.endsWith('K')) multiplier = Q_INT64_C(1024);
+    else if (number.endsWith('M')) multiplier = Q_INT64_C(1024) * 1024;
+    else if (number.endsWith('G')) multiplier = Q_INT64_C(1024) * 1024 * 1024;
+
+    if (multiplier > 1) {
+        number.chop(1);
+    }
+
+    bool ok = false;
+    bytes = number.toLongLong(&ok) * multiplier;
+    return ok && bytes > 0;
+}
+
+bool QuillBatch::parseFormatList(const QString &list, batchOptions &Options, QString &error)
+{
+    QStringList names = list.split(',', QString::SkipEmptyParts);
+
+    for (int n = 0; n < names.size(); n++) {
+        QuillExporter::Format format;
+        if (!QuillExporter::formatFromOption("--" + names.at(n).trimmed(), format)) {
+            error = names.at(n) + " is not a valid export format!";
+            return false;
+        }
+
+        if (!Options.formats.contains(format)) {
+            Options.formats.append(format);
+        }
+    }
+
+    return true;
+}
+
+bool QuillBatch::needsDocument(const batchOptions &Options)
+{
+    if (Options.help) {
+        return false;
+    }
+
+    for (int f = 0; f < Options.formats.size(); f++) {
+        if (QuillExporter::needsDocument(Options.formats.at(f))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+QString QuillBatch::usage()
+{
+    return "Usage:\n\n"
+           "    qstripper-cli --help\n"
+           "    qstripper-cli [--export] [-j N] --format [--format ...] file ...\n"
+           "    qstripper-cli [--export] [-j N] --formats format,format,... file ...\n\n"
+           "Where --format is one or more of:\n\n"
+           "    --pdf --docbook --odf --html --text --rst --asc\n\n"
+           "Files are exported to the same folder, with the same name and\n"
+           "each format's extension. Each file is only read once, however\n"
+           "many formats are asked for.\n\n"
+           "QXL.WIN and QL floppy disc images, and zip files, are read for\n"
+           "the Quill files inside. Those are exported to a folder named after\n"
+           "the image, disk_win for disk.win, next to it.\n\n"
+           "-j N exports N files at once. The default is one per core.\n"
+           "--recursive dir exports every Quill file in, and under, dir.\n"
+           "--include glob and --exclude glob choose which files in there\n"
+           "are looked at. The default is --include *.doc --include *_doc.\n"
+           "--cache dir remembers what was exported, in dir, and skips\n"
+           "files that haven't changed since. --prune deletes the exports\n"
+           "of files that have since been deleted.\n"
+           "--watch dir keeps running and exports files as they arrive in\n"
+           "dir, once they've not changed for --settle ms, 2000 by default.\n\n"
+           "    qstripper-cli --from file --to format\n\n"
+           "converts one file, or stdin if file is -, to stdout. Format is\n"
+           "one of text, html, rst, adoc, docbook, odf or pdf.\n\n"
+           "    qstripper-cli --serve [--socket name] [-j N]\n\n"
+           "runs a conversion server on a local socket, \"qstripper\" unless\n"
+           "named, doing up to N conversions at once.\n\n"
+           "--bundle file.zip, or file.tar, puts all the exports in one\n"
+           "archive rather than next to each input file.\n"
+           "--report file.jsonl writes a JSON line per file, with times and\n"
+           "sizes, then a summary line with totals and percentiles.\n"
+           "--on-error abort stops after the first error, rather than\n"
+           "carrying on with the other files. The exit code is then 3.\n"
+           "--error-log file adds errors to file, as JSON lines, instead of\n"
+           "writing them to stderr.\n"
+           "--max-rss size holds back new files while memory use is over\n"
+           "size, 256M for example. (Linux only, ignored elsewhere.)\n"
+           "--isolate exports in N worker processes instead of threads, so\n"
+           "a file that crashes or hangs only fails itself. --timeout secs,\n"
+           "60 by default, 0 for none, is the longest one file may take.\n";
+}
+
+//------------------------------------------------------------------------------
+// Export every file. One bad file doesn't stop the others.
+//------------------------------------------------------------------------------
+int QuillBatch::run()
+{
+    if (!fReporter) {
+        QString error;
+        fReporter = makeReporter(fOptions, error);
+        if (!fReporter) {
+            QTextStream(stderr) << error << "\n";
+            return EXIT_USAGE;
+        }
+        fOwnsReporter = true;
+    }
+
+    if (!fOptions.from.isEmpty()) {
+        return convertStream();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    fFailures = 0;
+    findFiles();
+
+    ExportCache cache;
+    fCache = nullptr;
+
+    if (!fOptions.cacheDirectory.isEmpty()) {
+        QString error;
+        if (!cache.load(fOptions.cacheDirectory, error)) {
+            fReporter->error(QString(), error);
+            return EXIT_FAILURES;
+        }
+        fCache = &cache;
+    }
+
+    BundleWriter bundle;
+    fBundle = nullptr;
+
+    if (!fOptions.bundle.isEmpty()) {
+        QString error;
+        if (!bundle.open(fOptions.bundle, error)) {
+            fReporter->error(QString(), error);
+            return EXIT_FAILURES;
+        }
+        fBundle = &bundle;
+        fBundleRoot = namedRoot();
+    }
+
+    // A --watch batch adds to the report, rather than replace it.
+    BatchReport report;
+    fReport = nullptr;
+
+    if (!fOptions.report.isEmpty()) {
+        QString error;
+        if (!report.open(fOptions.report, !fOptions.watchDirectory.isEmpty(), error)) {
+            fReporter->error(QString(), error);
+            return EXIT_FAILURES;
+        }
+        fReport = &report;
+    }
+
+    const int files = fOptions.files.size();
+    const int workers = qMin(fOptions.jobs, files);
+
+    fileResult pending;
+    pending.done = false;
+    BatchReport::clear(pending.report);
+    fResults.fill(pending, files);
+
+    fNextReport = 0;
+    fAborting = false;
+    fBusy = 0;
+
+    if (fOptions.isolate) {
+        // One queue, largest first, for the processes to take from in turn.
+        shareWork(1);
+        fParallelWriters = (workers <= 1);
+
+        if (workers > 0) {
+            WorkerPool pool(this, workers);
+            pool.run();
+        }
+    } else {
+        runThreads(workers);
+    }
+
+    finishSkipped();
+
+    qDeleteAll(fQueues);
+    fQueues.clear();
+
+    if (fCache) {
+        finishCache();
+        fCache = nullptr;
+    }
+
+    if (fBundle) {
+        QString error;
+        if (!fBundle->close(error)) {
+            fReporter->error(QString(), error);
+            fFailures++;
+        }
+        fBundle = nullptr;
+    }
+
+    if (fReport) {
+        QString error;
+        if (!fReport->close(timer.nsecsElapsed() / 1000, error)) {
+            fReporter->error(QString(), error);
+            fFailures++;
+        }
+        fReport = nullptr;
+    }
+
+    if (fReporter->aborted()) {
+        return EXIT_ABORTED;
+    }
+
+    return fFailures ? EXIT_FAILURES : EXIT_OK;
+}
+
+void QuillBatch::runThreads(const int workers)
+{
+    shareWork(qMax(workers, 1));
+
+    // With one worker, the cores are spare for the writers. With more, each
+    // file's writers run one after another, the workers keep the cores busy.
+    fParallelWriters = (workers <= 1);
+
+    if (workers <= 1) {
+        work(0);
+    } else {
+        // Our own pool, so the global one is free for the parser.
+        QThreadPool pool;
+        pool.setMaxThreadCount(workers);
+
+        for (int w = 0; w < workers; w++) {
+            pool.start(new batchWorker(this, w));
+        }
+
+        pool.waitForDone();
+    }
+}
+
+//------------------------------------------------------------------------------
+// Errors go to stderr, or with --error-log, to the end of that file. The
+// caller owns the reporter. Returns nullptr, with a message, if the log can't
+// be opened.
+//------------------------------------------------------------------------------
+ErrorReporter *QuillBatch::makeReporter(const batchOptions &Options, QString &error)
+{
+    ErrorReporter *reporter;
+
+    if (Options.errorLog.isEmpty()) {
+        reporter = new StderrReporter;
+    } else {
+        LogReporter *log = new LogReporter;
+        if (!log->open(Options.errorLog, error)) {
+            delete log;
+            return nullptr;
+        }
+        reporter = log;
+    }
+
+    reporter->setPolicy(Options.onError);
+    return reporter;
+}
+
+// For a reporter shared by several batches, --watch for one. We don't own it.
+void QuillBatch::setReporter(ErrorReporter *Reporter)
+{
+    if (fOwnsReporter) {
+        delete fReporter;
+    }
+
+    fReporter = Reporter;
+    fOwnsReporter = false;
+}
+
+//------------------------------------------------------------------------------
+// --from, --to. The whole document has to be read, as the tables come after
+// the text, but nothing is written to disc, and the text formats are written
+// out a paragraph at a time.
+//------------------------------------------------------------------------------
+int QuillBatch::convertStream()
+{
+    QFile in;
+
+    if (fOptions.from == "-") {
+#ifdef Q_OS_WIN
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        in.open(stdin, QFile::ReadOnly);
+    } else {
+        in.setFileName(fOptions.from);
+        in.open(QFile::ReadOnly);
+    }
+
+    if (!in.isOpen()) {
+        fReporter->error(fOptions.from, in.errorString());
+        return EXIT_FAILURES;
+    }
+
+    QuillDoc *Input = QuillDoc::fromBytes(in.readAll(), true);
+    if (!Input->isValid()) {
+        fReporter->error(fOptions.from, "This is not a Quill file. " + Input->getError());
+        delete Input;
+        return EXIT_FAILURES;
+    }
+
+#ifdef Q_OS_WIN
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    QFile out;
+    out.open(stdout, QFile::WriteOnly);
+
+    QuillExporter exporter(Input);
+    bool ok = exporter.write(fOptions.formats.at(0), &out);
+    out.flush();
+    delete Input;
+
+    if (!ok) {
+        fReporter->error(fOptions.from, exporter.errorString());
+        return EXIT_FAILURES;
+    }
+
+    return EXIT_OK;
+}
+
+//------------------------------------------------------------------------------
+// Report, or with --prune delete, outputs whose inputs have gone, then save
+// the manifest for next time.
+//------------------------------------------------------------------------------
+void QuillBatch::finishCache()
+{
+    QTextStream out(stdout);
+
+    if (fOptions.prune) {
+        QStringList deleted = fCache->prune();
+        for (int d = 0; d < deleted.size(); d++) {
+            out << "Pruned: " << deleted.at(d) << "\n";
+        }
+    } else {
+        QStringList stale = fCache->stale();
+        for (int d = 0; d < stale.size(); d++) {
+            out << "Stale: " << stale.at(d) << "\n";
+        }
+    }
+
+    out.flush();
+
+    QString error;
+    if (!fCache->save(error)) {
+        fReporter->error(QString(), error);
+        fFailures++;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Add the Quill files in each --recursive directory to the list. Directories
+// are read as we go, never listed in full, and only files whose names pass the
+// globs are opened at all, for their first 20 bytes. Within a directory tree
+// the files are sorted, so the batch is the same every time.
+//
+// Disc images and zip files, named or found, are replaced by the Quill files
+// inside them.
+//------------------------------------------------------------------------------
+void QuillBatch::findFiles()
+{
+    QStringList files;
+    fInputs.clear();
+    qDeleteAll(fContainers);
+    fContainers.clear();
+
+    // Files named on the command line don't have a root.
+    for (int f = 0; f < fOptions.files.size(); f++) {
+        addInput(files, fOptions.files.at(f), QString());
+    }
+
+    QList<QRegExp> include;
+    QList<QRegExp> exclude;
+
+    for (int g = 0; g < fOptions.include.size(); g++) {
+        include.append(QRegExp(fOptions.include.at(g), Qt::CaseInsensitive, QRegExp::Wildcard));
+    }
+
+    for (int g = 0; g < fOptions.exclude.size(); g++) {
+        exclude.append(QRegExp(fOptions.exclude.at(g), Qt::CaseInsensitive, QRegExp::Wildcard));
+    }
+
+    for (int d = 0; d < fOptions.directories.size(); d++) {
+        QStringList found;
+        QDirIterator it(fOptions.directories.at(d),
+                        QDir::Files | QDir::NoDotAndDotDot | QDir::Readable,
+                        QDirIterator::Subdirectories);
+
+        while (it.hasNext()) {
+            const QString path = it.next();
+            const QString name = it.fileName();
+
+            if (!matchesAny(include, name) || matchesAny(exclude, name)) {
+                continue;
+            }
+
+            if (QuillDoc::looksLikeQuill(path) || QuillContainer::isContainer(path)) {
+                found.append(path);
+            }
+        }
+
+        found.sort();
+        for (int f = 0; f < found.size(); f++) {
+            addInput(files, found.at(f), fOptions.directories.at(d));
+        }
+    }
+
+    fOptions.files = files;
+    fOptions.directories.clear();
+}
+
+//------------------------------------------------------------------------------
+// Add a file to the batch, or the Quill files in it if it's a container. One
+// that can't be read is reported now, and counts as a failure.
+//------------------------------------------------------------------------------
+void QuillBatch::addInput(QStringList &files, const QString &fileName, const QString &root)
+{
+    inputFile input;
+    input.root = root;
+    input.container = nullptr;
+    input.entry = 0;
+
+    if (!QuillContainer::isContainer(fileName)) {
+        files.append(fileName);
+        fInputs.append(input);
+        return;
+    }
+
+    QString error;
+    input.container = QuillContainer::open(fileName, error);
+    if (!input.container) {
+        fReporter->error(fileName, error);
+        fFailures++;
+        return;
+    }
+
+    fContainers.append(input.container);
+
+    // The exports need somewhere to go, so each file gets a name as if the
+    // container had been extracted.
+    const QString directory = containerDirectory(fileName);
+    const QVector<containerEntry> &entries = input.container->entries();
+
+    for (int e = 0; e < entries.size(); e++) {
+        input.entry = e;
+        files.append(directory + '/' + entries.at(e).name);
+        fInputs.append(input);
+    }
+}
+
+// "disk.win" becomes "disk_win", in the same folder, the QDOS way.
+QString QuillBatch::containerDirectory(const QString &fileName)
+{
+    QFileInfo info(fileName);
+    QString name = info.fileName().replace('.', '_');
+
+    return (info.path() == ".") ? name : info.path() + '/' + name;
+}
+
+bool QuillBatch::matchesAny(const QList<QRegExp> &globs, const QString &name)
+{
+    for (int g = 0; g < globs.size(); g++) {
+        if (globs.at(g).exactMatch(name)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// Share the files out between the workers. Biggest first, each one going to
+// the worker with the least to do so far, so each queue is largest first too.
+// Files that can't be found are zero sized, they'll fail quickly anyway.
+//------------------------------------------------------------------------------
+static bool largerFile(const QPair<qint64, int> &a, const QPair<qint64, int> &b)
+{
+    // Equal sizes stay in command line order.
+    return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+void QuillBatch::shareWork(const int workers)
+{
+    QVector<QPair<qint64, int> > sizes;
+    sizes.reserve(fOptions.files.size());
+    fSizes.resize(fOptions.files.size());
+
+    for (int f = 0; f < fOptions.files.size(); f++) {
+        const inputFile &input = fInputs.at(f);
+        fSizes[f] = input.container ? input.container->entries().at(input.entry).size
+                                    : QFileInfo(fOptions.files.at(f)).size();
+        sizes.append(qMakePair(fSizes.at(f), f));
+    }
+
+    std::sort(sizes.begin(), sizes.end(), largerFile);
+
+    qDeleteAll(fQueues);
+    fQueues.clear();
+    for (int w = 0; w < workers; w++) {
+        workQueue *queue = new workQueue;
+        queue->bytes = 0;
+        fQueues.append(queue);
+    }
+
+    for (int f = 0; f < sizes.size(); f++) {
+        workQueue *lightest = fQueues.at(0);
+        for (int w = 1; w < workers; w++) {
+            if (fQueues.at(w)->bytes < lightest->bytes) {
+                lightest = fQueues.at(w);
+            }
+        }
+
+        lightest->files.append(sizes.at(f).second);
+        lightest->bytes += sizes.at(f).first;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Get the next file for a worker. Its own biggest file if it has any left,
+// otherwise the smallest file of the worker with the most bytes still queued.
+// Nothing is ever added to the queues, so when they are all empty, we're done.
+//------------------------------------------------------------------------------
+bool QuillBatch::takeWork(const int worker, int &index)
+{
+    // --on-error abort, and something has gone wrong? Nothing more starts.
+    // A file that failed may not be reported yet, if one before it is still
+    // going, so don't wait for the reporter to hear about it.
+    {
+        QMutexLocker locker(&fReportMutex);
+        if (fAborting || fReporter->aborted()) {
+            return false;
+        }
+    }
+
+    workQueue *own = fQueues.at(worker);
+    {
+        QMutexLocker locker(&own->mutex);
+        if (!own->files.isEmpty()) {
+            index = own->files.takeFirst();
+            own->bytes -= fSizes.at(index);
+            return true;
+        }
+    }
+
+    for (;;) {
+        // Pick a victim. The byte counts may be a little stale, that's fine.
+        workQueue *victim = nullptr;
+        qint64 most = -1;
+
+        for (int w = 0; w < fQueues.size(); w++) {
+            workQueue *queue = fQueues.at(w);
+            QMutexLocker locker(&queue->mutex);
+            if (!queue->files.isEmpty() && queue->bytes > most) {
+                victim = queue;
+                most = queue->bytes;
+            }
+        }
+
+        if (!victim) {
+            return false;
+        }
+
+        QMutexLocker locker(&victim->mutex);
+        if (!victim->files.isEmpty()) {
+            index = victim->files.takeLast();
+            victim->bytes -= fSizes.at(index);
+            return true;
+        }
+
+        // Someone else got there first, try again.
+    }
+}
+
+//------------------------------------------------------------------------------
+// Each worker decodes into the same buffers, file after file, so they are only
+// allocated again when a bigger file comes along. Each QuillDoc, and anything
+// built from it, is gone as soon as its file has been exported.
+//------------------------------------------------------------------------------
+void QuillBatch::work(const int worker)
+{
+    quillBuffers buffers;
+    int index;
+
+    for (;;) {
+        waitForMemory();
+
+        if (!takeWork(worker, index)) {
+            doneWithMemory();
+            return;
+        }
+
+        fileReport report;
+        BatchReport::clear(report);
+
+        QElapsedTimer timer;
+        timer.start();
+        exportFile(index, buffers, report);
+        report.wall = timer.nsecsElapsed() / 1000;
+        doneWithMemory();
+
+        if (!report.errors.isEmpty()) {
+            report.status = "failed";
+        }
+
+        finished(index, report);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Wait until there's memory to start another file. If nobody else is busy, we
+// go ahead anyway, or nothing would ever finish. Memory doesn't always come
+// back when a file finishes, so we have another look every so often as well.
+//------------------------------------------------------------------------------
+void QuillBatch::waitForMemory()
+{
+    QMutexLocker locker(&fMemoryMutex);
+
+    while (fOptions.maxRSS && fBusy > 0 && currentRSS() > fOptions.maxRSS) {
+        fMemoryFreed.wait(&fMemoryMutex, 100);
+    }
+
+    fBusy++;
+}
+
+void QuillBatch::doneWithMemory()
+{
+    QMutexLocker locker(&fMemoryMutex);
+
+    fBusy--;
+    fMemoryFreed.wakeAll();
+}
+
+//------------------------------------------------------------------------------
+// Resident set size of this process, in bytes. Zero if we can't tell, which
+// turns the budget off.
+//------------------------------------------------------------------------------
+qint64 QuillBatch::currentRSS()
+{
+#ifdef Q_OS_LINUX
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QFile::ReadOnly)) {
+        return 0;
+    }
+
+    // Total program size, then resident pages.
+    QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.size() < 2) {
+        return 0;
+    }
+
+    return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Note that a file is done, then report every file that can be - all of those
+// following on from the last one reported, up to the first that isn't done.
+//------------------------------------------------------------------------------
+void QuillBatch::finished(const int index, const fileReport &report)
+{
+    QMutexLocker locker(&fReportMutex);
+
+    fResults[index].done = true;
+    fResults[index].report = report;
+
+    if (!report.errors.isEmpty() && fReporter->policy() == ErrorReporter::Abort) {
+        fAborting = true;
+    }
+
+    reportDone();
+}
+
+// Report the done files that are next in line. The lock is held.
+void QuillBatch::reportDone()
+{
+    while (fNextReport < fResults.size() && fResults.at(fNextReport).done) {
+        fileReport &done = fResults[fNextReport].report;
+
+        for (int e = 0; e < done.errors.size(); e++) {
+            fReporter->error(fOptions.files.at(fNextReport), done.errors.at(e));
+        }
+
+        if (!done.errors.isEmpty()) {
+            fFailures++;
+        }
+
+        if (fReport) {
+            fReport->add(fOptions.files.at(fNextReport), done);
+        }
+
+        BatchReport::clear(done);
+        fNextReport++;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Once the workers have stopped, every file has either finished or, if the
+// batch was aborted, never started. Those are reported as skipped, so the
+// files that did finish after one that never started are reported too, and
+// --report has a line for every file.
+//------------------------------------------------------------------------------
+void QuillBatch::finishSkipped()
+{
+    QMutexLocker locker(&fReportMutex);
+
+    for (int f = fNextReport; f < fResults.size(); f++) {
+        if (!fResults.at(f).done) {
+            fResults[f].done = true;
+            fResults[f].report.status = "skipped";
+            fResults[f].report.inputBytes = fSizes.at(f);
+        }
+    }
+
+    reportDone();
+}
+
+//------------------------------------------------------------------------------
+// Parse one file, then write it in every format. What happened goes in report,
+// errors included. The caller times the lot.
+//------------------------------------------------------------------------------
+void QuillBatch::exportFile(const int index, quillBuffers &buffers, fileReport &report)
+{
+    const inputFile &input = fInputs.at(index);
+    QStringList &errors = report.errors;
+
+    report.inputBytes = fSizes.at(index);
+
+    cacheKey key;
+    QVector<exportJob> jobs = pendingJobs(index, key);
+
+    if (jobs.isEmpty()) {
+        report.status = "skipped";
+        return;
+    }
+
+    if (!makeFolder(index, errors)) {
+        return;
+    }
+
+    QByteArray contents;
+    QString error;
+    if (input.container && !readEntry(index, contents, error)) {
+        errors.append(error);
+        return;
+    }
+
+    // Headless, the QTextDocument is only built if a format needs it.
+    QScopedPointer<QuillDoc> doc(parseFile(fOptions.files.at(index), contents,
+                                           input.container != nullptr, buffers, report));
+    if (!doc) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    writeJobs(doc.data(), jobs, fParallelWriters);
+    finishJobs(index, jobs, key, report);
+
+    report.exportWall = timer.nsecsElapsed() / 1000;
+}
+
+//------------------------------------------------------------------------------
+// The exports this file still needs, in the order the formats were asked for.
+// Any the cache says are up to date are left out.
+//------------------------------------------------------------------------------
+QVector<exportJob> QuillBatch::pendingJobs(const int index, cacheKey &key)
+{
+    const QString &fileName = fOptions.files.at(index);
+    QVector<exportJob> jobs;
+
+    // Files in containers aren't files, so they can't be cached.
+    ExportCache *cache = fInputs.at(index).container ? nullptr : fCache;
+    if (cache) {
+        key = ExportCache::keyFor(fileName);
+    }
+
+    for (int f = 0; f < fOptions.formats.size(); f++) {
+        exportJob job;
+        job.format = fOptions.formats.at(f);
+        job.outputFile = QuillExporter::outputFileName(fileName, job.format);
+        job.ok = false;
+        job.toMemory = (fBundle != nullptr);
+        job.bytes = 0;
+        job.wall = 0;
+        job.cpu = 0;
+
+        // Already done, and nothing's changed since?
+        if (cache && cache->isCurrent(key, job.format, job.outputFile)) {
+            continue;
+        }
+
+        jobs.append(job);
+    }
+
+    return jobs;
+}
+
+// The container's folder, and any below it, won't be there the first time.
+bool QuillBatch::makeFolder(const int index, QStringList &errors)
+{
+    if (!fInputs.at(index).container || fBundle) {
+        return true;
+    }
+
+    const QString folder = QFileInfo(fOptions.files.at(index)).path();
+    if (!QDir().mkpath(folder)) {
+        errors.append("Can't create the folder " + folder);
+        return false;
+    }
+
+    return true;
+}
+
+bool QuillBatch::readEntry(const int index, QByteArray &contents, QString &error)
+{
+    const inputFile &input = fInputs.at(index);
+    return input.container->read(input.entry, contents, error);
+}
+
+//------------------------------------------------------------------------------
+// Read and decode one file, from disc, or from contents if it came out of a
+// container. Returns nullptr, with the error in report, if it isn't Quill.
+//------------------------------------------------------------------------------
+QuillDoc *QuillBatch::parseFile(const QString &fileName, const QByteArray &contents,
+                                const bool inMemory, quillBuffers &buffers, fileReport &report)
+{
+    QElapsedTimer timer;
+    timer.start();
+    qint64 cpu = BatchReport::threadCPU();
+
+    QuillDoc *doc;
+    if (inMemory) {
+        doc = QuillDoc::fromBytes(contents, true, &buffers);
+    } else {
+        doc = new QuillDoc(fileName, true, &buffers);
+    }
+
+    report.parseWall = timer.nsecsElapsed() / 1000;
+    report.parseCPU = BatchReport::cpuSince(cpu);
+
+    if (!doc->isValid()) {
+        report.errors.append("This is not a Quill file. " + doc->getError());
+        delete doc;
+        return nullptr;
+    }
+
+    report.dialect = doc->isPCFile() ? "DOS" : "QL";
+    report.textBytes = doc->getTextLength();
+    report.paragraphs = doc->getParagraphs().size();
+
+    return doc;
+}
+
+//------------------------------------------------------------------------------
+// Formats that only need the runs are written on the thread pool, if parallel,
+// while this thread builds the document, if needed, and writes HTML, ODF and
+// PDF from it. QTextDocument isn't thread safe, so those are written one at a
+// time, here.
+//------------------------------------------------------------------------------
+void QuillBatch::writeJobs(QuillDoc *Input, QVector<exportJob> &jobs, const bool parallel)
+{
+    QVector<exportJob *> runJobs;
+    QVector<exportJob *> documentJobs;
+
+    for (int j = 0; j < jobs.size(); j++) {
+        if (QuillExporter::needsDocument(jobs.at(j).format)) {
+            documentJobs.append(&jobs[j]);
+        } else {
+            runJobs.append(&jobs[j]);
+        }
+    }
+
+    QFuture<void> running;
+
+    if (parallel && runJobs.size() > 1) {
+        running = QtConcurrent::map(runJobs, [Input](exportJob *&job) { writeJob(Input, *job); });
+    } else {
+        for (int j = 0; j < runJobs.size(); j++) {
+            writeJob(Input, *runJobs.at(j));
+        }
+    }
+
+    for (int j = 0; j < documentJobs.size(); j++) {
+        writeJob(Input, *documentJobs.at(j));
+    }
+
+    running.waitForFinished();
+}
+
+//------------------------------------------------------------------------------
+// Add the written jobs to the bundle, or the cache, and to the report, in the
+// order the formats were asked for, whoever finished first.
+//------------------------------------------------------------------------------
+void QuillBatch::finishJobs(const int index, const QVector<exportJob> &jobs, cacheKey &key,
+                            fileReport &report)
+{
+    const inputFile &input = fInputs.at(index);
+    ExportCache *cache = input.container ? nullptr : fCache;
+
+    QDateTime modified;
+    if (fBundle) {
+        modified = input.container ? input.container->entries().at(input.entry).modified
+                                   : QFileInfo(fOptions.files.at(index)).lastModified();
+    }
+
+    for (int j = 0; j < jobs.size(); j++) {
+        const exportJob &job = jobs.at(j);
+        formatReport written;
+        written.format = job.format;
+        written.ok = job.ok;
+        written.bytes = job.bytes;
+        written.wall = job.wall;
+        written.cpu = job.cpu;
+
+        QString error;
+
+        if (!job.ok) {
+            report.errors.append(job.error);
+        } else if (fBundle) {
+            if (!fBundle->add(bundleName(index, job.format), job.data, modified, error)) {
+                report.errors.append(error);
+                written.ok = false;
+            }
+        } else if (cache) {
+            cache->update(key, job.format, job.outputFile);
+        }
+
+        report.formats.append(written);
+
+        // The formats ran on different threads, so add them up.
+        if (report.exportCPU >= 0) {
+            report.exportCPU = (job.cpu < 0) ? -1 : report.exportCPU + job.cpu;
+        }
+    }
+}
+
+void QuillBatch::writeJob(QuillDoc *Input, exportJob &job)
+{
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 cpu = BatchReport::threadCPU();
+
+    QuillExporter exporter(Input);
+
+    if (job.toMemory) {
+        QBuffer buffer;
+        buffer.open(QBuffer::WriteOnly);
+        job.ok = exporter.write(job.format, &buffer);
+        job.data = buffer.data();
+    } else {
+        job.ok = exporter.writeFile(job.format, job.outputFile);
+    }
+
+    if (!job.ok) {
+        job.error = exporter.errorString();
+    }
+
+    job.bytes = job.toMemory ? job.data.size() : (job.ok ? QFileInfo(job.outputFile).size() : 0);
+    job.wall = timer.nsecsElapsed() / 1000;
+    job.cpu = BatchReport::cpuSince(cpu);
+}
+
+//------------------------------------------------------------------------------
+// The name of an export in the bundle. Files found by --recursive keep their
+// place in the tree under that directory. Files given by name keep theirs
+// under fBundleRoot, or are just the name if there's no root they share.
+//------------------------------------------------------------------------------
+QString QuillBatch::bundleName(const int index, const QuillExporter::Format format)
+{
+    const QString output = QuillExporter::outputFileName(fOptions.files.at(index), format);
+    const QString root = fInputs.at(index).root.isEmpty() ? fBundleRoot : fInputs.at(index).root;
+
+    QString name;
+    if (!root.isEmpty()) {
+        name = QDir(root).relativeFilePath(output);
+    }
+
+    if (name.isEmpty() || name.startsWith("../") || QDir::isAbsolutePath(name)) {
+        name = QFileInfo(output).fileName();
+    }
+
+    return name;
+}
+
+//------------------------------------------------------------------------------
+// The current directory, if every file given by name is somewhere under it.
+// Otherwise the deepest directory they all share, so a/x_doc and b/x_doc stay
+// apart in the bundle. Empty if they share nothing at all, different drives
+// on Windows.
+//------------------------------------------------------------------------------
+QString QuillBatch::namedRoot() const
+{
+    const QString current = QDir::cleanPath(QDir::currentPath());
+    const QString currentPrefix = current.endsWith('/') ? current : current + '/';
+    bool underCurrent = true;
+    bool first = true;
+    QStringList common;
+
+    for (int f = 0; f < fOptions.files.size(); f++) {
+        if (!fInputs.at(f).root.isEmpty()) {
+            continue;
+        }
+
+        const QString directory = QDir::cleanPath(QFileInfo(fOptions.files.at(f)).absolutePath());
+        if (directory != current && !directory.startsWith(currentPrefix)) {
+            underCurrent = false;
+        }
+
+        const QStringList parts = directory.split('/');
+        if (first) {
+            common = parts;
+            first = false;
+            continue;
+        }
+
+        int same = 0;
+        while (same < common.size() && same < parts.size() && common.at(same) == parts.at(same)) {
+            same++;
+        }
+        common = common.mid(0, same);
+    }
+
+    if (underCurrent) {
+        return current;
+    }
+
+    // "/a/b" splits into "", "a" and "b", and "C:/a" into "C:" and "a", so
+    // the root directory needs its slash back.
+    if (common.size() == 1) {
+        return common.at(0) + '/';
+    }
+
+    return common.join("/");
+}
@@ -0,0 +1,221 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <QList>
+#include <QRegExp>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QWaitCondition>
+
+#include "errorreporter.h"
+#include "quillexport.h"
+#include "report.h"
+
+class BatchReport;
+class BundleWriter;
+class ExportCache;
+class QuillContainer;
+class QuillDoc;
+struct cacheKey;
+struct quillBuffers;
+
+// Exit codes for the command line version.
+const int EXIT_OK = 0;                  // Everything exported.
+const int EXIT_FAILURES = 1;            // At least one file failed.
+const int EXIT_USAGE = 2;               // Bad command line.
+const int EXIT_ABORTED = 3;             // Stopped early, --on-error abort.
+
+// What the command line asked for.
+typedef struct batchOptions {
+    bool help;
+    int jobs;                               // Files exported at once, -j N.
+    qint64 maxRSS;                          // Memory budget in bytes, 0 = none.
+    QList<QuillExporter::Format> formats;   // In the order asked for.
+    QStringList files;
+    QStringList directories;                // --recursive, searched by run().
+    QStringList include;                    // Globs for files in directories.
+    QStringList exclude;
+    QString cacheDirectory;                 // --cache, empty for none.
+    bool prune;                             // Delete orphaned outputs.
+    QString watchDirectory;                 // --watch, a hot folder.
+    int settle;                             // Msecs a file must be unchanged.
+    QString from;                           // --from, "-" for stdin.
+    bool serve;                             // --serve, the local server.
+    QString serverName;                     // --socket name for the server.
+    QString bundle;                         // --bundle zip or tar, or empty.
+    QString report;                         // --report JSON Lines, or empty.
+    QString errorLog;                       // --error-log, or empty for stderr.
+    ErrorReporter::Policy onError;          // --on-error continue or abort.
+    bool isolate;                           // --isolate, a process per worker.
+    int timeout;                            // Seconds per file, 0 = forever.
+    bool worker;                            // --worker, one of those processes.
+} batchOptions;
+
+// One output file, for one input file. Filled in by the writer.
+typedef struct exportJob {
+    QuillExporter::Format format;
+    QString outputFile;
+    bool ok;
+    QString error;
+    bool toMemory;                          // Into data, for the bundle.
+    QByteArray data;
+    qint64 bytes;                           // Written, for --report.
+    qint64 wall;                            // Microseconds.
+    qint64 cpu;                             // Ditto, -1 if we can't tell.
+} exportJob;
+
+// Where one input file comes from, by index into batchOptions::files.
+typedef struct inputFile {
+    QString root;                       // --recursive directory, or empty.
+    QuillContainer *container;          // Disc image or zip, or nullptr.
+    int entry;                          // Which one in the container.
+} inputFile;
+
+// A worker's share of the files, largest first. The owner takes from the front,
+// idle workers steal from the back.
+typedef struct workQueue {
+    QMutex mutex;
+    QList<int> files;                   // Indexes into batchOptions::files.
+    qint64 bytes;                       // Total size of the files still queued.
+} workQueue;
+
+// How one input file went. Kept until all the files before it are reported.
+typedef struct fileResult {
+    bool done;
+    fileReport report;                  // Errors, and the --report details.
+} fileResult;
+
+
+// Exports a list of Quill files, without any GUI. Each file is parsed once and
+// written in all the requested formats. Errors go to an ErrorReporter, never a
+// dialog, and the batch carries on with the next file unless told to abort.
+//
+// With -j N, N workers export files at once, each with its own QuillDoc and
+// exporters. Errors are held back until every earlier file has been reported,
+// so the output is in command line order however the workers finish.
+//
+// Quill file sizes are very skewed, so the files are shared out largest first,
+// each to the worker with the fewest bytes so far. A worker that runs out
+// steals from whoever has the most bytes left. The big files all start early
+// and nobody is left chewing on a giant at the end.
+//
+// Memory is bounded too. Each file's QuillDoc goes as soon as it's exported,
+// each worker reuses its decode buffers, and --max-rss holds back new files
+// while the process is over budget.
+//
+// Disc images and zip files are opened, not exported. Their Quill documents
+// are read straight out of them, and exported into a folder named after the
+// container, "disk_win" for "disk.win", beside it.
+//
+// With --isolate the workers are processes, not threads, see isolate.cpp. A
+// file that crashes the parser, or takes forever, only takes its worker with
+// it. The rest of the batch carries on as normal.
+
+class QuillBatch {
+
+public:
+    QuillBatch(const batchOptions &Options);
+    ~QuillBatch();
+
+    // Parse the command line. Returns false, with a message, if it's rubbish.
+    static bool parseArgs(const QStringList &args, batchOptions &Options, QString &error);
+
+    // "256M" etc, as given to --max-rss.
+    static bool parseSize(const QString &size, qint64 &bytes);
+
+    // "pdf,html,rst" as given to --formats.
+    static bool parseFormatList(const QString &list, batchOptions &Options, QString &error);
+
+    // Does this batch need a QGuiApplication for fonts and painting?
+    static bool needsDocument(const batchOptions &Options);
+
+    static QString usage();
+
+    // The reporter the options ask for, or nullptr, with a message.
+    static ErrorReporter *makeReporter(const batchOptions &Options, QString &error);
+
+    // Use this reporter, not one of our own. It must outlive us.
+    void    setReporter(ErrorReporter *Reporter);
+
+    // Export everything, returns one of the EXIT_xxx codes.
+    int     run();
+
+private:
+    friend class batchWorker;
+    friend class WorkerPool;
+
+    int     convertStream();
+    void    findFiles();
+    void    addInput(QStringList &files, const QString &fileName, const QString &root);
+    static QString containerDirectory(const QString &fileName);
+    void    finishCache();
+    static bool matchesAny(const QList<QRegExp> &globs, const QString &name);
+
+    void    runThreads(const int workers);
+    void    work(const int worker);
+    bool    takeWork(const int worker, int &index);
+    void    shareWork(const int workers);
+    void    finished(const int index, const fileReport &report);
+    void    reportDone();
+    void    finishSkipped();
+    void    waitForMemory();
+    void    doneWithMemory();
+    static qint64 currentRSS();
+    void    exportFile(const int index, quillBuffers &buffers, fileReport &report);
+    QVector<exportJob> pendingJobs(const int index, cacheKey &key);
+    bool    makeFolder(const int index, QStringList &errors);
+    bool    readEntry(const int index, QByteArray &contents, QString &error);
+    void    finishJobs(const int index, const QVector<exportJob> &jobs, cacheKey &key,
+                       fileReport &report);
+    QString bundleName(const int index, const QuillExporter::Format format);
+    QString namedRoot() const;
+    static QuillDoc *parseFile(const QString &fileName, const QByteArray &contents,
+                               const bool inMemory, quillBuffers &buffers, fileReport &report);
+    static void writeJobs(QuillDoc *Input, QVector<exportJob> &jobs, const bool parallel);
+    static void writeJob(QuillDoc *Input, exportJob &job);
+
+    batchOptions fOptions;
+    bool fParallelWriters;              // Only when there's one worker.
+    ExportCache *fCache;                // Only during run(), if --cache.
+    BundleWriter *fBundle;              // Only during run(), if --bundle.
+    QString fBundleRoot;                // What named files' bundle names are relative to.
+    BatchReport *fReport;               // Only during run(), if --report.
+    ErrorReporter *fReporter;           // Made by run() if nobody set one.
+    bool fOwnsReporter;
+    QVector<inputFile> fInputs;         // One per file.
+    QList<QuillContainer *> fContainers;
+
+    QVector<workQueue *> fQueues;       // One per worker.
+    QVector<qint64> fSizes;             // Of each file, when we started.
+    QMutex fReportMutex;                // Guards the rest.
+    QVector<fileResult> fResults;
+    int fNextReport;                    // First file not yet reported.
+    int fFailures;
+    bool fAborting;                     // --on-error abort, and a file failed.
+
+    QMutex fMemoryMutex;                // Guards fBusy.
+    QWaitCondition fMemoryFreed;
+    int fBusy;                          // Files being exported right now.
+};
+
+#endif
@@ -0,0 +1,20 @@
+######################################################################
+# quillscan-bench - times the span decoder, and findControlByte(), against
+# the character at a time loop parseText() used before them.
+#
+#   cd bench && qmake && make && ./quillscan-bench
+######################################################################
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += concurrent
+TEMPLATE = app
+CONFIG += c++11 console release
+CONFIG -= app_bundle
+TARGET = quillscan-bench
+INCLUDEPATH += ..
+
+# Where libC68.doc is, unless another file is given on the command line.
+DEFINES += TESTFILES=\\\"$$PWD/../TestFiles\\\"
+
+# Input
+HEADERS += ../quill.h ../quillscan.h
+SOURCES += quillscan_bench.cpp ../quill.cpp ../quillscan.cpp
@@ -0,0 +1,431 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+// quillscan-bench [file.doc]
+//
+// Decodes a Quill file, libC68.doc by default, and a made up 8MB document,
+// two ways. Once with the character at a time loop parseText() used before
+// there was a scanner, translating and switching on every byte, and once with
+// QuillDoc itself, headless, as a batch does it, which finds the control
+// codes with findControlByte() and translates the text between them a span
+// at a time. Prints the speed of each, and fails if they don't decode to
+// exactly the same text and attributes. Then the same for just finding the
+// control bytes, findControlByte() against a byte at a time loop.
+//
+// QuillDoc decodes text areas of 512KB or more on several threads, so the
+// made up document measures that too.
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QScopedPointer>
+#include <QTextStream>
+#include <QVector>
+
+#include "quill.h"
+#include "quillscan.h"
+
+// What parseText() did before there was a scanner.
+static quint32 oldFindControlByte(const uchar *data, quint32 from, quint32 to)
+{
+    while (from < to && !isControlByte(data[from])) {
+        ++from;
+    }
+
+    return from;
+}
+
+typedef quint32 (*scanner)(const uchar *, quint32, quint32);
+
+// Every control byte's offset, as parseText() would find them.
+static QVector<quint32> scanAll(scanner scan, const QByteArray &buffer)
+{
+    const uchar *data = reinterpret_cast<const uchar *>(buffer.constData());
+    const quint32 size = quint32(buffer.size());
+    QVector<quint32> offsets;
+
+    for (quint32 at = scan(data, 0, size); at < size; at = scan(data, at + 1, size)) {
+        offsets.append(at);
+    }
+
+    return offsets;
+}
+
+// Best of a few runs, in MB a second.
+static double timeScan(scanner scan, const QByteArray &buffer, const int repeats)
+{
+    qint64 best = -1;
+
+    for (int run = 0; run < 5; run++) {
+        QElapsedTimer timer;
+        timer.start();
+
+        int found = 0;
+        for (int r = 0; r < repeats; r++) {
+            found += scanAll(scan, buffer).size();
+        }
+
+        const qint64 elapsed = timer.nsecsElapsed();
+        if (found >= 0 && (best < 0 || elapsed < best)) {
+            best = elapsed;
+        }
+    }
+
+    return (double(buffer.size()) * repeats / (1024.0 * 1024.0)) / (qMax(best, qint64(1)) / 1e9);
+}
+
+static bool benchScan(const QString &name, const QByteArray &buffer, const int repeats)
+{
+    QTextStream out(stdout);
+
+    const QVector<quint32> oldOffsets = scanAll(oldFindControlByte, buffer);
+    const QVector<quint32> newOffsets = scanAll(findControlByte, buffer);
+
+    if (oldOffsets != newOffsets) {
+        out << name << ": MISMATCH, the old loop found " << oldOffsets.size()
+            << " control bytes, findControlByte() found " << newOffsets.size() << "\n";
+        return false;
+    }
+
+    const double oldSpeed = timeScan(oldFindControlByte, buffer, repeats);
+    const double newSpeed = timeScan(findControlByte, buffer, repeats);
+
+    out << name << ": " << buffer.size() << " bytes, " << newOffsets.size() << " control bytes\n"
+        << "    old loop          " << qRound(oldSpeed) << " MB/s\n"
+        << "    findControlByte() " << qRound(newSpeed) << " MB/s, "
+        << QString::number(newSpeed / oldSpeed, 'f', 1) << " times faster\n";
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// A Quill file around some text, with an empty page header and footer, and no
+// tables. The header length is read big endian first, 20 for a QL file. A DOS
+// file's is 20 little endian, which reads as 5120, and the rest of its header
+// is little endian too.
+//------------------------------------------------------------------------------
+static QByteArray quillFile(const QByteArray &text, const bool pcFile)
+{
+    const quint32 textEnd = quint32(20 + 2 + text.size());
+    QByteArray file;
+
+    file += pcFile ? QByteArray("\x14\x00", 2) : QByteArray("\x00\x14", 2);
+    file += "vrm1qdf0";
+    for (int b = 0; b < 4; b++) {
+        const int shift = pcFile ? 8 * b : 8 * (3 - b);
+        file += char((textEnd >> shift) & 0xff);
+    }
+    file += QByteArray(6, '\0');           // No tables.
+    file += QByteArray(2, '\0');           // No header or footer.
+    file += text;
+
+    return file;
+}
+
+//------------------------------------------------------------------------------
+// The old loop translated with QuillDoc::translate(), which is private. The
+// table is got from QuillDoc instead, by decoding every byte that isn't a
+// control code, once each, in order.
+//------------------------------------------------------------------------------
+static QVector<QChar> translationTable(const bool pcFile)
+{
+    QByteArray text;
+    for (int c = 1; c < 256; c++) {
+        if (!isControlByte(uchar(c))) {
+            text += char(c);
+        }
+    }
+
+    QScopedPointer<QuillDoc> doc(QuillDoc::fromBytes(quillFile(text, pcFile), true));
+    const QString &translated = doc->getTextBuffer();
+
+    QVector<QChar> table(256);
+    int t = 0;
+    for (int c = 1; c < 256 && t < translated.size(); c++) {
+        if (!isControlByte(uchar(c))) {
+            table[c] = translated.at(t++);
+        }
+    }
+
+    return table;
+}
+
+// What the old loop made, and what QuillDoc makes.
+typedef struct decoded {
+    QString text;
+    QVector<textRun> runs;
+    QVector<textParagraph> paragraphs;
+} decoded;
+
+static void closeRun(decoded &out, int &runStart, const quint8 attributes, textParagraph &paragraph)
+{
+    if (out.text.size() > runStart) {
+        textRun run;
+        run.start = quint32(runStart);
+        run.length = quint32(out.text.size() - runStart);
+        run.attributes = attributes;
+        out.runs.append(run);
+        paragraph.runCount++;
+    }
+
+    runStart = out.text.size();
+}
+
+//------------------------------------------------------------------------------
+// What parseText() did before there was a scanner: every byte through the
+// switch, and every character appended on its own.
+//------------------------------------------------------------------------------
+static void oldDecode(const uchar *data, quint32 pointer, const quint32 textEnd,
+                      const QVector<QChar> &table, decoded &out)
+{
+    out.text.clear();
+    out.runs.clear();
+    out.paragraphs.clear();
+    if (textEnd > pointer) {
+        out.text.reserve(textEnd - pointer);
+    }
+
+    quint8 attributes = 0;
+    int runStart = 0;
+    textParagraph paragraph = {0, 0};
+    bool SuperOn = false;
+    bool SubOn = false;
+
+    while (pointer < textEnd) {
+       const quint8 Char = data[pointer++];
+
+       switch (Char) {
+         case 0 : closeRun(out, runStart, attributes, paragraph);
+                  out.paragraphs.append(paragraph);
+                  paragraph.firstRun = quint32(out.runs.size());
+                  paragraph.runCount = 0;
+                  attributes = 0;
+                  SuperOn = SubOn = false;
+                  break;
+
+         case 12: break;
+
+         case 15: closeRun(out, runStart, attributes, paragraph);
+                  attributes ^= ATTR_BOLD;
+                  break;
+
+         case 16: closeRun(out, runStart, attributes, paragraph);
+                  attributes ^= ATTR_UNDERLINE;
+                  break;
+
+         case 17: closeRun(out, runStart, attributes, paragraph);
+                  attributes &= ~(ATTR_SUBSCRIPT | ATTR_SUPERSCRIPT);
+                  if (!SubOn) {
+                      attributes |= ATTR_SUBSCRIPT;
+                  }
+                  SubOn = !SubOn;
+                  break;
+
+         case 18: closeRun(out, runStart, attributes, paragraph);
+                  attributes &= ~(ATTR_SUBSCRIPT | ATTR_SUPERSCRIPT);
+                  if (!SuperOn) {
+                      attributes |= ATTR_SUPERSCRIPT;
+                  }
+                  SuperOn = !SuperOn;
+                  break;
+
+         case 19: closeRun(out, runStart, attributes, paragraph);
+                  attributes ^= ATTR_ITALIC;
+                  break;
+
+         case 30: break;
+
+         default: out.text.append(table.at(Char));
+       }
+    }
+
+    closeRun(out, runStart, attributes, paragraph);
+    out.paragraphs.append(paragraph);
+}
+
+// Where the body text starts, after the page header and footer.
+static quint32 bodyStart(const uchar *data)
+{
+    quint32 pointer = 20;
+    for (int skip = 0; skip < 2; skip++) {
+        while (data[pointer++] != 0) {
+        }
+    }
+
+    return pointer;
+}
+
+//------------------------------------------------------------------------------
+// QuillDoc merges neighbouring runs with the same attributes, the old loop
+// didn't, so the runs are compared a character at a time. Each paragraph's
+// text must be the same too.
+//------------------------------------------------------------------------------
+static QByteArray attributesOf(const decoded &out)
+{
+    QByteArray attributes(out.text.size(), '\0');
+    for (int r = 0; r < out.runs.size(); r++) {
+        const textRun &run = out.runs.at(r);
+        for (quint32 c = 0; c < run.length; c++) {
+            attributes[int(run.start + c)] = char(run.attributes);
+        }
+    }
+
+    return attributes;
+}
+
+static QVector<int> paragraphEnds(const decoded &out)
+{
+    QVector<int> ends;
+    for (int p = 0; p < out.paragraphs.size(); p++) {
+        const textParagraph &paragraph = out.paragraphs.at(p);
+        if (paragraph.runCount == 0) {
+            ends.append(-1);
+        } else {
+            const textRun &run = out.runs.at(int(paragraph.firstRun + paragraph.runCount - 1));
+            ends.append(int(run.start + run.length));
+        }
+    }
+
+    return ends;
+}
+
+static bool sameDecode(const decoded &a, const decoded &b)
+{
+    return a.text == b.text && attributesOf(a) == attributesOf(b) && paragraphEnds(a) == paragraphEnds(b);
+}
+
+static bool benchDecode(const QString &name, const QByteArray &file, const int repeats)
+{
+    QTextStream out(stdout);
+
+    QScopedPointer<QuillDoc> doc(QuillDoc::fromBytes(file, true));
+    if (!doc->isValid()) {
+        out << name << ": not a Quill file, " << doc->getError() << "\n";
+        return false;
+    }
+
+    const uchar *data = reinterpret_cast<const uchar *>(file.constData());
+    const quint32 from = bodyStart(data);
+    const quint32 to = doc->getTextLength();
+    const QVector<QChar> table = translationTable(doc->isPCFile());
+
+    decoded oldWay;
+    oldDecode(data, from, to, table, oldWay);
+
+    decoded newWay;
+    newWay.text = doc->getTextBuffer();
+    newWay.runs = doc->getRuns();
+    newWay.paragraphs = doc->getParagraphs();
+
+    if (!sameDecode(oldWay, newWay)) {
+        out << name << ": MISMATCH, the old loop decoded " << oldWay.text.size() << " characters in "
+            << oldWay.paragraphs.size() << " paragraphs, QuillDoc " << newWay.text.size()
+            << " characters in " << newWay.paragraphs.size() << " paragraphs\n";
+        return false;
+    }
+
+    doc.reset();
+
+    // Best of a few runs, each reusing its buffers, as a batch worker does.
+    qint64 oldBest = -1;
+    qint64 newBest = -1;
+    quillBuffers buffers;
+
+    for (int run = 0; run < 5; run++) {
+        QElapsedTimer timer;
+        timer.start();
+        for (int r = 0; r < repeats; r++) {
+            oldDecode(data, from, to, table, oldWay);
+        }
+        qint64 elapsed = timer.nsecsElapsed();
+        if (oldBest < 0 || elapsed < oldBest) {
+            oldBest = elapsed;
+        }
+
+        timer.start();
+        for (int r = 0; r < repeats; r++) {
+            delete QuillDoc::fromBytes(file, true, &buffers);
+        }
+        elapsed = timer.nsecsElapsed();
+        if (newBest < 0 || elapsed < newBest) {
+            newBest = elapsed;
+        }
+    }
+
+    const double megabytes = double(file.size()) * repeats / (1024.0 * 1024.0);
+    const double oldSpeed = megabytes / (qMax(oldBest, qint64(1)) / 1e9);
+    const double newSpeed = megabytes / (qMax(newBest, qint64(1)) / 1e9);
+
+    out << name << ": " << file.size() << " bytes, " << newWay.paragraphs.size() << " paragraphs, "
+        << newWay.runs.size() << " runs\n"
+        << "    old decode loop   " << qRound(oldSpeed) << " MB/s\n"
+        << "    QuillDoc          " << qRound(newSpeed) << " MB/s, "
+        << QString::number(newSpeed / oldSpeed, 'f', 1) << " times faster\n";
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Text much like a real document's: words, with a toggle now and then and a
+// paragraph end every few hundred bytes. Always the same, so runs compare.
+//------------------------------------------------------------------------------
+static QByteArray madeUpText(const int size)
+{
+    static const char controls[] = { 0x00, 0x0C, 0x0F, 0x10, 0x11, 0x12, 0x13, 0x1E };
+    QByteArray text(size, ' ');
+    quint32 seed = 20090101;
+
+    for (int b = 0; b < size; b++) {
+        seed = seed * 1103515245 + 12345;
+        const quint32 r = (seed >> 16) & 0x7FFF;
+
+        if (r % 97 == 0) {
+            text[b] = controls[r % sizeof(controls)];
+        } else if (r % 7 == 0) {
+            text[b] = ' ';
+        } else {
+            // Printable, including the QL's top half characters.
+            text[b] = char(0x20 + r % 0xDF);
+        }
+    }
+
+    return text;
+}
+
+int main(int argc, char *argv[])
+{
+    const QString fileName = (argc > 1) ? QString::fromLocal8Bit(argv[1])
+                                        : QString(TESTFILES) + "/libC68.doc";
+
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly)) {
+        QTextStream(stderr) << "Cannot read " << fileName << ": " << file.errorString() << "\n";
+        return 2;
+    }
+
+    const QByteArray contents = file.readAll();
+    const QByteArray text = madeUpText(8 * 1024 * 1024);
+
+    QTextStream(stdout) << "Decoding\n";
+    bool ok = benchDecode(fileName, contents, 200);
+    ok = benchDecode("8MB made up document", quillFile(text, false), 2) && ok;
+
+    QTextStream(stdout) << "\nFinding control bytes\n";
+    ok = benchScan(fileName, contents, 200) && ok;
+    ok = benchScan("8MB of made up text", text, 2) && ok;
+
+    return ok ? 0 : 1;
+}
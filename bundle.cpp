@@ -0,0 +1,458 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#include <QFileInfo>
+#include <QMutexLocker>
+
+#include "bundle.h"
+
+#include <cstring>
+
+//------------------------------------------------------------------------------
+// Zip numbers are all little endian.
+//------------------------------------------------------------------------------
+static void put16(QByteArray &out, const quint16 value)
+{
+    out.append(char(value & 0xff));
+    out.append(char(value >> 8));
+}
+
+static void put32(QByteArray &out, const quint32 value)
+{
+    put16(out, quint16(value & 0xffff));
+    put16(out, quint16(value >> 16));
+}
+
+static void put64(QByteArray &out, const quint64 value)
+{
+    put32(out, quint32(value & 0xffffffff));
+    put32(out, quint32(value >> 32));
+}
+
+// Tar numbers are octal text, zero padded, and null terminated.
+static void putOctal(QByteArray &header, const int offset, const int width, const qint64 value)
+{
+    QByteArray digits = QByteArray::number(value, 8).rightJustified(width - 1, '0');
+    memcpy(header.data() + offset, digits.constData(), size_t(width - 1));
+    header[offset + width - 1] = '\0';
+}
+
+
+BundleWriter::BundleWriter()
+{
+    fZip = true;
+    fOffset = 0;
+    fBroken = false;
+}
+
+BundleWriter::~BundleWriter()
+{
+    if (fFile.isOpen()) {
+        QString error;
+        close(error);
+    }
+}
+
+bool BundleWriter::isBundleName(const QString &fileName)
+{
+    const QString suffix = QFileInfo(fileName).suffix().toLower();
+    return suffix == "zip" || suffix == "tar";
+}
+
+bool BundleWriter::open(const QString &fileName, QString &error)
+{
+    if (!isBundleName(fileName)) {
+        error = fileName + " must end in .zip or .tar.";
+        return false;
+    }
+
+    fZip = QFileInfo(fileName).suffix().toLower() == "zip";
+    fOffset = 0;
+    fBroken = false;
+    fEntries.clear();
+    fNames.clear();
+
+    fFile.setFileName(fileName);
+    if (!fFile.open(QFile::WriteOnly | QFile::Truncate)) {
+        error = QString("Cannot write %1:\n%2.").arg(fileName).arg(fFile.errorString());
+        return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// The CRC and compression, or the tar headers, are done on the caller's thread.
+// Only the write itself is done one at a time, so the workers don't all queue
+// up behind one deflate.
+//------------------------------------------------------------------------------
+bool BundleWriter::add(const QString &name, const QByteArray &data, const QDateTime &modified, QString &error)
+{
+    const QByteArray entryName = name.toUtf8();
+    zipEntry entry;
+    QByteArray out;
+
+    if (fZip) {
+        prepareZip(entryName, data, modified, entry, out);
+    } else {
+        out = prepareTar(entryName, data, modified);
+    }
+
+    QMutexLocker locker(&fMutex);
+
+    if (fBroken) {
+        error = QString("Cannot add %1 to %2, an earlier write to it failed.").arg(name).arg(fFile.fileName());
+        return false;
+    }
+
+    if (fNames.contains(name)) {
+        error = QString("%1 is already in %2, so this one wasn't added.").arg(name).arg(fFile.fileName());
+        return false;
+    }
+
+    bool ok = fZip ? addZip(entry, out) : addTar(out);
+    if (ok) {
+        fNames.insert(name);
+    } else {
+        fBroken = true;
+        error = QString("Cannot write %1 to %2:\n%3.").arg(name).arg(fFile.fileName()).arg(fFile.errorString());
+    }
+
+    return ok;
+}
+
+bool BundleWriter::close(QString &error)
+{
+    QMutexLocker locker(&fMutex);
+
+    if (!fFile.isOpen()) {
+        return true;
+    }
+
+    // Half a zip that looks whole is worse than none at all.
+    if (fBroken) {
+        fFile.close();
+        fFile.remove();
+        error = QString("%1 is incomplete, as a write to it failed, so it has been deleted.").arg(fFile.fileName());
+        return false;
+    }
+
+    bool ok = fZip ? closeZip() : closeTar();
+    fFile.close();
+
+    if (!ok || fFile.error() != QFile::NoError) {
+        error = QString("Cannot write %1:\n%2.").arg(fFile.fileName()).arg(fFile.errorString());
+        return false;
+    }
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Everything about a zip entry except where it goes. Level 6, zlib's default,
+// is much quicker than 9, and hardly any bigger on text.
+//------------------------------------------------------------------------------
+void BundleWriter::prepareZip(const QByteArray &name, const QByteArray &data, const QDateTime &modified,
+                              zipEntry &entry, QByteArray &body)
+{
+    entry.name = name;
+    entry.crc = crc32(data);
+    entry.size = quint32(data.size());
+    entry.offset = 0;
+
+    QDateTime when = modified.isValid() ? modified : QDateTime::currentDateTime();
+    if (when.date().year() < 1980) {
+        when = QDateTime(QDate(1980, 1, 1), QTime(0, 0));
+    }
+    entry.dosTime = quint16((when.time().hour() << 11) | (when.time().minute() << 5) | (when.time().second() / 2));
+    entry.dosDate = quint16(((when.date().year() - 1980) << 9) | (when.date().month() << 5) | when.date().day());
+
+    // qCompress() gives a 4 byte length, a 2 byte zlib header, the deflated
+    // data and a 4 byte Adler-32. Zip wants just the deflated data.
+    body = data;
+    entry.method = 0;
+
+    if (data.size() > 64) {
+        QByteArray compressed = qCompress(data, 6);
+        if (compressed.size() > 10 && compressed.size() - 10 < data.size()) {
+            body = compressed.mid(6, compressed.size() - 10);
+            entry.method = 8;
+        }
+    }
+
+    entry.compressedSize = quint32(body.size());
+}
+
+//------------------------------------------------------------------------------
+// A zip entry: local header, then the data. The sizes and CRC are known up
+// front, so there's no data descriptor after it. Called with the lock held.
+//------------------------------------------------------------------------------
+bool BundleWriter::addZip(zipEntry &entry, const QByteArray &body)
+{
+    const QByteArray &name = entry.name;
+    entry.offset = fOffset;
+
+    QByteArray header;
+    put32(header, 0x04034b50);          // Local file header signature.
+    put16(header, 20);                  // Version needed, 2.0.
+    put16(header, 0x0800);              // Names are UTF-8.
+    put16(header, entry.method);
+    put16(header, entry.dosTime);
+    put16(header, entry.dosDate);
+    put32(header, entry.crc);
+    put32(header, entry.compressedSize);
+    put32(header, entry.size);
+    put16(header, quint16(name.size()));
+    put16(header, 0);                   // No extra field.
+    header.append(name);
+
+    if (fFile.write(header) != header.size() || fFile.write(body) != body.size()) {
+        return false;
+    }
+
+    fOffset += quint64(header.size()) + quint64(body.size());
+    fEntries.append(entry);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// The central directory, then the end records. Offsets past 4GB, and more than
+// 65,535 entries, need the zip64 versions.
+//------------------------------------------------------------------------------
+bool BundleWriter::closeZip()
+{
+    const quint64 directoryOffset = fOffset;
+    QByteArray directory;
+
+    for (int e = 0; e < fEntries.size(); e++) {
+        const zipEntry &entry = fEntries.at(e);
+        const bool zip64 = entry.offset >= 0xffffffffULL;
+
+        put32(directory, 0x02014b50);   // Central directory header signature.
+        put16(directory, 0x0300 | 45);  // Made by Unix, version 4.5.
+        put16(directory, zip64 ? 45 : 20);
+        put16(directory, 0x0800);
+        put16(directory, entry.method);
+        put16(directory, entry.dosTime);
+        put16(directory, entry.dosDate);
+        put32(directory, entry.crc);
+        put32(directory, entry.compressedSize);
+        put32(directory, entry.size);
+        put16(directory, quint16(entry.name.size()));
+        put16(directory, zip64 ? 12 : 0);
+        put16(directory, 0);            // No comment.
+        put16(directory, 0);            // Disk number.
+        put16(directory, 0);            // Internal attributes.
+        put32(directory, 0100644U << 16);
+        put32(directory, zip64 ? 0xffffffffU : quint32(entry.offset));
+        directory.append(entry.name);
+
+        if (zip64) {
+            put16(directory, 0x0001);   // Zip64 extra field, offset only.
+            put16(directory, 8);
+            put64(directory, entry.offset);
+        }
+
+        // Don't let the directory get too big in memory.
+        if (directory.size() > 1024 * 1024) {
+            if (fFile.write(directory) != directory.size()) {
+                return false;
+            }
+            fOffset += quint64(directory.size());
+            directory.clear();
+        }
+    }
+
+    if (fFile.write(directory) != directory.size()) {
+        return false;
+    }
+    fOffset += quint64(directory.size());
+
+    const quint64 directorySize = fOffset - directoryOffset;
+    const quint64 entries = quint64(fEntries.size());
+    const bool zip64 = entries > 0xffff || directoryOffset >= 0xffffffffULL ||
+                       directorySize >= 0xffffffffULL;
+
+    QByteArray end;
+
+    if (zip64) {
+        const quint64 zip64End = fOffset;
+
+        put32(end, 0x06064b50);         // Zip64 end of central directory.
+        put64(end, 44);
+        put16(end, 0x0300 | 45);
+        put16(end, 45);
+        put32(end, 0);
+        put32(end, 0);
+        put64(end, entries);
+        put64(end, entries);
+        put64(end, directorySize);
+        put64(end, directoryOffset);
+
+        put32(end, 0x07064b50);         // Zip64 end of central directory locator.
+        put32(end, 0);
+        put64(end, zip64End);
+        put32(end, 1);
+    }
+
+    put32(end, 0x06054b50);             // End of central directory.
+    put16(end, 0);
+    put16(end, 0);
+    put16(end, quint16(qMin(entries, quint64(0xffff))));
+    put16(end, quint16(qMin(entries, quint64(0xffff))));
+    put32(end, quint32(qMin(directorySize, quint64(0xffffffffULL))));
+    put32(end, quint32(qMin(directoryOffset, quint64(0xffffffffULL))));
+    put16(end, 0);
+
+    if (fFile.write(end) != end.size()) {
+        return false;
+    }
+
+    fOffset += quint64(end.size());
+    fEntries.clear();
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// A ustar header. Names too long for it get a GNU long name entry first.
+//------------------------------------------------------------------------------
+QByteArray BundleWriter::tarHeader(const QByteArray &name, const qint64 size, const QDateTime &modified, const char type)
+{
+    QByteArray header(512, '\0');
+
+    // Up to 100 bytes of name, and 155 of prefix, split at a '/'.
+    QByteArray prefix;
+    QByteArray shortName = name;
+
+    if (name.size() > 100) {
+        const int split = name.lastIndexOf('/', 155);
+
+        if (split > 0 && name.size() - split - 1 <= 100) {
+            prefix = name.left(split);
+            shortName = name.mid(split + 1);
+        } else {
+            shortName = name.left(100);
+        }
+    }
+
+    memcpy(header.data(), shortName.constData(), size_t(qMin(shortName.size(), 100)));
+    putOctal(header, 100, 8, 0644);                     // Mode.
+    putOctal(header, 108, 8, 0);                        // Uid.
+    putOctal(header, 116, 8, 0);                        // Gid.
+    putOctal(header, 124, 12, size);
+#if QT_VERSION >= 0x050800
+    putOctal(header, 136, 12, modified.isValid() ? modified.toSecsSinceEpoch() : 0);
+#else
+    putOctal(header, 136, 12, modified.isValid() ? qint64(modified.toTime_t()) : 0);
+#endif
+    memset(header.data() + 148, ' ', 8);                // Checksum, for now.
+    header[156] = type;
+    memcpy(header.data() + 257, "ustar", 6);
+    memcpy(header.data() + 263, "00", 2);
+    memcpy(header.data() + 345, prefix.constData(), size_t(qMin(prefix.size(), 155)));
+
+    unsigned int checksum = 0;
+    for (int b = 0; b < 512; b++) {
+        checksum += uchar(header.at(b));
+    }
+    putOctal(header, 148, 7, checksum);
+    header[155] = ' ';
+
+    return header;
+}
+
+static QByteArray tarPadding(const qint64 size)
+{
+    return QByteArray(int((512 - size % 512) % 512), '\0');
+}
+
+// A whole tar entry, headers, data and padding, ready to write.
+QByteArray BundleWriter::prepareTar(const QByteArray &name, const QByteArray &data, const QDateTime &modified)
+{
+    QByteArray out;
+
+    // Does the name fit in the header, with or without a prefix?
+    const int split = name.lastIndexOf('/', 155);
+    const bool fits = name.size() <= 100 || (split > 0 && name.size() - split - 1 <= 100);
+
+    if (!fits) {
+        QByteArray longName = name + '\0';
+        out += tarHeader("././@LongLink", longName.size(), QDateTime(), 'L');
+        out += longName;
+        out += tarPadding(longName.size());
+    }
+
+    out += tarHeader(name, data.size(), modified, '0');
+    out += data;
+    out += tarPadding(data.size());
+
+    return out;
+}
+
+// Called with the lock held.
+bool BundleWriter::addTar(const QByteArray &out)
+{
+    if (fFile.write(out) != out.size()) {
+        return false;
+    }
+
+    fOffset += quint64(out.size());
+    return true;
+}
+
+// Two empty blocks mark the end of a tar file.
+bool BundleWriter::closeTar()
+{
+    QByteArray end(1024, '\0');
+    return fFile.write(end) == end.size();
+}
+
+
+//------------------------------------------------------------------------------
+// The usual CRC-32, as used by zip. The table is built the first time it's
+// needed. Function statics are only ever initialised once, whichever threads
+// get there first.
+//------------------------------------------------------------------------------
+struct crcTable {
+    quint32 entries[256];
+
+    crcTable() {
+        for (quint32 n = 0; n < 256; n++) {
+            quint32 c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+            }
+            entries[n] = c;
+        }
+    }
+};
+
+quint32 BundleWriter::crc32(const QByteArray &data)
+{
+    static const crcTable table;
+
+    quint32 crc = 0xffffffffU;
+    const uchar *bytes = reinterpret_cast<const uchar *>(data.constData());
+    for (int b = 0; b < data.size(); b++) {
+        crc = table.entries[(crc ^ bytes[b]) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc ^ 0xffffffffU;
+}
@@ -0,0 +1,93 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+// What the zip central directory needs to know about an entry.
+typedef struct zipEntry {
+    QByteArray name;                // UTF-8.
+    quint32 crc;
+    quint32 compressedSize;
+    quint32 size;
+    quint16 method;                 // 0 = stored, 8 = deflated.
+    quint16 dosTime;
+    quint16 dosDate;
+    quint64 offset;                 // Of the local header.
+} zipEntry;
+
+
+// Writes exported files into one zip or tar file, instead of lots of little
+// files, as they are produced. Each entry is written in one go, so nothing
+// has to be gone back and patched. A zip's central directory is written once,
+// at the end, by close(). Zip64 records are added when there are more than
+// 65,535 entries or the file passes 4GB.
+//
+// Zip entries are deflated when that makes them smaller, using qCompress()
+// and throwing away the zlib wrapper, so we don't need zlib itself.
+//
+// add() is thread safe. Entries are compressed on the caller's thread, only
+// the writing is done one at a time. A name that's already in the bundle is
+// an error, rather than an entry that extracting would quietly lose.
+//
+// Once a write fails, the offsets no longer match the file, so every add()
+// after it fails, and close() deletes the file rather than finish it off.
+
+class BundleWriter {
+
+public:
+    BundleWriter();
+    ~BundleWriter();
+
+    // The type comes from the extension, .zip or .tar.
+    bool    open(const QString &fileName, QString &error);
+    bool    add(const QString &name, const QByteArray &data, const QDateTime &modified, QString &error);
+    bool    close(QString &error);
+
+    static bool isBundleName(const QString &fileName);
+
+private:
+    static void prepareZip(const QByteArray &name, const QByteArray &data, const QDateTime &modified,
+                           zipEntry &entry, QByteArray &body);
+    static QByteArray prepareTar(const QByteArray &name, const QByteArray &data, const QDateTime &modified);
+    bool    addZip(zipEntry &entry, const QByteArray &body);
+    bool    addTar(const QByteArray &out);
+    bool    closeZip();
+    bool    closeTar();
+
+    static QByteArray tarHeader(const QByteArray &name, const qint64 size, const QDateTime &modified, const char type);
+    static quint32 crc32(const QByteArray &data);
+
+    QMutex fMutex;
+    QFile fFile;
+    bool fZip;
+    quint64 fOffset;                // Bytes written so far.
+    bool fBroken;                   // A write failed, nothing after it can be trusted.
+    QVector<zipEntry> fEntries;     // Zip only.
+    QSet<QString> fNames;           // Of every entry so far.
+};
+
+#endif
@@ -0,0 +1,286 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QTextCodec>
+#include <QTextStream>
+#include <QUrl>
+
+#include "cache.h"
+#include "quill.h"
+#include "version.h"
+
+// The first line of every manifest. Change it if the layout changes.
+static const char *manifestHeader = "# QStripper manifest 2";
+
+// Paths may have tabs or newlines in them, which would split the line up, so
+// they are percent encoded, '%' included.
+static QString escapePath(const QString &path)
+{
+    QString escaped = path;
+    escaped.replace('%', "%25").replace('\t', "%09").replace('\n', "%0A").replace('\r', "%0D");
+    return escaped;
+}
+
+static QString unescapePath(const QString &field)
+{
+    return QUrl::fromPercentEncoding(field.toUtf8());
+}
+
+// The input from an fEntries key. The extension after the last tab never has
+// one in it, but the input might.
+static QString keyInput(const QString &key)
+{
+    return key.section('\t', 0, -2);
+}
+
+ExportCache::ExportCache()
+{
+}
+
+//------------------------------------------------------------------------------
+// Read the manifest, if there is one. A missing one is fine, everything just
+// gets exported. Each line is tab separated:
+//
+// input format hash size modified version output
+//
+// The input and output paths are percent encoded.
+//------------------------------------------------------------------------------
+bool ExportCache::load(const QString &directory, QString &error)
+{
+    fEntries.clear();
+
+    QDir dir(directory);
+    if (!dir.exists() && !dir.mkpath(".")) {
+        error = QString("Cannot create cache directory %1.").arg(directory);
+        return false;
+    }
+
+    fFileName = dir.absoluteFilePath("qstripper.manifest");
+
+    QFile file(fFileName);
+    if (!file.exists()) {
+        return true;
+    }
+
+    if (!file.open(QFile::ReadOnly | QFile::Text)) {
+        error = QString("Cannot read cache manifest %1:\n%2.").arg(fFileName).arg(file.errorString());
+        return false;
+    }
+
+    QTextStream in(&file);
+    in.setCodec(QTextCodec::codecForName("UTF-8"));
+
+    if (in.readLine() != manifestHeader) {
+        // Not one of ours, or an older layout. Start again.
+        return true;
+    }
+
+    while (!in.atEnd()) {
+        QStringList fields = in.readLine().split('\t');
+        if (fields.size() != 7) {
+            continue;
+        }
+
+        cacheEntry entry;
+        entry.hash = QByteArray::fromHex(fields.at(2).toLatin1());
+        entry.size = fields.at(3).toLongLong();
+        entry.modified = fields.at(4).toLongLong();
+        entry.version = fields.at(5);
+        entry.output = unescapePath(fields.at(6));
+
+        fEntries.insert(unescapePath(fields.at(0)) + '\t' + fields.at(1), entry);
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Write the manifest to a temporary file first, so a crash part way through
+// doesn't lose the lot.
+//------------------------------------------------------------------------------
+bool ExportCache::save(QString &error)
+{
+    if (fFileName.isEmpty()) {
+        return true;
+    }
+
+    const QString tempName = fFileName + ".new";
+    QFile file(tempName);
+    if (!file.open(QFile::WriteOnly | QFile::Text)) {
+        error = QString("Cannot write cache manifest %1:\n%2.").arg(tempName).arg(file.errorString());
+        return false;
+    }
+
+    QTextStream out(&file);
+    out.setCodec(QTextCodec::codecForName("UTF-8"));
+    out << manifestHeader << "\n";
+
+    QHash<QString, cacheEntry>::const_iterator it;
+    for (it = fEntries.constBegin(); it != fEntries.constEnd(); ++it) {
+        const cacheEntry &entry = it.value();
+        out << escapePath(keyInput(it.key())) << '\t'
+            << it.key().section('\t', -1) << '\t'
+            << entry.hash.toHex() << '\t'
+            << entry.size << '\t'
+            << entry.modified << '\t'
+            << entry.version << '\t'
+            << escapePath(entry.output) << "\n";
+    }
+
+    out.flush();
+    file.close();
+
+    if (out.status() != QTextStream::Ok || file.error() != QFile::NoError) {
+        error = QString("Cannot write cache manifest %1:\n%2.").arg(tempName).arg(file.errorString());
+        return false;
+    }
+
+    QFile::remove(fFileName);
+    if (!QFile::rename(tempName, fFileName)) {
+        error = QString("Cannot replace cache manifest %1.").arg(fFileName);
+        return false;
+    }
+
+    return true;
+}
+
+cacheKey ExportCache::keyFor(const QString &inputFile)
+{
+    QFileInfo info(inputFile);
+
+    cacheKey key;
+    key.input = info.absoluteFilePath();
+    key.size = info.size();
+    key.modified = info.lastModified().toMSecsSinceEpoch();
+    return key;
+}
+
+QString ExportCache::entryName(const QString &input, const QuillExporter::Format format)
+{
+    return input + '\t' + QuillExporter::extension(format);
+}
+
+//------------------------------------------------------------------------------
+// Cheapest checks first. The hash means reading the file, so it's only done
+// if the size or time say the file might have changed.
+//------------------------------------------------------------------------------
+bool ExportCache::isCurrent(cacheKey &key, const QuillExporter::Format format, const QString &output)
+{
+    cacheEntry entry;
+    {
+        QMutexLocker locker(&fMutex);
+        QHash<QString, cacheEntry>::const_iterator it = fEntries.constFind(entryName(key.input, format));
+        if (it == fEntries.constEnd()) {
+            return false;
+        }
+        entry = it.value();
+    }
+
+    if (entry.version != QSTRIPPER_VERSION ||
+        entry.output != QFileInfo(output).absoluteFilePath() ||
+        !QFile::exists(output)) {
+        return false;
+    }
+
+    if (entry.size == key.size && entry.modified == key.modified) {
+        return true;
+    }
+
+    // Touched, copied or saved again, but maybe not changed.
+    if (key.hash.isEmpty()) {
+        key.hash = QuillDoc::contentHash(key.input);
+    }
+
+    if (key.hash.isEmpty() || key.hash != entry.hash) {
+        return false;
+    }
+
+    // Same content. Remember the new size and time for next time.
+    update(key, format, output);
+    return true;
+}
+
+void ExportCache::update(cacheKey &key, const QuillExporter::Format format, const QString &output)
+{
+    if (key.hash.isEmpty()) {
+        key.hash = QuillDoc::contentHash(key.input);
+    }
+
+    cacheEntry entry;
+    entry.hash = key.hash;
+    entry.size = key.size;
+    entry.modified = key.modified;
+    entry.version = QSTRIPPER_VERSION;
+    entry.output = QFileInfo(output).absoluteFilePath();
+
+    QMutexLocker locker(&fMutex);
+    fEntries.insert(entryName(key.input, format), entry);
+}
+
+//------------------------------------------------------------------------------
+// Outputs we wrote for inputs that have since been deleted, or moved.
+//------------------------------------------------------------------------------
+QStringList ExportCache::stale()
+{
+    QStringList outputs;
+
+    QMutexLocker locker(&fMutex);
+    QHash<QString, cacheEntry>::const_iterator it;
+    for (it = fEntries.constBegin(); it != fEntries.constEnd(); ++it) {
+        const QString input = keyInput(it.key());
+        if (!QFile::exists(input) && QFile::exists(it.value().output)) {
+            outputs.append(it.value().output);
+        }
+    }
+
+    outputs.sort();
+    return outputs;
+}
+
+//------------------------------------------------------------------------------
+// Delete the stale outputs and forget about their inputs. Returns the ones
+// that were deleted.
+//------------------------------------------------------------------------------
+QStringList ExportCache::prune()
+{
+    QStringList deleted;
+
+    QMutexLocker locker(&fMutex);
+    QHash<QString, cacheEntry>::iterator it = fEntries.begin();
+    while (it != fEntries.end()) {
+        const QString input = keyInput(it.key());
+        if (QFile::exists(input)) {
+            ++it;
+            continue;
+        }
+
+        if (QFile::exists(it.value().output) && QFile::remove(it.value().output)) {
+            deleted.append(it.value().output);
+        }
+
+        it = fEntries.erase(it);
+    }
+
+    deleted.sort();
+    return deleted;
+}
@@ -0,0 +1,87 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+#include "quillexport.h"
+
+// What we knew about one input file when it was last exported in one format.
+typedef struct cacheEntry {
+    QByteArray hash;                // QuillDoc::contentHash().
+    qint64 size;                    // Of the input, for the quick check.
+    qint64 modified;                // Ditto, msecs since the epoch.
+    QString version;                // QSTRIPPER_VERSION that wrote it.
+    QString output;                 // The file that was written.
+} cacheEntry;
+
+// What we know about an input file now. The hash is only worked out if the
+// size or time have changed.
+typedef struct cacheKey {
+    QString input;                  // Absolute path.
+    qint64 size;
+    qint64 modified;
+    QByteArray hash;                // Empty until needed.
+} cacheKey;
+
+
+// The manifest of previous exports, so unchanged files can be skipped. It is a
+// text file, "qstripper.manifest", in the cache directory, one line for each
+// input file and format.
+//
+// An export is current if the output is still there, it was written by this
+// version, and the input's size and time, or failing that, its content hash,
+// are unchanged.
+
+class ExportCache {
+
+public:
+    ExportCache();
+
+    bool    load(const QString &directory, QString &error);
+    bool    save(QString &error);
+
+    // Fill in the size and time of an input file.
+    static cacheKey keyFor(const QString &inputFile);
+
+    // Is the export of this input, in this format, to this file, up to date?
+    // May work out the hash, in key, if it needs it. Thread safe.
+    bool    isCurrent(cacheKey &key, const QuillExporter::Format format, const QString &output);
+
+    // Record a successful export. Thread safe.
+    void    update(cacheKey &key, const QuillExporter::Format format, const QString &output);
+
+    // Outputs whose inputs have gone. prune() deletes them and forgets them.
+    QStringList stale();
+    QStringList prune();
+
+private:
+    static QString entryName(const QString &input, const QuillExporter::Format format);
+
+    QString fFileName;
+    QMutex fMutex;
+    QHash<QString, cacheEntry> fEntries;    // Keyed on "input\tformat".
+};
+
+#endif
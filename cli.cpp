@@ -0,0 +1,128 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+// qstripper-cli. Exports Quill files without building the main window, so it
+// starts quickly and doesn't need a display.
+
+#include <QCoreApplication>
+#include <QScopedPointer>
+#include <QTextStream>
+
+#if QT_VERSION >= 0x050000
+#include <QGuiApplication>
+#else
+#include <QApplication>
+#endif
+
+#include "batch.h"
+#include "isolate.h"
+#include "serve.h"
+#include "version.h"
+#include "watch.h"
+
+int main(int argc, char *argv[])
+{
+    // Parse the arguments before there's an application, as that depends
+    // on what we are asked to do.
+    QStringList args;
+    for (int a = 1; a < argc; a++) {
+        args.append(QString::fromLocal8Bit(argv[a]));
+    }
+
+    batchOptions Options;
+    QString error;
+
+    if (!QuillBatch::parseArgs(args, Options, error)) {
+        QTextStream err(stderr);
+        err << "qstripper-cli: " << error << "\n\n" << QuillBatch::usage();
+        return EXIT_USAGE;
+    }
+
+    if (Options.help) {
+        QTextStream out(stdout);
+        out << "QStripper " << QSTRIPPER_VERSION << "\n\n" << QuillBatch::usage();
+        return EXIT_OK;
+    }
+
+    // HTML, ODF and PDF go via a QTextDocument, which needs fonts, so needs a
+    // GUI application. No display is needed for the offscreen platform.
+    // Everything else only needs the core. The server could be asked for any
+    // format, so it always gets the GUI. With --isolate, only the workers do.
+    QCoreApplication *app;
+    if (Options.serve || (!Options.isolate && QuillBatch::needsDocument(Options))) {
+#if QT_VERSION >= 0x050000
+        if (qgetenv("QT_QPA_PLATFORM").isEmpty()) {
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+        }
+        app = new QGuiApplication(argc, argv);
+#else
+        app = new QApplication(argc, argv, QApplication::Tty);
+#endif
+    } else {
+        app = new QCoreApplication(argc, argv);
+    }
+
+    int result;
+
+    if (Options.worker) {
+        result = WorkerPool::runWorker();
+    } else if (Options.serve) {
+        LocalServer server(Options);
+        if (!server.start(error)) {
+            QTextStream(stderr) << "qstripper-cli: " << error << "\n";
+            delete app;
+            return EXIT_FAILURES;
+        }
+
+        result = app->exec();
+    } else if (!Options.watchDirectory.isEmpty()) {
+        // One reporter for every batch, so --error-log is opened once, and a
+        // log that can't be written stops us before we start watching.
+        QScopedPointer<ErrorReporter> reporter(QuillBatch::makeReporter(Options, error));
+        if (!reporter) {
+            QTextStream(stderr) << "qstripper-cli: " << error << "\n";
+            delete app;
+            return EXIT_USAGE;
+        }
+
+        // Anything on the command line first, then wait for more.
+        if (!Options.files.isEmpty() || !Options.directories.isEmpty()) {
+            QuillBatch batch(Options);
+            batch.setReporter(reporter.data());
+            if (batch.run() == EXIT_ABORTED) {
+                delete app;
+                return EXIT_ABORTED;
+            }
+        }
+
+        HotFolder folder(Options, reporter.data());
+        if (!folder.start(error)) {
+            QTextStream(stderr) << "qstripper-cli: " << error << "\n";
+            delete app;
+            return EXIT_USAGE;
+        }
+
+        result = app->exec();
+    } else {
+        QuillBatch batch(Options);
+        result = batch.run();
+    }
+
+    delete app;
+    return result;
+}
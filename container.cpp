@@ -0,0 +1,1054 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#include <QHash>
+#include <QStringList>
+#include <QtEndian>
+
+#include "container.h"
+#include "quill.h"
+
+#include <cstring>
+
+// Every QDOS file starts with a copy of its 64 byte directory entry.
+const qint64 QDOS_HEADER_SIZE = 64;
+const qint64 QDOS_SECTOR_SIZE = 512;
+
+// Where things are in a QDOS directory entry, and in the file header.
+const int QDOS_LENGTH = 0x00;               // Long, includes the header.
+const int QDOS_TYPE = 0x05;                 // Byte, 0xff for a directory.
+const int QDOS_NAME_LENGTH = 0x0e;          // Word, up to 36.
+const int QDOS_NAME = 0x10;
+const int QDOS_UPDATE_DATE = 0x34;          // Long, seconds since 1961.
+const int QDOS_FIRST_GROUP = 0x3a;          // Word, QXL.WIN only.
+
+const quint8 QDOS_TYPE_DIRECTORY = 0xff;
+
+// QXL.WIN header.
+const int QLWA_SECTORS_PER_GROUP = 0x20;
+const int QLWA_GROUPS = 0x28;
+const int QLWA_ROOT = 0x32;
+const int QLWA_ROOT_LENGTH = 0x34;
+const int QLWA_MAP = 0x40;                  // A word per group, the next one.
+
+// QL floppy map block.
+const int QL5_TOTAL_SECTORS = 0x18;
+const int QL5_SECTORS_PER_TRACK = 0x1a;
+const int QL5_SECTORS_PER_CYLINDER = 0x1c;
+const int QL5_SECTORS_PER_BLOCK = 0x20;
+const int QL5_DIRECTORY_BLOCKS = 0x22;      // Word, whole blocks.
+const int QL5_DIRECTORY_BYTES = 0x24;       // Word, and bytes in the next.
+const int QL5_SKEW = 0x26;                  // Sector offset per cylinder.
+const int QL5_LOGICAL_TO_PHYSICAL = 0x28;
+const int QL5_TRANSLATE_SIZE = 18;
+const int QL5_MAP = 0x60;                   // 3 bytes per block.
+
+// Map entries for blocks that aren't in a file.
+const int QL5_FIRST_SPECIAL_FILE = 0xf80;
+
+// Don't follow silly directory trees for ever.
+const int MAX_DIRECTORY_DEPTH = 16;
+
+// No Quill document comes near this. Anything that says it's bigger is
+// damaged or hostile, and isn't worth allocating for.
+const qint64 MAX_ENTRY_SIZE = Q_INT64_C(64) * 1024 * 1024;
+
+
+static quint16 bigWord(const uchar *p) { return qFromBigEndian<quint16>(p); }
+static quint32 bigLong(const uchar *p) { return qFromBigEndian<quint32>(p); }
+static quint16 littleWord(const uchar *p) { return qFromLittleEndian<quint16>(p); }
+static quint32 littleLong(const uchar *p) { return qFromLittleEndian<quint32>(p); }
+static quint64 littleLongLong(const uchar *p) { return qFromLittleEndian<quint64>(p); }
+
+static bool sizeOK(const qint64 size, QString &error)
+{
+    if (size < 0 || size > MAX_ENTRY_SIZE) {
+        error = QString("The entry is too big, %1 bytes.").arg(size);
+        return false;
+    }
+
+    return true;
+}
+
+static QDateTime qdosDate(const quint32 seconds)
+{
+    return QDateTime(QDate(1961, 1, 1), QTime(0, 0), Qt::UTC).addSecs(seconds).toLocalTime();
+}
+
+static QDateTime dosDate(const quint16 date, const quint16 time)
+{
+    return QDateTime(QDate(1980 + (date >> 9), (date >> 5) & 0x0f, date & 0x1f),
+                     QTime(time >> 11, (time >> 5) & 0x3f, (time & 0x1f) * 2));
+}
+
+//------------------------------------------------------------------------------
+// Exports are written under the name, so it mustn't be able to climb out of
+// the folder they go in.
+//------------------------------------------------------------------------------
+static QString safeName(QString name)
+{
+    QStringList parts = name.replace('\\', '/').split('/');
+    QStringList safe;
+
+    for (int p = 0; p < parts.size(); p++) {
+        if (!parts.at(p).isEmpty() && parts.at(p) != "." && parts.at(p) != "..") {
+            safe.append(parts.at(p));
+        }
+    }
+
+    return safe.join("/");
+}
+
+//------------------------------------------------------------------------------
+// Pick up the name, size and date from a 64 byte QDOS directory entry. Returns
+// false for unused entries.
+//------------------------------------------------------------------------------
+static bool qdosEntry(const uchar *entry, containerEntry &file)
+{
+    const quint32 length = bigLong(entry + QDOS_LENGTH);
+    const quint16 nameLength = qMin<quint16>(bigWord(entry + QDOS_NAME_LENGTH), 36);
+
+    if (length < QDOS_HEADER_SIZE || nameLength == 0) {
+        return false;
+    }
+
+    file.name = safeName(QString::fromLatin1(reinterpret_cast<const char *>(entry + QDOS_NAME), nameLength));
+    file.size = length - QDOS_HEADER_SIZE;
+    file.modified = qdosDate(bigLong(entry + QDOS_UPDATE_DATE));
+    file.storedSize = file.size;
+    file.method = 0;
+    return !file.name.isEmpty();
+}
+
+
+//==============================================================================
+// QXL.WIN. The disc is split into groups of sectors and each file is a chain
+// of groups. The map has a word per group, the number of the next group in the
+// same file. The first group of each file is in its directory entry.
+//==============================================================================
+class qxlWinImage : public QuillContainer {
+
+protected:
+    bool    list(QString &error);
+    bool    readEntry(const containerEntry &entry, const qint64 limit,
+                      QByteArray &data, QString &error) const;
+
+private:
+    bool    readChain(const quint16 first, const qint64 from, const qint64 to,
+                      QByteArray &data, QString &error) const;
+    bool    listDirectory(const quint16 first, const qint64 length, const int depth, QString &error);
+
+    qint64  fGroupSize;
+    quint16 fGroups;
+};
+
+bool qxlWinImage::list(QString &error)
+{
+    if (!fits(0, QLWA_MAP)) {
+        error = "The QXL.WIN header is incomplete.";
+        return false;
+    }
+
+    fGroupSize = bigWord(fData + QLWA_SECTORS_PER_GROUP) * QDOS_SECTOR_SIZE;
+    fGroups = bigWord(fData + QLWA_GROUPS);
+
+    if (fGroupSize == 0 || !fits(QLWA_MAP, qint64(fGroups) * 2)) {
+        error = "The QXL.WIN group map is damaged.";
+        return false;
+    }
+
+    return listDirectory(bigWord(fData + QLWA_ROOT), bigLong(fData + QLWA_ROOT_LENGTH), 0, error);
+}
+
+//------------------------------------------------------------------------------
+// Directories are files of 64 byte entries, after the usual header. The names
+// in sub-directories are already the full path, "docs_letter_doc", so they are
+// used as they are.
+//------------------------------------------------------------------------------
+bool qxlWinImage::listDirectory(const quint16 first, const qint64 length, const int depth, QString &error)
+{
+    if (depth > MAX_DIRECTORY_DEPTH) {
+        error = "The QXL.WIN directories are nested too deeply.";
+        return false;
+    }
+
+    QByteArray directory;
+    if (!readChain(first, 0, length, directory, error)) {
+        return false;
+    }
+
+    const uchar *entries = reinterpret_cast<const uchar *>(directory.constData());
+
+    for (qint64 e = QDOS_HEADER_SIZE; e + QDOS_HEADER_SIZE <= directory.size(); e += QDOS_HEADER_SIZE) {
+        const uchar *entry = entries + e;
+        containerEntry file;
+
+        if (!qdosEntry(entry, file)) {
+            continue;
+        }
+
+        file.location = bigWord(entry + QDOS_FIRST_GROUP);
+
+        if (entry[QDOS_TYPE] == QDOS_TYPE_DIRECTORY) {
+            if (!listDirectory(quint16(file.location), file.size + QDOS_HEADER_SIZE, depth + 1, error)) {
+                return false;
+            }
+        } else {
+            fEntries.append(file);
+        }
+    }
+
+    return true;
+}
+
+bool qxlWinImage::readEntry(const containerEntry &entry, const qint64 limit,
+                            QByteArray &data, QString &error) const
+{
+    const qint64 size = (limit < 0) ? entry.size : qMin(limit, entry.size);
+    return readChain(quint16(entry.location), QDOS_HEADER_SIZE, QDOS_HEADER_SIZE + size, data, error);
+}
+
+//------------------------------------------------------------------------------
+// Bytes from..to of the file starting at group first. A chain can't be longer
+// than the number of groups, so a looped map can't hang us.
+//------------------------------------------------------------------------------
+bool qxlWinImage::readChain(const quint16 first, const qint64 from, const qint64 to,
+                            QByteArray &data, QString &error) const
+{
+    data.clear();
+    if (!sizeOK(qMax<qint64>(to - from, 0), error)) {
+        return false;
+    }
+    data.reserve(int(qMax<qint64>(to - from, 0)));
+
+    quint16 group = first;
+    qint64 position = 0;
+
+    for (int count = 0; position < to; count++) {
+        if (group == 0 || group >= fGroups || count >= fGroups) {
+            error = "The QXL.WIN group map is damaged.";
+            return false;
+        }
+
+        const qint64 start = qMax(from, position);
+        const qint64 end = qMin(to, position + fGroupSize);
+
+        if (start < end) {
+            const qint64 offset = qint64(group) * fGroupSize + (start - position);
+            if (!fits(offset, end - start)) {
+                error = "The QXL.WIN image is truncated.";
+                return false;
+            }
+            data.append(reinterpret_cast<const char *>(fData + offset), int(end - start));
+        }
+
+        position += fGroupSize;
+        group = bigWord(fData + QLWA_MAP + 2 * group);
+    }
+
+    return true;
+}
+
+
+//==============================================================================
+// QL floppy discs. The first block holds the map, 3 bytes per block, giving
+// the file that owns it and which block of that file it is. File 0 is the
+// directory, and the directory entry for file n is at n * 64 in it.
+//
+// Logical sectors go round a cylinder through a translate table, and each
+// cylinder is skewed, so consecutive sectors aren't next to each other in the
+// image, which is just the tracks, side 0 then side 1, in cylinder order.
+//==============================================================================
+class qlFloppyImage : public QuillContainer {
+
+protected:
+    bool    list(QString &error);
+    bool    readEntry(const containerEntry &entry, const qint64 limit,
+                      QByteArray &data, QString &error) const;
+
+private:
+    qint64  sectorOffset(const qint64 logical) const;
+    bool    readFile(const int file, const qint64 from, const qint64 to,
+                     QByteArray &data, QString &error) const;
+
+    int     fSectorsPerTrack;
+    int     fSectorsPerCylinder;
+    int     fSectorsPerBlock;
+    int     fSkew;
+    quint8  fTranslate[QL5_TRANSLATE_SIZE];
+    QHash<int, QVector<int> > fBlocks;      // Disc block of each file block.
+};
+
+//------------------------------------------------------------------------------
+// Image offset of a logical sector. The translate table has bit 7 set for the
+// second side. HD discs have more sectors in a cylinder than the table has
+// room for, those are in order, a side at a time.
+//------------------------------------------------------------------------------
+qint64 qlFloppyImage::sectorOffset(const qint64 logical) const
+{
+    const qint64 cylinder = logical / fSectorsPerCylinder;
+    const int inCylinder = int(logical % fSectorsPerCylinder);
+    int side;
+    int sector;
+
+    if (fSectorsPerCylinder <= QL5_TRANSLATE_SIZE) {
+        side = (fTranslate[inCylinder] & 0x80) ? 1 : 0;
+        sector = fTranslate[inCylinder] & 0x7f;
+    } else {
+        side = inCylinder / fSectorsPerTrack;
+        sector = inCylinder % fSectorsPerTrack;
+    }
+
+    sector = int((sector + cylinder * fSkew) % fSectorsPerTrack);
+    return (cylinder * fSectorsPerCylinder + side * fSectorsPerTrack + sector) * QDOS_SECTOR_SIZE;
+}
+
+bool qlFloppyImage::list(QString &error)
+{
+    if (!fits(0, QDOS_SECTOR_SIZE)) {
+        error = "The floppy disc image is truncated.";
+        return false;
+    }
+
+    const int totalSectors = bigWord(fData + QL5_TOTAL_SECTORS);
+    fSectorsPerTrack = bigWord(fData + QL5_SECTORS_PER_TRACK);
+    fSectorsPerCylinder = bigWord(fData + QL5_SECTORS_PER_CYLINDER);
+    fSectorsPerBlock = bigWord(fData + QL5_SECTORS_PER_BLOCK);
+    fSkew = bigWord(fData + QL5_SKEW);
+    memcpy(fTranslate, fData + QL5_LOGICAL_TO_PHYSICAL, sizeof(fTranslate));
+
+    if (fSectorsPerTrack == 0 || fSectorsPerCylinder < fSectorsPerTrack || fSectorsPerBlock == 0) {
+        error = "The floppy disc map is damaged.";
+        return false;
+    }
+
+    for (int s = 0; s < QL5_TRANSLATE_SIZE && s < fSectorsPerCylinder; s++) {
+        if ((fTranslate[s] & 0x7f) >= fSectorsPerTrack) {
+            error = "The floppy disc sector table is damaged.";
+            return false;
+        }
+    }
+
+    // The map is block 0, which is spread about like everything else.
+    const int blocks = totalSectors / fSectorsPerBlock;
+    QByteArray map;
+
+    for (int s = 0; s < fSectorsPerBlock; s++) {
+        const qint64 offset = sectorOffset(s);
+        if (!fits(offset, QDOS_SECTOR_SIZE)) {
+            error = "The floppy disc image is truncated.";
+            return false;
+        }
+        map.append(reinterpret_cast<const char *>(fData + offset), int(QDOS_SECTOR_SIZE));
+    }
+
+    if (QL5_MAP + 3 * blocks > map.size()) {
+        error = "The floppy disc map is damaged.";
+        return false;
+    }
+
+    const uchar *entry = reinterpret_cast<const uchar *>(map.constData()) + QL5_MAP;
+    for (int b = 0; b < blocks; b++, entry += 3) {
+        const int file = (entry[0] << 4) | (entry[1] >> 4);
+        const int block = ((entry[1] & 0x0f) << 8) | entry[2];
+
+        if (file >= QL5_FIRST_SPECIAL_FILE) {
+            continue;
+        }
+
+        // Block 0 is always the map's, so 0 marks a hole in a damaged map.
+        QVector<int> &fileBlocks = fBlocks[file];
+        if (block >= fileBlocks.size()) {
+            fileBlocks.resize(block + 1);
+        }
+        fileBlocks[block] = b;
+    }
+
+    const uchar *header = reinterpret_cast<const uchar *>(map.constData());
+    const qint64 blockSize = fSectorsPerBlock * QDOS_SECTOR_SIZE;
+    const qint64 directoryLength = bigWord(header + QL5_DIRECTORY_BLOCKS) * blockSize +
+                                   bigWord(header + QL5_DIRECTORY_BYTES);
+
+    QByteArray directory;
+    if (!readFile(0, 0, directoryLength, directory, error)) {
+        return false;
+    }
+
+    const uchar *entries = reinterpret_cast<const uchar *>(directory.constData());
+    for (qint64 e = QDOS_HEADER_SIZE; e + QDOS_HEADER_SIZE <= directory.size(); e += QDOS_HEADER_SIZE) {
+        containerEntry file;
+        if (qdosEntry(entries + e, file)) {
+            file.location = e / QDOS_HEADER_SIZE;
+            fEntries.append(file);
+        }
+    }
+
+    return true;
+}
+
+bool qlFloppyImage::readEntry(const containerEntry &entry, const qint64 limit,
+                              QByteArray &data, QString &error) const
+{
+    const qint64 size = (limit < 0) ? entry.size : qMin(limit, entry.size);
+    return readFile(int(entry.location), QDOS_HEADER_SIZE, QDOS_HEADER_SIZE + size, data, error);
+}
+
+//------------------------------------------------------------------------------
+// Bytes from..to of a file, a sector at a time.
+//------------------------------------------------------------------------------
+bool qlFloppyImage::readFile(const int file, const qint64 from, const qint64 to,
+                             QByteArray &data, QString &error) const
+{
+    const QVector<int> blocks = fBlocks.value(file);
+    const qint64 blockSize = fSectorsPerBlock * QDOS_SECTOR_SIZE;
+
+    data.clear();
+    if (!sizeOK(qMax<qint64>(to - from, 0), error)) {
+        return false;
+    }
+    data.reserve(int(qMax<qint64>(to - from, 0)));
+
+    for (qint64 position = from; position < to; ) {
+        const qint64 block = position / blockSize;
+        if (block >= blocks.size() || blocks.at(int(block)) <= 0) {
+            error = "The floppy disc map is damaged.";
+            return false;
+        }
+
+        const qint64 inBlock = position % blockSize;
+        const qint64 inSector = inBlock % QDOS_SECTOR_SIZE;
+        const qint64 sector = qint64(blocks.at(int(block))) * fSectorsPerBlock + inBlock / QDOS_SECTOR_SIZE;
+        const qint64 length = qMin(QDOS_SECTOR_SIZE - inSector, to - position);
+        const qint64 offset = sectorOffset(sector) + inSector;
+
+        if (!fits(offset, length)) {
+            error = "The floppy disc image is truncated.";
+            return false;
+        }
+
+        data.append(reinterpret_cast<const char *>(fData + offset), int(length));
+        position += length;
+    }
+
+    return true;
+}
+
+
+//==============================================================================
+// Inflate, for deflated zip entries. This is the plain, slow, bit at a time
+// version from RFC 1951. Quill documents are small, and we only have qCompress
+// and qUncompress, which want the zlib wrapper, and its checksum, which a zip
+// doesn't have.
+//==============================================================================
+typedef struct huffman {
+    short count[16];                // Codes of each length.
+    short symbol[288];              // Symbols, in code order.
+} huffman;
+
+class inflater {
+
+public:
+    inflater(const uchar *in, const qint64 size, QByteArray &out, const qint64 limit)
+        : fIn(in), fSize(size), fPosition(0), fBits(0), fBitCount(0), fOut(out), fLimit(limit) {}
+
+    bool    run();
+
+private:
+    int     bits(const int need);
+    bool    stored();
+    bool    codes(const huffman &lengths, const huffman &distances);
+    bool    fixed();
+    bool    dynamic();
+    int     decode(const huffman &h);
+    static bool construct(huffman &h, const short *lengths, const int n);
+
+    bool    full() const { return fLimit >= 0 && fOut.size() >= fLimit; }
+
+    const uchar *fIn;
+    qint64  fSize;
+    qint64  fPosition;
+    quint32 fBits;
+    int     fBitCount;
+    QByteArray &fOut;
+    qint64  fLimit;
+};
+
+// Returns -1 if the input has run out.
+int inflater::bits(const int need)
+{
+    quint32 value = fBits;
+
+    while (fBitCount < need) {
+        if (fPosition >= fSize) {
+            return -1;
+        }
+        value |= quint32(fIn[fPosition++]) << fBitCount;
+        fBitCount += 8;
+    }
+
+    fBits = value >> need;
+    fBitCount -= need;
+    return int(value & ((1u << need) - 1));
+}
+
+bool inflater::stored()
+{
+    fBits = 0;
+    fBitCount = 0;
+
+    if (fPosition + 4 > fSize) {
+        return false;
+    }
+
+    const quint16 length = littleWord(fIn + fPosition);
+    const quint16 check = littleWord(fIn + fPosition + 2);
+    fPosition += 4;
+
+    if (length != quint16(~check) || fPosition + length > fSize) {
+        return false;
+    }
+
+    fOut.append(reinterpret_cast<const char *>(fIn + fPosition), length);
+    fPosition += length;
+    return true;
+}
+
+int inflater::decode(const huffman &h)
+{
+    int code = 0;
+    int first = 0;
+    int index = 0;
+
+    for (int length = 1; length < 16; length++) {
+        const int bit = bits(1);
+        if (bit < 0) {
+            return -1;
+        }
+
+        code |= bit;
+        const int count = h.count[length];
+        if (code - count < first) {
+            return h.symbol[index + (code - first)];
+        }
+
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+
+    return -1;
+}
+
+bool inflater::construct(huffman &h, const short *lengths, const int n)
+{
+    memset(h.count, 0, sizeof(h.count));
+    for (int s = 0; s < n; s++) {
+        h.count[lengths[s]]++;
+    }
+
+    if (h.count[0] == n) {
+        return true;
+    }
+
+    // Too many codes of any length is an error, too few is allowed.
+    int left = 1;
+    for (int length = 1; length < 16; length++) {
+        left <<= 1;
+        left -= h.count[length];
+        if (left < 0) {
+            return false;
+        }
+    }
+
+    short offsets[16];
+    offsets[1] = 0;
+    for (int length = 1; length < 15; length++) {
+        offsets[length + 1] = offsets[length] + h.count[length];
+    }
+
+    for (int s = 0; s < n; s++) {
+        if (lengths[s] != 0) {
+            h.symbol[offsets[lengths[s]]++] = short(s);
+        }
+    }
+
+    return true;
+}
+
+bool inflater::codes(const huffman &lengths, const huffman &distances)
+{
+    static const short lengthBase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const short lengthExtra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const short distanceBase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+        8193, 12289, 16385, 24577};
+    static const short distanceExtra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    for (;;) {
+        if (full()) {
+            return true;
+        }
+
+        int symbol = decode(lengths);
+        if (symbol < 0) {
+            return false;
+        }
+
+        if (symbol < 256) {
+            fOut.append(char(symbol));
+            continue;
+        }
+
+        if (symbol == 256) {
+            return true;
+        }
+
+        symbol -= 257;
+        if (symbol >= 29) {
+            return false;
+        }
+
+        const int extra = bits(lengthExtra[symbol]);
+        if (extra < 0) {
+            return false;
+        }
+        const int length = lengthBase[symbol] + extra;
+
+        symbol = decode(distances);
+        if (symbol < 0 || symbol >= 30) {
+            return false;
+        }
+
+        const int distanceBits = bits(distanceExtra[symbol]);
+        if (distanceBits < 0) {
+            return false;
+        }
+        const int distance = distanceBase[symbol] + distanceBits;
+
+        if (distance > fOut.size()) {
+            return false;
+        }
+
+        // The copy can overlap what it's writing, so a byte at a time.
+        for (int c = 0; c < length; c++) {
+            fOut.append(fOut.at(fOut.size() - distance));
+        }
+    }
+}
+
+// Built every time, it's cheap, and there's nothing shared between threads.
+bool inflater::fixed()
+{
+    huffman lengths;
+    huffman distances;
+    short sizes[288];
+    int s = 0;
+
+    for (; s < 144; s++) sizes[s] = 8;
+    for (; s < 256; s++) sizes[s] = 9;
+    for (; s < 280; s++) sizes[s] = 7;
+    for (; s < 288; s++) sizes[s] = 8;
+    construct(lengths, sizes, 288);
+
+    for (s = 0; s < 30; s++) sizes[s] = 5;
+    construct(distances, sizes, 30);
+
+    return codes(lengths, distances);
+}
+
+bool inflater::dynamic()
+{
+    static const short order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    const int nLengths = bits(5) + 257;
+    const int nDistances = bits(5) + 1;
+    const int nCodes = bits(4) + 4;
+
+    if (nLengths > 286 || nDistances > 30 || nCodes < 4) {
+        return false;
+    }
+
+    short sizes[286 + 30];
+    int s;
+
+    for (s = 0; s < nCodes; s++) {
+        const int size = bits(3);
+        if (size < 0) {
+            return false;
+        }
+        sizes[order[s]] = short(size);
+    }
+    for (; s < 19; s++) {
+        sizes[order[s]] = 0;
+    }
+
+    huffman lengths;
+    huffman distances;
+    if (!construct(lengths, sizes, 19)) {
+        return false;
+    }
+
+    for (s = 0; s < nLengths + nDistances; ) {
+        int symbol = decode(lengths);
+        if (symbol < 0) {
+            return false;
+        }
+
+        if (symbol < 16) {
+            sizes[s++] = short(symbol);
+            continue;
+        }
+
+        short size = 0;
+        int repeat;
+
+        if (symbol == 16) {
+            if (s == 0) {
+                return false;
+            }
+            size = sizes[s - 1];
+            repeat = 3 + bits(2);
+        } else if (symbol == 17) {
+            repeat = 3 + bits(3);
+        } else {
+            repeat = 11 + bits(7);
+        }
+
+        if (repeat < 3 || s + repeat > nLengths + nDistances) {
+            return false;
+        }
+
+        while (repeat--) {
+            sizes[s++] = size;
+        }
+    }
+
+    // There has to be an end of block code.
+    if (sizes[256] == 0) {
+        return false;
+    }
+
+    if (!construct(lengths, sizes, nLengths) || !construct(distances, sizes + nLengths, nDistances)) {
+        return false;
+    }
+
+    return codes(lengths, distances);
+}
+
+bool inflater::run()
+{
+    int last;
+
+    do {
+        last = bits(1);
+        const int type = bits(2);
+        bool ok;
+
+        switch (type) {
+        case 0: ok = stored(); break;
+        case 1: ok = fixed(); break;
+        case 2: ok = dynamic(); break;
+        default: ok = false; break;
+        }
+
+        if (!ok) {
+            return false;
+        }
+    } while (last == 0 && !full());
+
+    if (fLimit >= 0 && fOut.size() > fLimit) {
+        fOut.truncate(int(fLimit));
+    }
+
+    return last >= 0;
+}
+
+
+//==============================================================================
+// Zip files. Only the central directory is read to list them, the local
+// header is only looked at to find where the data starts.
+//==============================================================================
+const quint32 ZIP_LOCAL_HEADER = 0x04034b50;
+const quint32 ZIP_CENTRAL_HEADER = 0x02014b50;
+const quint32 ZIP_END = 0x06054b50;
+const quint32 ZIP64_END = 0x06064b50;
+const quint32 ZIP64_LOCATOR = 0x07064b50;
+
+class zipArchive : public QuillContainer {
+
+protected:
+    bool    list(QString &error);
+    bool    readEntry(const containerEntry &entry, const qint64 limit,
+                      QByteArray &data, QString &error) const;
+};
+
+bool zipArchive::list(QString &error)
+{
+    // The end record is last, but there could be a comment after it.
+    qint64 end = -1;
+    for (qint64 e = fSize - 22; e >= 0 && e >= fSize - 22 - 65535; e--) {
+        if (littleLong(fData + e) == ZIP_END) {
+            end = e;
+            break;
+        }
+    }
+
+    if (end < 0) {
+        error = "This zip file has no central directory.";
+        return false;
+    }
+
+    quint64 count = littleWord(fData + end + 10);
+    quint64 directory = littleLong(fData + end + 16);
+
+    // Zip64 keeps the real numbers elsewhere.
+    if (directory == 0xffffffff || count == 0xffff) {
+        const qint64 locator = end - 20;
+        if (fits(locator, 20) && littleLong(fData + locator) == ZIP64_LOCATOR) {
+            const qint64 end64 = qint64(littleLongLong(fData + locator + 8));
+            if (!fits(end64, 56) || littleLong(fData + end64) != ZIP64_END) {
+                error = "This zip file's zip64 directory is damaged.";
+                return false;
+            }
+            count = littleLongLong(fData + end64 + 32);
+            directory = littleLongLong(fData + end64 + 48);
+        }
+    }
+
+    qint64 position = qint64(directory);
+    for (quint64 n = 0; n < count; n++) {
+        if (!fits(position, 46) || littleLong(fData + position) != ZIP_CENTRAL_HEADER) {
+            error = "This zip file's central directory is damaged.";
+            return false;
+        }
+
+        const uchar *header = fData + position;
+        const quint16 flags = littleWord(header + 8);
+        const quint16 nameLength = littleWord(header + 28);
+        const quint16 extraLength = littleWord(header + 30);
+        const quint16 commentLength = littleWord(header + 32);
+
+        if (!fits(position + 46, qint64(nameLength) + extraLength + commentLength)) {
+            error = "This zip file's central directory is damaged.";
+            return false;
+        }
+
+        const QByteArray name(reinterpret_cast<const char *>(header + 46), nameLength);
+
+        containerEntry file;
+        file.name = safeName((flags & 0x0800) ? QString::fromUtf8(name) : QString::fromLatin1(name));
+        file.method = littleWord(header + 10);
+        file.modified = dosDate(littleWord(header + 14), littleWord(header + 12));
+        file.storedSize = littleLong(header + 20);
+        file.size = littleLong(header + 24);
+        file.location = littleLong(header + 42);
+
+        // Zip64 sizes and offset, in that order, for those that didn't fit.
+        const uchar *extra = header + 46 + nameLength;
+        for (int x = 0; x + 4 <= extraLength; ) {
+            const quint16 id = littleWord(extra + x);
+            const quint16 size = littleWord(extra + x + 2);
+            if (id == 0x0001) {
+                const uchar *value = extra + x + 4;
+                const uchar *valueEnd = value + qMin<int>(size, extraLength - x - 4);
+                if (file.size == 0xffffffff && value + 8 <= valueEnd) {
+                    file.size = qint64(littleLongLong(value));
+                    value += 8;
+                }
+                if (file.storedSize == 0xffffffff && value + 8 <= valueEnd) {
+                    file.storedSize = qint64(littleLongLong(value));
+                    value += 8;
+                }
+                if (file.location == 0xffffffff && value + 8 <= valueEnd) {
+                    file.location = qint64(littleLongLong(value));
+                }
+            }
+            x += 4 + size;
+        }
+
+        position += 46 + nameLength + extraLength + commentLength;
+
+        // Directories, and anything we can't decrypt, aren't listed.
+        if (file.name.isEmpty() || name.endsWith('/') || (flags & 0x0001)) {
+            continue;
+        }
+
+        fEntries.append(file);
+    }
+
+    return true;
+}
+
+bool zipArchive::readEntry(const containerEntry &entry, const qint64 limit,
+                           QByteArray &data, QString &error) const
+{
+    const qint64 local = entry.location;
+    if (!fits(local, 30) || littleLong(fData + local) != ZIP_LOCAL_HEADER) {
+        error = "The zip entry's header is damaged.";
+        return false;
+    }
+
+    const qint64 start = local + 30 + littleWord(fData + local + 26) + littleWord(fData + local + 28);
+    if (!fits(start, entry.storedSize)) {
+        error = "The zip file is truncated.";
+        return false;
+    }
+
+    const qint64 wanted = (limit < 0) ? entry.size : qMin(limit, entry.size);
+    data.clear();
+
+    // The sizes come from the directory, and zip64 allows anything at all.
+    if (!sizeOK(wanted, error)) {
+        return false;
+    }
+
+    if (entry.method == 0) {
+        data = QByteArray(reinterpret_cast<const char *>(fData + start), int(qMin(wanted, entry.storedSize)));
+        return true;
+    }
+
+    if (entry.method != 8) {
+        error = QString("Zip compression method %1 isn't supported.").arg(entry.method);
+        return false;
+    }
+
+    // Never more than the directory said, whatever the data says.
+    data.reserve(int(wanted));
+    inflater inflate(fData + start, entry.storedSize, data, wanted);
+    if (!inflate.run() && data.size() < wanted) {
+        error = "The zip entry's compressed data is damaged.";
+        return false;
+    }
+
+    return true;
+}
+
+
+//==============================================================================
+// The common bits.
+//==============================================================================
+QuillContainer::QuillContainer()
+{
+    fData = nullptr;
+    fSize = 0;
+}
+
+QuillContainer::~QuillContainer()
+{
+}
+
+bool QuillContainer::isContainer(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly)) {
+        return false;
+    }
+
+    const QByteArray magic = file.read(4);
+    return magic == "QLWA" || magic == "QL5A" || magic == "QL5B" || magic == "PK\x03\x04";
+}
+
+//------------------------------------------------------------------------------
+// Open the container and list the Quill documents in it. Only their first 20
+// bytes are read to find out, which for a zip means only inflating that much.
+//------------------------------------------------------------------------------
+QuillContainer *QuillContainer::open(const QString &fileName, QString &error)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly)) {
+        error = file.errorString();
+        return nullptr;
+    }
+
+    const QByteArray magic = file.read(4);
+    file.close();
+
+    QuillContainer *container;
+    if (magic == "QLWA") {
+        container = new qxlWinImage;
+    } else if (magic == "QL5A" || magic == "QL5B") {
+        container = new qlFloppyImage;
+    } else if (magic == "PK\x03\x04") {
+        container = new zipArchive;
+    } else {
+        error = "This is not a QXL.WIN, QL floppy disc or zip file.";
+        return nullptr;
+    }
+
+    container->fFile.setFileName(fileName);
+    if (!container->mapFile(error) || !container->list(error)) {
+        delete container;
+        return nullptr;
+    }
+
+    QVector<containerEntry> quill;
+    for (int e = 0; e < container->fEntries.size(); e++) {
+        const containerEntry &entry = container->fEntries.at(e);
+        QByteArray header;
+        QString ignored;
+
+        if (container->readEntry(entry, 20, header, ignored) &&
+            QuillDoc::looksLikeQuill(reinterpret_cast<const uchar *>(header.constData()), header.size())) {
+            quill.append(entry);
+        }
+    }
+
+    container->fEntries = quill;
+    return container;
+}
+
+bool QuillContainer::read(const int n, QByteArray &data, QString &error) const
+{
+    return readEntry(fEntries.at(n), -1, data, error);
+}
+
+//------------------------------------------------------------------------------
+// The same as QuillDoc does, map it if we can, read it if we can't.
+//------------------------------------------------------------------------------
+bool QuillContainer::mapFile(QString &error)
+{
+    if (!fFile.open(QIODevice::ReadOnly)) {
+        error = fFile.errorString();
+        return false;
+    }
+
+    uchar *mapped = nullptr;
+    if (!fFile.isSequential() && fFile.size() > 0) {
+        mapped = fFile.map(0, fFile.size());
+    }
+
+    if (mapped) {
+        fData = mapped;
+        fSize = fFile.size();
+        return true;
+    }
+
+    fContents = fFile.readAll();
+    fFile.close();
+    fData = reinterpret_cast<const uchar *>(fContents.constData());
+    fSize = fContents.size();
+    return true;
+}
@@ -0,0 +1,90 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+// One file in a container. Where it is depends on the container.
+typedef struct containerEntry {
+    QString name;                   // QDOS name, or path in a zip, '/' separated.
+    qint64  size;                   // Bytes of data, without any QDOS header.
+    QDateTime modified;
+    qint64  location;               // First group, file number or local header.
+    qint64  storedSize;             // Zip only, compressed size.
+    quint16 method;                 // Zip only, 0 = stored, 8 = deflated.
+} containerEntry;
+
+
+// Read only access to the Quill documents inside something else, without
+// extracting them first:
+//
+//  QXL.WIN hard disc images, "QLWA".
+//  QL floppy disc images, "QL5A" (DD) and "QL5B" (HD).
+//  Zip files, stored or deflated, zip64 too.
+//
+// The container is mapped, or read if it can't be, and nothing is ever written
+// to it, so read() is thread safe. Only the entries that look like Quill
+// documents, going by their first 20 bytes, are listed.
+
+class QuillContainer {
+
+public:
+    virtual ~QuillContainer();
+
+    // Checks the first few bytes only.
+    static bool isContainer(const QString &fileName);
+
+    // Returns nullptr, with a message, if it can't be read.
+    static QuillContainer *open(const QString &fileName, QString &error);
+
+    QString fileName() const { return fFile.fileName(); }
+    const QVector<containerEntry> &entries() const { return fEntries; }
+
+    bool    read(const int n, QByteArray &data, QString &error) const;
+
+protected:
+    QuillContainer();
+
+    // Every file in the container, Quill or not.
+    virtual bool list(QString &error) = 0;
+
+    // At most limit bytes, if limit isn't negative.
+    virtual bool readEntry(const containerEntry &entry, const qint64 limit,
+                           QByteArray &data, QString &error) const = 0;
+
+    bool    fits(const qint64 offset, const qint64 length) const {
+        return offset >= 0 && length >= 0 && offset <= fSize && length <= fSize - offset;
+    }
+
+    QFile   fFile;
+    QByteArray fContents;           // If it couldn't be mapped.
+    const uchar *fData;
+    qint64  fSize;
+    QVector<containerEntry> fEntries;
+
+private:
+    bool    mapFile(QString &error);
+};
+
+#endif
@@ -0,0 +1,46 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#include <QMessageBox>
+
+#include "dialogreporter.h"
+
+DialogReporter::DialogReporter(QWidget *Parent)
+{
+    fParent = Parent;
+}
+
+static QString dialogText(const QString &source, const QString &message)
+{
+    if (source.isEmpty()) {
+        return message;
+    }
+
+    return source + "\n\n" + message;
+}
+
+void DialogReporter::write(const QString &source, const QString &message)
+{
+    QMessageBox::critical(fParent, QObject::tr("QStripper"), dialogText(source, message));
+}
+
+// Export failures, as they always were.
+void DialogReporter::writeWarning(const QString &source, const QString &message)
+{
+    QMessageBox::warning(fParent, QObject::tr("QStripper"), dialogText(source, message));
+}
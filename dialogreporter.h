@@ -0,0 +1,41 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#ifndef DIALOGREPORTER_H
+#define DIALOGREPORTER_H
+
+#include "errorreporter.h"
+
+class QWidget;
+
+// Errors in a message box, for the interactive GUI only. It waits for the user,
+// so never give one of these to a batch. Only call it from the GUI thread.
+class DialogReporter : public ErrorReporter {
+
+public:
+    DialogReporter(QWidget *Parent);
+
+protected:
+    void    write(const QString &source, const QString &message);
+    void    writeWarning(const QString &source, const QString &message);
+
+private:
+    QWidget *fParent;
+};
+
+#endif
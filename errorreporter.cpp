@@ -0,0 +1,115 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QTextStream>
+
+#include "errorreporter.h"
+#include "report.h"
+
+// Recursive, as a dialog runs the event loop, which might find another error.
+ErrorReporter::ErrorReporter() : fMutex(QMutex::Recursive)
+{
+    fPolicy = Continue;
+    fErrors = 0;
+}
+
+ErrorReporter::~ErrorReporter()
+{
+}
+
+bool ErrorReporter::policyFromName(const QString &name, Policy &policy)
+{
+    if (name.toLower() == "continue") {
+        policy = Continue;
+        return true;
+    }
+
+    if (name.toLower() == "abort") {
+        policy = Abort;
+        return true;
+    }
+
+    return false;
+}
+
+void ErrorReporter::error(const QString &source, const QString &message)
+{
+    QMutexLocker locker(&fMutex);
+
+    fErrors++;
+    write(source, message);
+}
+
+void ErrorReporter::warning(const QString &source, const QString &message)
+{
+    QMutexLocker locker(&fMutex);
+
+    fErrors++;
+    writeWarning(source, message);
+}
+
+int ErrorReporter::errors() const
+{
+    QMutexLocker locker(&fMutex);
+    return fErrors;
+}
+
+bool ErrorReporter::aborted() const
+{
+    QMutexLocker locker(&fMutex);
+    return fPolicy == Abort && fErrors > 0;
+}
+
+
+void StderrReporter::write(const QString &source, const QString &message)
+{
+    QTextStream err(stderr);
+
+    if (!source.isEmpty()) {
+        err << source << ": ";
+    }
+    err << message << "\n";
+}
+
+
+bool LogReporter::open(const QString &fileName, QString &error)
+{
+    fFile.setFileName(fileName);
+
+    if (!fFile.open(QFile::WriteOnly | QFile::Append)) {
+        error = QString("Cannot write error log %1:\n%2.").arg(fileName).arg(fFile.errorString());
+        return false;
+    }
+
+    return true;
+}
+
+// Flushed every time, the next thing that happens might be a crash.
+void LogReporter::write(const QString &source, const QString &message)
+{
+    QByteArray line;
+
+    line += "{\"time\":" + BatchReport::jsonString(QDateTime::currentDateTime().toUTC().toString(Qt::ISODate));
+    line += ",\"source\":" + BatchReport::jsonString(source);
+    line += ",\"message\":" + BatchReport::jsonString(message) + "}\n";
+
+    fFile.write(line);
+    fFile.flush();
+}
@@ -0,0 +1,100 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#ifndef ERRORREPORTER_H
+#define ERRORREPORTER_H
+
+#include <QFile>
+#include <QMutex>
+#include <QString>
+
+// Where parse and export errors go. The code that finds an error doesn't know,
+// or care, whether anyone is watching, it just tells the reporter. Which one
+// depends on how we're running:
+//
+//  StderrReporter - batches, from either program. The default.
+//  LogReporter    - batches with --error-log, a JSON line per error.
+//  DialogReporter - the GUI, a message box. See dialogreporter.h.
+//
+// The policy says what happens next. Continue carries on with the other files,
+// Abort stops taking new ones after the first error. Files already being
+// exported are allowed to finish.
+//
+// error() is thread safe, errors are written one at a time.
+
+class ErrorReporter {
+
+public:
+    enum Policy {
+        Continue,
+        Abort
+    };
+
+    ErrorReporter();
+    virtual ~ErrorReporter();
+
+    void    setPolicy(const Policy policy) { fPolicy = policy; }
+    Policy  policy() const { return fPolicy; }
+
+    // "continue" or "abort", as given to --on-error.
+    static bool policyFromName(const QString &name, Policy &policy);
+
+    // Source is the file concerned, if any.
+    void    error(const QString &source, const QString &message);
+
+    // Counted like an error, but less alarming to anyone watching.
+    void    warning(const QString &source, const QString &message);
+
+    int     errors() const;
+    bool    aborted() const;
+
+protected:
+    // One at a time, the mutex is held.
+    virtual void write(const QString &source, const QString &message) = 0;
+    virtual void writeWarning(const QString &source, const QString &message) { write(source, message); }
+
+private:
+    mutable QMutex fMutex;
+    Policy  fPolicy;
+    int     fErrors;
+};
+
+
+// "source: message", a line each.
+class StderrReporter : public ErrorReporter {
+
+protected:
+    void    write(const QString &source, const QString &message);
+};
+
+
+// {"time":"...","source":"...","message":"..."}, a line each, added to the end
+// of the log. Unattended runs can be grepped, or fed to whatever collects logs.
+class LogReporter : public ErrorReporter {
+
+public:
+    bool    open(const QString &fileName, QString &error);
+
+protected:
+    void    write(const QString &source, const QString &message);
+
+private:
+    QFile   fFile;
+};
+
+#endif
@@ -0,0 +1,29 @@
+######################################################################
+# quill-fuzzer - libFuzzer target for the parser and the containers.
+#
+# Needs clang. Build and run with:
+#
+#   cd fuzz && qmake && make && ./quill-fuzzer corpus
+#
+# The corpus is seeded from TestFiles/ when the fuzzer is linked, and
+# libFuzzer adds anything new it finds to it.
+######################################################################
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += concurrent
+TEMPLATE = app
+CONFIG += c++11 console debug
+CONFIG -= app_bundle
+TARGET = quill-fuzzer
+INCLUDEPATH += ..
+
+QMAKE_CC = clang
+QMAKE_CXX = clang++
+QMAKE_LINK = clang++
+QMAKE_CXXFLAGS += -fsanitize=fuzzer,address -fno-omit-frame-pointer
+QMAKE_LFLAGS += -fsanitize=fuzzer,address
+
+QMAKE_POST_LINK = mkdir -p corpus && cp $$PWD/../TestFiles/* corpus/
+
+# Input
+HEADERS += ../container.h ../quill.h ../quillscan.h
+SOURCES += quill_fuzzer.cpp ../container.cpp ../quill.cpp ../quillscan.cpp
@@ -0,0 +1,74 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+// libFuzzer target. Each input is parsed as a Quill document, headless, the
+// way a batch does it, so checkHeader() and the decoders get the lot. Inputs
+// that start like a QXL.WIN or floppy disc image, or a zip file, are opened as
+// a container too, and every Quill document found in there is parsed as well.
+
+#include <QByteArray>
+#include <QScopedPointer>
+#include <QString>
+#include <QTemporaryFile>
+
+#include "container.h"
+#include "quill.h"
+
+// The containers only open files, so the input is written to this one.
+static void fuzzContainer(const QByteArray &data)
+{
+    static QTemporaryFile *file = nullptr;
+    if (!file) {
+        file = new QTemporaryFile;
+        if (!file->open()) {
+            return;
+        }
+    }
+
+    file->resize(0);
+    file->seek(0);
+    file->write(data);
+    file->flush();
+
+    QString error;
+    QScopedPointer<QuillContainer> container(QuillContainer::open(file->fileName(), error));
+    if (!container) {
+        return;
+    }
+
+    for (int e = 0; e < container->entries().size(); e++) {
+        QByteArray contents;
+        if (container->read(e, contents, error)) {
+            delete QuillDoc::fromBytes(contents, true);
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    const QByteArray contents = QByteArray::fromRawData(reinterpret_cast<const char *>(data), int(size));
+
+    delete QuillDoc::fromBytes(contents, true);
+
+    if (contents.startsWith("QLWA") || contents.startsWith("QL5A") ||
+        contents.startsWith("QL5B") || contents.startsWith("PK\x03\x04")) {
+        fuzzContainer(contents);
+    }
+
+    return 0;
+}
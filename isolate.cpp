@@ -0,0 +1,609 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+//------------------------------------------------------------------------------
+// The protocol. The pool writes requests to a worker's stdin, and the worker
+// writes one reply per request to its stdout. Each is a frame, a big endian
+// 32 bit length then that many bytes of QDataStream, Qt 4.8 format.
+//
+// A request, one file to export:
+//
+//   qint32 index, QString file, QString container, qint32 entry, QString
+//   entry name, bool parallel writers, qint32 jobs, then for each job:
+//   qint32 format, QString output file, bool to memory.
+//
+// The container is empty unless the file is in a disc image or zip. Then the
+// worker opens the container itself and reads and inflates the entry, so a
+// damaged one can only take the worker with it. The name is there to check
+// it's the same entry the pool listed. Jobs to memory are for --bundle, the
+// rest are written to the output file by the worker.
+//
+// A reply, how it went:
+//
+//   qint32 index, bool parsed, QString dialect, qint64 text bytes,
+//   qint32 paragraphs, qint64 parse wall, qint64 parse CPU, qint64 export
+//   wall, QStringList errors, qint32 jobs, then for each job:
+//   bool ok, QString error, QByteArray data, qint64 bytes, wall, CPU.
+//
+// The worker only ever has one request at a time, and quits when its stdin is
+// closed. Anything it says on stderr is passed through, on Qt 5.
+//------------------------------------------------------------------------------
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QFile>
+#include <QHash>
+#include <QScopedPointer>
+#include <QtEndian>
+
+#ifdef Q_OS_WIN
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "container.h"
+#include "isolate.h"
+#include "quill.h"
+
+// Biggest frame we'll take. Any more and the worker is talking rubbish.
+static const quint32 maxFrameBytes = 512 * 1024 * 1024;
+
+// The command line option for each format, for the worker's arguments.
+static QString formatOption(const QuillExporter::Format format)
+{
+    switch (format) {
+        case QuillExporter::Text: return "--text";
+        case QuillExporter::HTML: return "--html";
+        case QuillExporter::PDF: return "--pdf";
+        case QuillExporter::ODF: return "--odf";
+        case QuillExporter::Docbook: return "--docbook";
+        case QuillExporter::RST: return "--rst";
+        case QuillExporter::ASC: return "--asc";
+    }
+
+    return QString();
+}
+
+// A frame is just a QDataStream'd QByteArray, length first.
+static QByteArray makeFrame(const QByteArray &body)
+{
+    QByteArray frame;
+    QDataStream stream(&frame, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_8);
+    stream << body;
+    return frame;
+}
+
+// Blocking, for the worker. False at the end of the input.
+static bool readFully(QFile &in, char *data, const qint64 length)
+{
+    qint64 done = 0;
+
+    while (done < length) {
+        const qint64 got = in.read(data + done, length - done);
+        if (got <= 0) {
+            return false;
+        }
+        done += got;
+    }
+
+    return true;
+}
+
+static bool readFrame(QFile &in, QByteArray &body)
+{
+    uchar header[4];
+    if (!readFully(in, reinterpret_cast<char *>(header), 4)) {
+        return false;
+    }
+
+    const quint32 length = qFromBigEndian<quint32>(header);
+    if (length > maxFrameBytes) {
+        return false;
+    }
+
+    body.resize(length);
+    return readFully(in, body.data(), length);
+}
+
+//------------------------------------------------------------------------------
+// For the worker. Each container is opened, and listed, the first time a file
+// in it is asked for, then kept until the worker quits.
+//------------------------------------------------------------------------------
+static bool readContainerEntry(QHash<QString, QuillContainer *> &containers, const QString &fileName,
+                               const int entry, const QString &name, QByteArray &contents, QString &error)
+{
+    QuillContainer *container = containers.value(fileName);
+    if (!container) {
+        container = QuillContainer::open(fileName, error);
+        if (!container) {
+            return false;
+        }
+        containers.insert(fileName, container);
+    }
+
+    if (entry < 0 || entry >= container->entries().size() || container->entries().at(entry).name != name) {
+        error = "The container has changed since the batch started.";
+        return false;
+    }
+
+    return container->read(entry, contents, error);
+}
+
+
+WorkerPool::WorkerPool(QuillBatch *Batch, const int Workers, QObject *parent)
+    : QObject(parent)
+{
+    fBatch = Batch;
+    fDone = false;
+
+    // The formats are only there so the worker knows which application to
+    // make. Each request says what it actually wants.
+    fArguments << "--worker";
+    for (int f = 0; f < fBatch->fOptions.formats.size(); f++) {
+        fArguments << formatOption(fBatch->fOptions.formats.at(f));
+    }
+
+    for (int w = 0; w < Workers; w++) {
+        isolatedWorker *worker = new isolatedWorker;
+        worker->process = nullptr;
+        worker->index = -1;
+
+        worker->timer = new QTimer(this);
+        worker->timer->setSingleShot(true);
+        connect(worker->timer, SIGNAL(timeout()), this, SLOT(timedOut()));
+
+        fWorkers.append(worker);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    for (int w = 0; w < fWorkers.size(); w++) {
+        stopWorker(fWorkers.at(w), false, false);
+    }
+
+    qDeleteAll(fWorkers);
+}
+
+//------------------------------------------------------------------------------
+// Give every worker a file, then sit in the event loop handing out more as the
+// replies come in, until there are none left and nobody is busy.
+//------------------------------------------------------------------------------
+void WorkerPool::run()
+{
+    for (int w = 0; w < fWorkers.size(); w++) {
+        dispatch(fWorkers.at(w));
+    }
+
+    if (!fDone) {
+        fLoop.exec();
+    }
+
+    // No more requests, so they'll all quit.
+    for (int w = 0; w < fWorkers.size(); w++) {
+        stopWorker(fWorkers.at(w), false, false);
+    }
+}
+
+bool WorkerPool::startWorker(isolatedWorker *worker, QString &error)
+{
+    QProcess *process = new QProcess(this);
+#if QT_VERSION >= 0x050000
+    process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+#endif
+
+    connect(process, SIGNAL(readyReadStandardOutput()), this, SLOT(readReply()));
+    connect(process, SIGNAL(finished(int, QProcess::ExitStatus)), this, SLOT(workerFinished()));
+
+    process->start(QCoreApplication::applicationFilePath(), fArguments);
+
+    if (!process->waitForStarted()) {
+        error = "Can't start a worker process: " + process->errorString();
+        disconnect(process, nullptr, this, nullptr);
+        delete process;
+        return false;
+    }
+
+    worker->process = process;
+    worker->buffer.clear();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Closing stdin asks a worker to quit. One that's stuck, or has timed out, is
+// killed instead. From one of the process's own signals, it can't be deleted
+// until we're back in the event loop.
+//------------------------------------------------------------------------------
+void WorkerPool::stopWorker(isolatedWorker *worker, const bool kill, const bool inSignal)
+{
+    QProcess *process = worker->process;
+    if (!process) {
+        return;
+    }
+
+    worker->process = nullptr;
+    worker->buffer.clear();
+    worker->timer->stop();
+    disconnect(process, nullptr, this, nullptr);
+
+    if (!kill) {
+        process->closeWriteChannel();
+    }
+
+    if (kill || !process->waitForFinished(5000)) {
+        process->kill();
+        process->waitForFinished(5000);
+    }
+
+    if (inSignal) {
+        process->deleteLater();
+    } else {
+        delete process;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Send a worker its next file, largest first. Files that don't need a worker,
+// all up to date in the cache, or that fail before they get that far, are
+// reported here and we go on to the next. A worker that died is replaced now,
+// when there's something for it to do.
+//------------------------------------------------------------------------------
+void WorkerPool::dispatch(isolatedWorker *worker)
+{
+    int index;
+
+    while (fBatch->takeWork(0, index)) {
+        worker->index = index;
+        worker->clock.start();
+        BatchReport::clear(worker->report);
+        worker->report.inputBytes = fBatch->fSizes.at(index);
+
+        worker->jobs = fBatch->pendingJobs(index, worker->key);
+        if (worker->jobs.isEmpty()) {
+            worker->report.status = "skipped";
+            finishFile(worker);
+            continue;
+        }
+
+        if (!fBatch->makeFolder(index, worker->report.errors)) {
+            finishFile(worker);
+            continue;
+        }
+
+        const inputFile &input = fBatch->fInputs.at(index);
+        QString containerName;
+        QString entryName;
+
+        if (input.container) {
+            containerName = input.container->fileName();
+            entryName = input.container->entries().at(input.entry).name;
+        }
+
+        QString error;
+        if (!worker->process && !startWorker(worker, error)) {
+            fileFailed(worker, error);
+            continue;
+        }
+
+        QByteArray request;
+        QDataStream stream(&request, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_4_8);
+
+        stream << qint32(index) << fBatch->fOptions.files.at(index) << containerName
+               << qint32(input.container ? input.entry : -1) << entryName
+               << fBatch->fParallelWriters << qint32(worker->jobs.size());
+
+        for (int j = 0; j < worker->jobs.size(); j++) {
+            const exportJob &job = worker->jobs.at(j);
+            stream << qint32(job.format) << job.outputFile << job.toMemory;
+        }
+
+        worker->process->write(makeFrame(request));
+
+        if (fBatch->fOptions.timeout > 0) {
+            worker->timer->start(fBatch->fOptions.timeout * 1000);
+        }
+        return;
+    }
+
+    checkDone();
+}
+
+// Nothing left to hand out, and nobody busy? Then the batch is done.
+void WorkerPool::checkDone()
+{
+    for (int w = 0; w < fWorkers.size(); w++) {
+        if (fWorkers.at(w)->index >= 0) {
+            return;
+        }
+    }
+
+    fDone = true;
+    fLoop.quit();
+}
+
+//------------------------------------------------------------------------------
+// Replies can arrive in pieces, so they are buffered until the whole frame is
+// here. A reply for a file the worker has since been killed over is ignored.
+//------------------------------------------------------------------------------
+void WorkerPool::readReply()
+{
+    isolatedWorker *worker = workerFor(sender());
+    if (!worker || !worker->process) {
+        return;
+    }
+
+    worker->buffer += worker->process->readAllStandardOutput();
+
+    while (worker->process && worker->buffer.size() >= 4) {
+        const quint32 length =
+            qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(worker->buffer.constData()));
+
+        if (length > maxFrameBytes) {
+            stopWorker(worker, true, true);
+            if (worker->index >= 0) {
+                fileFailed(worker, "The worker process sent a bad reply.");
+            }
+            dispatch(worker);
+            return;
+        }
+
+        if (quint32(worker->buffer.size() - 4) < length) {
+            return;
+        }
+
+        const QByteArray reply = worker->buffer.mid(4, length);
+        worker->buffer.remove(0, 4 + length);
+
+        if (worker->index < 0) {
+            continue;
+        }
+
+        worker->timer->stop();
+        fileDone(worker, reply);
+        dispatch(worker);
+    }
+}
+
+//------------------------------------------------------------------------------
+// A worker only quits by itself if something has gone badly wrong. Its file,
+// if it had one, is failed. A new worker is started for the next file.
+//------------------------------------------------------------------------------
+void WorkerPool::workerFinished()
+{
+    isolatedWorker *worker = workerFor(sender());
+    if (!worker) {
+        return;
+    }
+
+    QProcess *process = worker->process;
+    const bool crashed = (process->exitStatus() == QProcess::CrashExit);
+    const int exitCode = process->exitCode();
+
+    // We're in one of its signals, so it can't be deleted just yet.
+    disconnect(process, nullptr, this, nullptr);
+    process->deleteLater();
+    worker->process = nullptr;
+    worker->buffer.clear();
+    worker->timer->stop();
+
+    if (worker->index < 0) {
+        return;
+    }
+
+    if (crashed) {
+        fileFailed(worker, "The worker process crashed exporting this file.");
+    } else {
+        fileFailed(worker, QString("The worker process quit, exit code %1, exporting this file.").arg(exitCode));
+    }
+
+    dispatch(worker);
+}
+
+//------------------------------------------------------------------------------
+// Too long over one file. Probably going round in circles on a damaged
+// document, so it's killed, not asked to stop.
+//------------------------------------------------------------------------------
+void WorkerPool::timedOut()
+{
+    isolatedWorker *worker = workerFor(sender());
+    if (!worker || worker->index < 0) {
+        return;
+    }
+
+    stopWorker(worker, true, false);
+    fileFailed(worker, QString("Timed out after %1 seconds.").arg(fBatch->fOptions.timeout));
+    dispatch(worker);
+}
+
+//------------------------------------------------------------------------------
+// Fill in the report from the worker's reply, then add the exports to the
+// bundle, cache and report exactly as the threads would.
+//------------------------------------------------------------------------------
+void WorkerPool::fileDone(isolatedWorker *worker, const QByteArray &reply)
+{
+    fileReport &report = worker->report;
+    QDataStream stream(reply);
+    stream.setVersion(QDataStream::Qt_4_8);
+
+    qint32 index;
+    bool parsed;
+    qint32 paragraphs;
+    QStringList errors;
+    qint32 jobs;
+
+    stream >> index >> parsed >> report.dialect >> report.textBytes >> paragraphs
+           >> report.parseWall >> report.parseCPU >> report.exportWall >> errors >> jobs;
+
+    if (stream.status() != QDataStream::Ok || index != worker->index ||
+        (parsed && jobs != worker->jobs.size())) {
+        // Called from readReply(), in the process's own signal.
+        stopWorker(worker, true, true);
+        fileFailed(worker, "The worker process sent a bad reply.");
+        return;
+    }
+
+    report.paragraphs = paragraphs;
+    report.errors += errors;
+
+    if (parsed) {
+        for (int j = 0; j < jobs; j++) {
+            exportJob &job = worker->jobs[j];
+            stream >> job.ok >> job.error >> job.data >> job.bytes >> job.wall >> job.cpu;
+        }
+
+        fBatch->finishJobs(index, worker->jobs, worker->key, report);
+    }
+
+    worker->jobs.clear();
+    finishFile(worker);
+}
+
+void WorkerPool::fileFailed(isolatedWorker *worker, const QString &error)
+{
+    worker->report.errors.append(error);
+    worker->jobs.clear();
+    finishFile(worker);
+}
+
+// Report it, in order, along with any earlier files that are now done.
+void WorkerPool::finishFile(isolatedWorker *worker)
+{
+    fileReport &report = worker->report;
+
+    report.wall = worker->clock.nsecsElapsed() / 1000;
+    if (!report.errors.isEmpty()) {
+        report.status = "failed";
+    }
+
+    const int index = worker->index;
+    worker->index = -1;
+    fBatch->finished(index, report);
+}
+
+isolatedWorker *WorkerPool::workerFor(QObject *object) const
+{
+    for (int w = 0; w < fWorkers.size(); w++) {
+        isolatedWorker *worker = fWorkers.at(w);
+        if (worker->process == object || worker->timer == object) {
+            return worker;
+        }
+    }
+
+    return nullptr;
+}
+
+//------------------------------------------------------------------------------
+// The other end. One file at a time, with the same decode buffers each time,
+// just like a batch thread. The document is gone before the next request is
+// read. If the parser crashes, so do we, and the pool deals with it.
+//------------------------------------------------------------------------------
+int WorkerPool::runWorker()
+{
+#ifdef Q_OS_WIN
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    // Unbuffered, or a short request would sit waiting for a full buffer.
+    QFile in;
+    QFile out;
+    if (!in.open(stdin, QFile::ReadOnly | QFile::Unbuffered) || !out.open(stdout, QFile::WriteOnly)) {
+        return EXIT_FAILURES;
+    }
+
+    quillBuffers buffers;
+    QHash<QString, QuillContainer *> containers;
+    QByteArray request;
+    int result = EXIT_OK;
+
+    while (readFrame(in, request)) {
+        QDataStream stream(request);
+        stream.setVersion(QDataStream::Qt_4_8);
+
+        qint32 index;
+        QString fileName;
+        QString containerName;
+        qint32 entry;
+        QString entryName;
+        bool parallel;
+        qint32 count;
+
+        stream >> index >> fileName >> containerName >> entry >> entryName >> parallel >> count;
+
+        QVector<exportJob> jobs;
+        for (int j = 0; j < count && stream.status() == QDataStream::Ok; j++) {
+            qint32 format;
+            exportJob job;
+            stream >> format >> job.outputFile >> job.toMemory;
+            job.format = QuillExporter::Format(format);
+            job.ok = false;
+            job.bytes = 0;
+            job.wall = 0;
+            job.cpu = 0;
+            jobs.append(job);
+        }
+
+        if (stream.status() != QDataStream::Ok) {
+            result = EXIT_FAILURES;
+            break;
+        }
+
+        fileReport report;
+        BatchReport::clear(report);
+
+        const bool inMemory = !containerName.isEmpty();
+        QByteArray contents;
+        QString error;
+        QScopedPointer<QuillDoc> doc;
+
+        if (inMemory && !readContainerEntry(containers, containerName, entry, entryName, contents, error)) {
+            report.errors.append(error);
+        } else {
+            doc.reset(QuillBatch::parseFile(fileName, contents, inMemory, buffers, report));
+        }
+        contents.clear();
+
+        if (doc) {
+            QElapsedTimer timer;
+            timer.start();
+            QuillBatch::writeJobs(doc.data(), jobs, parallel);
+            report.exportWall = timer.nsecsElapsed() / 1000;
+        }
+
+        QByteArray reply;
+        QDataStream replyStream(&reply, QIODevice::WriteOnly);
+        replyStream.setVersion(QDataStream::Qt_4_8);
+
+        replyStream << index << !doc.isNull() << report.dialect << report.textBytes
+                    << qint32(report.paragraphs) << report.parseWall << report.parseCPU
+                    << report.exportWall << report.errors << qint32(jobs.size());
+
+        for (int j = 0; j < jobs.size(); j++) {
+            const exportJob &job = jobs.at(j);
+            replyStream << job.ok << job.error << job.data << job.bytes << job.wall << job.cpu;
+        }
+
+        out.write(makeFrame(reply));
+        out.flush();
+    }
+
+    qDeleteAll(containers);
+    return result;
+}
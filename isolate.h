@@ -0,0 +1,98 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#ifndef ISOLATE_H
+#define ISOLATE_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QObject>
+#include <QProcess>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+
+#include "batch.h"
+#include "cache.h"
+#include "report.h"
+
+// One worker process, and the file it's working on, if any.
+typedef struct isolatedWorker {
+    QProcess *process;
+    QTimer *timer;                  // Fires if the file takes too long.
+    int index;                      // Into batchOptions::files, -1 if idle.
+    QVector<exportJob> jobs;        // What it was asked to do.
+    cacheKey key;
+    fileReport report;
+    QElapsedTimer clock;            // Since the file was taken.
+    QByteArray buffer;              // Reply so far.
+} isolatedWorker;
+
+
+// qstripper-cli --isolate. The batch's files are exported by a pool of -j N
+// worker processes instead of threads, so a Quill file that crashes the
+// parser, or sends it round in circles, can't take the whole batch with it.
+//
+// A worker that dies, or takes longer than --timeout seconds over one file, is
+// killed if need be and a new one started in its place. Its file is failed,
+// and the batch carries on. Everything else, the cache, --bundle, --report and
+// the order errors are reported in, is as it is with threads. --max-rss isn't
+// needed, each worker only has one file in memory at a time.
+//
+// The workers are this program again, with --worker. See isolate.cpp for what
+// goes down the pipes.
+
+class WorkerPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    WorkerPool(QuillBatch *Batch, const int Workers, QObject *parent = nullptr);
+    ~WorkerPool();
+
+    // Export the batch's files, returns when they are all done.
+    void    run();
+
+    // qstripper-cli --worker. Exports files as the pool asks, until stdin is
+    // closed. Returns the exit code.
+    static int runWorker();
+
+private slots:
+    void    readReply();
+    void    workerFinished();
+    void    timedOut();
+
+private:
+    bool    startWorker(isolatedWorker *worker, QString &error);
+    void    stopWorker(isolatedWorker *worker, const bool kill, const bool inSignal);
+    void    dispatch(isolatedWorker *worker);
+    void    fileDone(isolatedWorker *worker, const QByteArray &reply);
+    void    fileFailed(isolatedWorker *worker, const QString &error);
+    void    finishFile(isolatedWorker *worker);
+    isolatedWorker *workerFor(QObject *object) const;
+    void    checkDone();
+
+    QuillBatch *fBatch;
+    QStringList fArguments;         // For each worker process.
+    QVector<isolatedWorker *> fWorkers;
+    QEventLoop fLoop;
+    bool fDone;                     // Nothing left to do, fLoop can stop.
+};
+
+#endif
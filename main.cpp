@@ -31,8 +31,9 @@ int main(int argc, char *argv[])
     if (argc > 1) {
 
         // If true, we are exporting silently.
-        if (mainWin.processArgs(argc, argv))
-            return 0;
+        int exitCode;
+        if (mainWin.processArgs(argc, argv, exitCode))
+            return exitCode;
     }
 
     // Otherwise, display the main window.
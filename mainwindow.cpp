@@ -18,6 +18,8 @@
 
 #include <QtGui>
 
+#include "batch.h"
+#include "dialogreporter.h"
 #include "mainwindow.h"
 #include "mdichild.h"
 #include "ndworkspace.h"
@@ -34,6 +36,7 @@ MainWindow::MainWindow()
     setWindowIcon(QIcon(":/images/quill.jpg"));
     setWindowTitle(tr("QStripper Open Source Edition"));
     fileName.clear();
+    reporter = new DialogReporter(this);
 
     createActions();
     createMenus();
@@ -66,6 +69,12 @@ MainWindow::MainWindow()
     workspace->setScrollBarsEnabled(true);
 }
 
+// The reporter isn't a QObject, so it isn't deleted with us.
+MainWindow::~MainWindow()
+{
+    delete reporter;
+}
+
 // Slot to update the various Text Formatting Actions when the cursor moves
 // over a 'new' format in any child window.
 void MainWindow::FormatChanged(const QTextCharFormat &Format)
@@ -384,7 +393,7 @@ void MainWindow::help()
                "a desired format, pdf for example."
                "<br>"
                "<br>If --export is present, it <em>must</em> be the first parameter. It <em>must</em> also be followed "
-               "by a valid export format, which must be one of the following:"
+               "by one or more valid export formats, from the following:"
                "<br>"
                "<br><b>--pdf</b> - Export all files to pdf."
                "<br><b>--text</b> - Export all files to text."
@@ -393,6 +402,29 @@ void MainWindow::help()
                "<br><b>--html</b> - Export all files to HTML format."
                "<br><b>--rst</b> - Export all files to ReStructuredText format."
                "<br><b>--asc</b> - Export all files to Asciidoctor format."
+               "<br><br>Or use <b>--formats pdf,html,rst</b> etc. Each file is only read once, "
+               "however many formats are requested."
+               "<br><br><b>-j N</b>, after --export, exports N files at once. The default is one per core."
+               "<br><br><b>--recursive DIR</b>, after --export, exports every Quill file in and under DIR. "
+               "<b>--include GLOB</b> and <b>--exclude GLOB</b> choose the file names to look at, "
+               "the default being *.doc and *_doc. Files that aren't Quill files are skipped."
+               "<br><br><b>--cache DIR</b> keeps a manifest of exports in DIR, and unchanged files "
+               "are skipped next time. <b>--prune</b> deletes exports of files that have been deleted."
+               "<br><br><b>--bundle FILE</b> writes all the exports into one .zip or .tar file instead."
+               "<br><br><b>--report FILE</b> writes a JSON line per file, with sizes, times and any errors, "
+               "then a summary line with totals and percentiles."
+               "<br><br><b>--on-error abort</b> stops after the first error, instead of carrying on. "
+               "<b>--error-log FILE</b> adds errors to FILE, as JSON lines, rather than stderr. "
+               "Exports never stop to show a dialog. The exit code is 0 if everything was exported, "
+               "1 if anything failed, 2 for a bad command line and 3 if the export was aborted."
+               "<br><br><b>qstripper-cli --isolate</b> exports in worker processes rather than threads, "
+               "so a damaged file that crashes or hangs only fails itself. <b>--timeout SECS</b>, 60 by "
+               "default, 0 for none, is how long one file may take."
+               "<br><br>QXL.WIN and QL floppy disc images, and zip files, are read for the Quill files "
+               "inside them. Those are exported to a folder named after the image, <em>disk_win</em> for "
+               "<em>disk.win</em>."
+               "<br><br><b>QStripper --from FILE --to FORMAT</b> converts one file, or stdin if FILE "
+               "is -, to stdout. FORMAT is text, html, rst, adoc, docbook, odf or pdf."
                "<br><br>All files will be created in the <em>same folder as the input file(s).</em>"
                ));
 }
@@ -473,7 +505,7 @@ void MainWindow::updateWindowMenu()
 
 MdiChild *MainWindow::createMdiChild()
 {
-    MdiChild *child = new MdiChild;
+    MdiChild *child = new MdiChild(reporter);
     workspace->addWindow(child);
 
     connect(child, SIGNAL(copyAvailable(bool)),
@@ -799,18 +831,29 @@ MdiChild *MainWindow::findMdiChild(const QString &fileName)
     return nullptr;
 }
 
-// If we have any passed args on startup, process them here.
-bool MainWindow::processArgs(int argc, char *argv[])
+// If we have any passed args on startup, process them here. Returns true if
+// the GUI isn't wanted, with the code to exit with.
+//
+// Exports can run unattended, so they never put up a dialog. Errors go to
+// stderr, or --error-log.
+bool MainWindow::processArgs(int argc, char *argv[], int &exitCode)
 {
+    exitCode = EXIT_OK;
+
     // The commandline format is:
     //
     // qstripper --help
     //
     // or
     //
-    // qstripper --export --fmt list_of_files
+    // qstripper --export --fmt [--fmt ...] list_of_files
+    // qstripper --export --formats fmt,fmt,... list_of_files
+    //
+    // or
     //
-    // Fmt is one of the following:
+    // qstripper --from file --to fmt
+    //
+    // Fmt is one or more of the following:
     // --pdf --docbook --odf --html --text --rst --asc
     //
 
@@ -823,76 +866,32 @@ bool MainWindow::processArgs(int argc, char *argv[])
         return true;
     }
 
-    // Check if we are exporting next:
-    if (optionArg == "--export") {
-        // We are exporting!
-        // Which export format?
-        QString exportFormat = QString(argv[2]).toLower();
-
-        // Valid format?
-        if (exportFormat != "--pdf" &&
-            exportFormat != "--docbook" &&
-            exportFormat != "--text" &&
-            exportFormat != "--odf" &&
-            exportFormat != "--rst" &&
-            exportFormat != "--asc" &&
-            exportFormat != "--html") {
-            QMessageBox::critical(this, "QStripper - Invalid export format", QString(argv[2]) + " is not a valid export format!");
+    // Check if we are exporting next, or converting to stdout:
+    if (optionArg == "--export" || optionArg == "--from") {
+        // We are exporting! This is exactly what qstripper-cli does, each
+        // file is read once and written in every requested format.
+        QStringList args;
+        for (int a = 1; a < argc; a++) {
+            args.append(QString::fromLocal8Bit(argv[a]));
+        }
+
+        batchOptions Options;
+        QString error;
+
+        if (!QuillBatch::parseArgs(args, Options, error)) {
+            QTextStream(stderr) << "qstripper: " << error << "\n\n" << QuillBatch::usage();
+            exitCode = EXIT_USAGE;
             return true;
         }
 
-        // We have a valid format for export.
-
-        // For each filename passed in argv[3] onwards, export to the
-        // same folder, in the desired format.
-        MdiChild *c = new MdiChild();
-        c->setSilent(true);
-
-        for (int Files = 3; Files < argc; Files++) {
-            c->curFile = QString(argv[Files]);
-            c->loadFile(c->curFile);
-
-            if (exportFormat == "--pdf") {
-                c->PDFFile.clear();
-                c->ExportPDF();
-            }
-
-            if (exportFormat == "--docbook") {
-                c->XMLFile.clear();
-                c->ExportDocbook();
-            }
-
-            if (exportFormat == "--text") {
-                c->TXTFile.clear();
-                c->ExportText();
-            }
-
-            if (exportFormat == "--odf") {
-                c->ODFFile.clear();
-                c->ExportODF();
-            }
-
-            if (exportFormat == "--rst") {
-                c->RSTFile.clear();
-                c->ExportRST();
-            }
-
-            if (exportFormat == "--asc") {
-                c->ASCFile.clear();
-                c->ExportASC();
-            }
-
-            if (exportFormat == "--html") {
-                c->HTMLFile.clear();
-                c->ExportHTML();
-            }
-
-            // "Close" the file.
-            c->clear();
+        if (!Options.watchDirectory.isEmpty() || Options.serve || Options.isolate || Options.worker) {
+            QTextStream(stderr) << "qstripper: --watch, --serve and --isolate need qstripper-cli.\n";
+            exitCode = EXIT_USAGE;
+            return true;
         }
 
-        // Finished from the working window.
-        delete c;
+        QuillBatch batch(Options);
+        exitCode = batch.run();
 
         // Don't show the GUI.
         return true;
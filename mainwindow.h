@@ -35,6 +35,7 @@ class QMimeData;
 class QFontComboBox;
 class QComboBox;
 class QImage;
+class ErrorReporter;
 
 class MainWindow : public QMainWindow
 {
@@ -42,8 +43,9 @@ class MainWindow : public QMainWindow
 
 public:
     MainWindow();
+    ~MainWindow();
     void openFile(const QString &fileName);
-    bool processArgs(int argc, char *argv[]);
+    bool processArgs(int argc, char *argv[], int &exitCode);
 
 protected:
     void closeEvent(QCloseEvent *event);
@@ -148,6 +150,8 @@ private:
     QComboBox *comboSize;
     QString fileName;
 
+    ErrorReporter *reporter;    // Message boxes, for the children.
+
     QImage Jupiter;
     QList<QAction *> recentFileActionList;
     enum {maxRecentFiles = 10};
@@ -20,6 +20,7 @@
 #include <QStack>
 //#include <QtDebug>
 
+#include "errorreporter.h"
 #include "mdichild.h"
 #include "quill.h"
 
@@ -28,10 +29,12 @@ MdiChild::~MdiChild()
     if (Input) delete Input;
 }
 
-MdiChild::MdiChild()
+MdiChild::MdiChild(ErrorReporter *Reporter)
 {
     setAttribute(Qt::WA_DeleteOnClose);
     silentRunning = false;
+    Input = nullptr;
+    reporter = Reporter;
 
     connect(document(), SIGNAL(contentsChanged()), this, SLOT(documentWasModified()));
     connect(this, SIGNAL(currentCharFormatChanged(const QTextCharFormat &)),
@@ -57,16 +60,18 @@ void MdiChild::focusInEvent(QFocusEvent *event)
 
 bool MdiChild::loadFile(const QString &fileName)
 {
-    QFile file(fileName);
-    Input = new QuillDoc(fileName);
-    if (!Input->isValid()) {
-      QMessageBox::critical(this, tr("QStripper"),
-                            tr("This is not a Quill file.\nError message :\n\n") + QString(Input->getError()));
+    QuillDoc *Doc = new QuillDoc(fileName);
+    if (!Doc->isValid()) {
+      reporter->error(fileName, tr("This is not a Quill file.\nError message :\n\n") + QString(Doc->getError()));
+      delete Doc;
       return false;
     }
 
-    // Use the quill document as our document.
-    setDocument(Input->getDocument());
+    // Use the quill document as our document. The previous one, if any, is
+    // no longer needed and its QTextDocument goes with it.
+    setDocument(Doc->getDocument());
+    if (Input) delete Input;
+    Input = Doc;
     setFocus();
     setCurrentFile(fileName);
 
@@ -91,23 +96,8 @@ bool MdiChild::ExportText()
     if (fileExtension(fileName).toLower() != "txt")
         fileName += ".txt";
 
-    QFile file(fileName);
-    if (!file.open(QFile::WriteOnly | QFile::Text)) {
-        QMessageBox::warning(this, tr("QStripper"),
-                             tr("Cannot write plain text file %1:\n%2.")
-                             .arg(fileName)
-                             .arg(file.errorString()));
+    if (!exportDocument(QuillExporter::Text, fileName, QString()))
         return false;
-    }
-
-    QTextDocumentWriter txt;
-    txt.setFormat("plaintext");
-    txt.setCodec(QTextCodec::codecForName("UTF-8"));
-    txt.setFileName(fileName);
-
-    QApplication::setOverrideCursor(Qt::WaitCursor);
-    txt.write(document());
-    QApplication::restoreOverrideCursor();
 
     TXTFile = fileName;
     document()->setModified(false);
@@ -132,22 +122,8 @@ bool MdiChild::ExportHTML()
     if (fileExtension(fileName).toLower() != "html")
         fileName += ".html";
 
-    QFile file(fileName);
-    if (!file.open(QFile::WriteOnly | QFile::Text)) {
-        QMessageBox::warning(this, tr("QStripper"),
-                             tr("Cannot write HTML file %1:\n%2.")
-                             .arg(fileName)
-                             .arg(file.errorString()));
+    if (!exportDocument(QuillExporter::HTML, fileName, QString()))
         return false;
-    }
-
-    QTextDocumentWriter html;
-    html.setFormat("HTML");
-    html.setCodec(QTextCodec::codecForName("UTF-8"));
-    html.setFileName(fileName);
-    QApplication::setOverrideCursor(Qt::WaitCursor);
-    html.write(document());
-    QApplication::restoreOverrideCursor();
 
     HTMLFile = fileName;
     document()->setModified(false);
@@ -172,13 +148,8 @@ bool MdiChild::ExportPDF()
     if (fileExtension(fileName).toLower() != "pdf")
         fileName += ".pdf";
 
-    QPrinter Pdf(QPrinter::HighResolution);
-    Pdf.setOutputFormat(QPrinter::PdfFormat);
-    Pdf.setOutputFileName(fileName);
-
-    QApplication::setOverrideCursor(Qt::WaitCursor);
-    document()->print(&Pdf);
-    QApplication::restoreOverrideCursor();
+    if (!exportDocument(QuillExporter::PDF, fileName, QString()))
+        return false;
 
     PDFFile = fileName;
     document()->setModified(false);
@@ -203,13 +174,8 @@ bool MdiChild::ExportODF()
     if (fileExtension(fileName).toLower() != "odf")
         fileName += ".odf";
 
-    QTextDocumentWriter odf;
-    odf.setFormat("odf");
-    odf.setFileName(fileName);
-
-    QApplication::setOverrideCursor(Qt::WaitCursor);
-    odf.write(document());
-    QApplication::restoreOverrideCursor();
+    if (!exportDocument(QuillExporter::ODF, fileName, QString()))
+        return false;
 
     ODFFile = fileName;
     document()->setModified(false);
@@ -234,15 +200,6 @@ bool MdiChild::ExportDocbook()
     if (fileExtension(fileName).toLower() != "xml")
         fileName += ".xml";
 
-    QFile file(fileName);
-    if (!file.open(QFile::WriteOnly | QFile::Text)) {
-        QMessageBox::warning(this, tr("QStripper"),
-                             tr("Cannot write DocBook XML file %1:\n%2.")
-                             .arg(fileName)
-                             .arg(file.errorString()));
-        return false;
-    }
-
     // Ask user for a title for the Article.
     bool ok = false;
     QString ArticleTitle;
@@ -253,110 +210,18 @@ bool MdiChild::ExportDocbook()
                                             tr("Please enter a title for the DocBook article"),
                                             QLineEdit::Normal, "", &ok);
     if (!ok) {
-       ArticleTitle = "**** PUT YOUR TITLE HERE PLEASE ****";
-    }
-
-    QTextStream out(&file);
-    out.setCodec(QTextCodec::codecForName("ISO 8859-15"));
-    QApplication::setOverrideCursor(Qt::WaitCursor);
-
-    // XML header first.
-    out << "<?xml version=\"1.0\" encoding=\"iso-8859-15\"?>\n";
-    out << "<!DOCTYPE article PUBLIC \"-//OASIS//DTD DocBook XML V4.2//EN\"\n";
-    out << "\"http://www.oasis-open.org/docbook/xml/4.2/docbookx.dtd\">\n";
-
-    // Make this an article, so get a title from the user.
-    out << "<article>\n";
-    out << "<title>" << ArticleTitle << "</title>\n";
-
-    // Iterate over all text blocks in the document and process each one
-    // as a paragraph. Empty paragraphs are ignored.
-    QTextBlock tb = document()->begin();
-    while (tb.isValid()) {
-        QString Paragraph = DocBookParagraph(tb);
-        if (!Paragraph.isEmpty()) {
-            out << "<para>" << Paragraph << "</para>\n";
-        }
-
-        tb = tb.next();
+       ArticleTitle.clear();
     }
 
-    // Finish off the article.
-    out << "</article>\n";
+    if (!exportDocument(QuillExporter::Docbook, fileName, ArticleTitle))
+        return false;
 
-    QApplication::restoreOverrideCursor();
     XMLFile = fileName;
     document()->setModified(false);
     return true;
 }
 
 
-// For each and every paragraph, iterate over each fragment of text,
-// where we build up an XML 'statement'.
-QString MdiChild::DocBookParagraph(const QTextBlock &ThisBlock)
-{
-    QString Paragraph;
-    for (QTextBlock::iterator it = ThisBlock.begin(); !it.atEnd(); it++) {
-      QTextFragment tf = it.fragment();
-      Paragraph += DocBookFragment(tf);
-    }
-
-    return Paragraph;
-}
-
-// This is where we process each paragraph's text fragments and remove
-// invalid XML characters.
-//
-// TODO : Foreign character translation isn't working yet and can cause
-//        illegal characters in the XML file.
-QString MdiChild::DocBookFragment(const QTextFragment &ThisFragment)
-{
-    QTextCharFormat Format = ThisFragment.charFormat();
-    QString ThisText = ThisFragment.text();
-
-    // We've got hard spaces, +/- etc in the text to translate.
-    unsigned char Nbsp = 0xA0;
-    unsigned char PlusMinus = 0xB1;
-
-    if (!ThisText.isEmpty()) {
-         // Do '&' first - so we don't change '&lt;' to '&amp;lt;' !
-         ThisText.replace(QString("&"), QString("&amp;"));
-         ThisText.replace(QString("<"), QString("&lt;"));
-         ThisText.replace(QString(">"), QString("&gt;"));
-         ThisText.replace(QString("\t"), QString("    "));
-         ThisText.replace(QString(PlusMinus), QString("&plusmn;"));
-         ThisText.replace(QString(Nbsp), QString(" "));
-    }
-
-    // Here we try to decode what text attributes have been applied
-    // and return a suitable XML 'statment' to accomodate them.
-    if (Format.font().italic())
-       return "<emphasis>" + ThisText + "</emphasis>";
-
-    if (Format.font().underline())
-       return "<emphasis role=\"underline\">" + ThisText + "</emphasis>";
-
-    if (Format.font().bold())
-       return "<emphasis role=\"bold\">" + ThisText + "</emphasis>";
-
-     switch (Format.verticalAlignment()) {
-        case QTextCharFormat::AlignNormal: return ThisText;
-        case QTextCharFormat::AlignSuperScript: return "<superscript>" +
-                                                       ThisText +
-                                                       "</superscript>";
-        case QTextCharFormat::AlignSubScript: return "<subscript>" +
-                                                       ThisText +
-                                                       "</supbscript>";
-        case QTextCharFormat::AlignMiddle: break;
-        case QTextCharFormat::AlignTop: break;
-        case QTextCharFormat::AlignBottom: break;
-        case QTextCharFormat::AlignBaseline: break;
-     }
-     
-     return ThisText;
-}
-
-
 // Export a document in ReStructuredText, in UTF8 encoding.
 bool MdiChild::ExportRST()
 {
@@ -376,15 +241,6 @@ bool MdiChild::ExportRST()
     if (fileExtension(fileName).toLower() != "rst")
         fileName += ".rst";
 
-    QFile file(fileName);
-    if (!file.open(QFile::WriteOnly | QFile::Text)) {
-        QMessageBox::warning(this, tr("QStripper"),
-                             tr("Cannot write ReStructuredText (RST) file %1:\n%2.")
-                             .arg(fileName)
-                             .arg(file.errorString()));
-        return false;
-    }
-
     // Ask user for a title for the RST Document.
     bool ok = false;
     QString ArticleTitle;
@@ -395,114 +251,18 @@ bool MdiChild::ExportRST()
                                             tr("Please enter a title for the article"),
                                             QLineEdit::Normal, "", &ok);
     if (!ok) {
-       ArticleTitle = "==========\n"
-                      "YOUR TITLE\n"
-                      "==========\n\n";
-    } else {
-        // Work out under and overlines for the title.
-        int titleSize = ArticleTitle.size();
-        QString overUnderLine = QString().fill('=', titleSize) + "\n";
-        ArticleTitle = overUnderLine + ArticleTitle + "\n" + overUnderLine;
-    }
-
-
-    QTextStream out(&file);
-
-    // Pandoc and other converters require UTF8.
-    out.setCodec(QTextCodec::codecForName("UTF-8"));
-
-    QApplication::setOverrideCursor(Qt::WaitCursor);
-
-    // Make this an article, so get a title from the user.
-    out << ArticleTitle;
-
-    // Iterate over all text blocks in the document and process each one
-    // as a paragraph. Empty paragraphs are ignored.
-    QTextBlock tb = document()->begin();
-    while (tb.isValid()) {
-        QString Paragraph = RSTParagraph(tb);
-        if (!Paragraph.isEmpty())
-        out << endl << Paragraph << endl;
-
-        tb = tb.next();
+       ArticleTitle.clear();
     }
 
-    // Finish off the article.
-    out << endl;
+    if (!exportDocument(QuillExporter::RST, fileName, ArticleTitle))
+        return false;
 
-    QApplication::restoreOverrideCursor();
     RSTFile = fileName;
     document()->setModified(false);
     return true;
 }
 
 
-// For each and every paragraph, iterate over each fragment of text.
-QString MdiChild::RSTParagraph(const QTextBlock &ThisBlock)
-{
-    QString Paragraph;
-    for (QTextBlock::iterator it = ThisBlock.begin(); !it.atEnd(); it++) {
-      QTextFragment tf = it.fragment();
-      Paragraph += RSTFragment(tf);
-    }
-
-    return Paragraph;
-}
-
-// This is where we process each paragraph's text fragments and remove
-// invalid RST characters.
-QString MdiChild::RSTFragment(const QTextFragment &ThisFragment)
-{
-    QTextCharFormat Format = ThisFragment.charFormat();
-    QString ThisText = ThisFragment.text();
-
-    QString euroInput = QString(QChar(0x80));
-    QString euroOutput = QString(QChar(0x20ac));  // Unicode U+20AC for Euro.
-
-    if (!ThisText.isEmpty()) {
-         // Do '\' first or else you get all sorts of stuff going wrong!
-         // And '\' needs to be escaped, so becomes '\\' - don't forget!
-         ThisText.replace(QString("\\"), QString("\\\\"));
-         ThisText.replace(QString("_"), QString("\\_"));
-         ThisText.replace(QString("*"), QString("\\*"));
-         ThisText.replace(QString("$"), QString("\\$"));
-         ThisText.replace(QString("`"), QString("\\`"));
-    }
-
-    // Here we try to decode what text attributes have been applied
-    // and return a suitable XML 'statment' to accomodate them.
-    // BEWARE: if an italic fragment has leading whitspace, the
-    //         italics wont work in RST as no whitespace is permitted.
-    if (Format.font().italic())
-       ThisText = "*" + ThisText + "*\\ ";
-
-    // There is no underline in RST. :-(
-    if (Format.font().underline()) {
-       ; // do nothing. (Unless we can fix RST of course!)
-    }
-
-    // BEWARE: if a bold fragment has leading whitspace, the bold
-    //         wont work in RST as no whitespace is permitted.
-    if (Format.font().bold())
-       ThisText = "**" + ThisText + "**\\ ";
-
-     // These are mutually exclusive.
-     switch (Format.verticalAlignment()) {
-        case QTextCharFormat::AlignSuperScript:
-            return ":sup:`" + ThisText + "`\\ ";
-        case QTextCharFormat::AlignSubScript:
-            return ":sub:`" + ThisText + "`\\ ";
-        case QTextCharFormat::AlignNormal: break;
-        case QTextCharFormat::AlignMiddle: break;
-        case QTextCharFormat::AlignTop: break;
-        case QTextCharFormat::AlignBottom: break;
-        case QTextCharFormat::AlignBaseline: break;
-     }
-
-     return ThisText;
-}
-
-
 // Export a document in ASCIIDoc[tor], in UTF8 encoding.
 bool MdiChild::ExportASC()
 {
@@ -522,15 +282,6 @@ bool MdiChild::ExportASC()
     if (fileExtension(fileName).toLower() != "adoc")
         fileName += ".adoc";
 
-    QFile file(fileName);
-    if (!file.open(QFile::WriteOnly | QFile::Text)) {
-        QMessageBox::warning(this, tr("QStripper"),
-                             tr("Cannot write ASCIIdoctor (ASC) file %1:\n%2.")
-                             .arg(fileName)
-                             .arg(file.errorString()));
-        return false;
-    }
-
     // Ask user for a title for the ASC Document.
     bool ok = false;
     QString ArticleTitle;
@@ -541,94 +292,36 @@ bool MdiChild::ExportASC()
                                             tr("Please enter a title for the article"),
                                             QLineEdit::Normal, "", &ok);
     if (!ok) {
-       ArticleTitle = "= YOUR TITLE\n";
-    } else {
-        ArticleTitle = "= " + ArticleTitle + "\n";
-    }
-
-
-    QTextStream out(&file);
-
-    // Pandoc and other converters require UTF8.
-    out.setCodec(QTextCodec::codecForName("UTF-8"));
-
-    QApplication::setOverrideCursor(Qt::WaitCursor);
-
-    // Make this an article, so use the title from the user.
-    out << ArticleTitle;
-
-    // Iterate over all text blocks in the document and process each one
-    // as a paragraph. Empty paragraphs are ignored.
-    QTextBlock tb = document()->begin();
-    while (tb.isValid()) {
-        QString Paragraph = ASCParagraph(tb);
-        if (!Paragraph.isEmpty())
-            out << endl << Paragraph << endl;
-
-        tb = tb.next();
+       ArticleTitle.clear();
     }
 
-    // Finish off the article.
-    out << endl;
+    if (!exportDocument(QuillExporter::ASC, fileName, ArticleTitle))
+        return false;
 
-    QApplication::restoreOverrideCursor();
     ASCFile = fileName;
     document()->setModified(false);
     return true;
 }
 
 
-// For each and every paragraph, iterate over each fragment of text.
-QString MdiChild::ASCParagraph(const QTextBlock &ThisBlock)
+// All the exports end up here. The editor's document is exported, as the user
+// may have changed it since it was loaded.
+bool MdiChild::exportDocument(const QuillExporter::Format format,
+                              const QString &fileName,
+                              const QString &title)
 {
-    QString Paragraph;
-    for (QTextBlock::iterator it = ThisBlock.begin(); !it.atEnd(); it++) {
-      QTextFragment tf = it.fragment();
-      Paragraph += ASCFragment(tf);
-    }
-
-    return Paragraph;
-}
+    QuillExporter exporter(document());
+    exporter.setTitle(title);
 
-// This is where we process each paragraph's text fragments and remove
-// invalid ASCIIdoctor characters.
-QString MdiChild::ASCFragment(const QTextFragment &ThisFragment)
-{
-    QTextCharFormat Format = ThisFragment.charFormat();
-    QString ThisText = ThisFragment.text();
-
-    // Here we try to decode what text attributes have been applied
-    // and return a suitable XML 'statment' to accomodate them.
-    // BEWARE: if an italic fragment has leading whitespace, the
-    //         italics wont work in ASCIIdoctor as no whitespace is permitted.
-    if (Format.font().italic()) {
-       ThisText = "__" + ThisText + "__";
-    }
-
-    // There is no underline in ASCIIdoctor. :-(
-    if (Format.font().underline()) {
-       ; // Do nothing, until ASCIIdoctor is fixed.
-    }
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    bool ok = exporter.writeFile(format, fileName);
+    QApplication::restoreOverrideCursor();
 
-    // BEWARE: if a bold fragment has leading whitspace, the bold
-    //         won't work in RST as no whitespace is permitted.
-    if (Format.font().bold()) {
-       ThisText =  "**" + ThisText + "**";
+    if (!ok) {
+        reporter->warning(fileName, exporter.errorString());
     }
 
-     switch (Format.verticalAlignment()) {
-        case QTextCharFormat::AlignSuperScript:
-            return "^" + ThisText + "^";
-        case QTextCharFormat::AlignSubScript:
-            return "~" + ThisText + "~";
-        case QTextCharFormat::AlignNormal: break;
-        case QTextCharFormat::AlignMiddle: break;
-        case QTextCharFormat::AlignTop: break;
-        case QTextCharFormat::AlignBottom: break;
-        case QTextCharFormat::AlignBaseline: break;
-     }
-
-     return ThisText;
+    return ok;
 }
 
 
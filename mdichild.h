@@ -23,14 +23,17 @@
 #include <QTextStream>
 #include <QTextFragment>
 
+#include "quillexport.h"
+
 class QuillDoc;
+class ErrorReporter;
 
 class MdiChild : public QTextEdit
 {
     Q_OBJECT
 
 public:
-    MdiChild();
+    MdiChild(ErrorReporter *Reporter);
     ~MdiChild();
 
     bool loadFile(const QString &fileName);
@@ -75,18 +78,15 @@ signals:
 private:
     void setCurrentFile(const QString &fileName);
     QString strippedName(const QString &fullFileName);
-    
-    QString DocBookParagraph(const QTextBlock &ThisBlock);
-    QString DocBookFragment(const QTextFragment &ThisFragment);
-    QString RSTParagraph(const QTextBlock &ThisBlock);
-    QString RSTFragment(const QTextFragment &ThisFragment);
-    QString ASCParagraph(const QTextBlock &ThisBlock);
-    QString ASCFragment(const QTextFragment &ThisFragment);
+    bool exportDocument(const QuillExporter::Format format,
+                        const QString &fileName,
+                        const QString &title);
     bool maybeSave();
     bool isUntitled;
     bool silentRunning;
 
     QuillDoc *Input;
+    ErrorReporter *reporter;    // Where load and export errors go.
 };
 
 #endif
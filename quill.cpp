@@ -17,26 +17,345 @@
 ****************************************************************************/
 
 #include "quill.h"
+#include "quillscan.h"
+
+#include <QtConcurrentMap>
+#include <climits>
+#include <cstring>
+
+//------------------------------------------------------------------------------
+// Everything that differs between QL and DOS Quill files. The parser is a set of
+// templates over one of these, and the choice is made once per document, after
+// the header says which it is. Nothing in the decoding loops has to check.
+//------------------------------------------------------------------------------
+struct QLDialect {
+    static const bool littleEndian = false;         // Like the 68008.
+
+    typedef layoutTableQL layoutTable;
+
+    // MOST of the QL Character set is valid ASCII, so anything under 127 or
+    // over 187 is unchanged. The exception is 96, which is the Pound Sterling
+    // sign. Everything from 127 to 187 needs converting to Unicode.
+    static constexpr char16_t translation[256] = {
+         0x0000, 0x0001, 0x0002, 0x0003, 0x0004, 0x0005, 0x0006, 0x0007,
+         0x0008, 0x0009, 0x000a, 0x000b, 0x000c, 0x000d, 0x000e, 0x000f,
+         0x0010, 0x0011, 0x0012, 0x0013, 0x0014, 0x0015, 0x0016, 0x0017,
+         0x0018, 0x0019, 0x001a, 0x001b, 0x001c, 0x001d, 0x001e, 0x001f,
+         0x0020, 0x0021, 0x0022, 0x0023, 0x0024, 0x0025, 0x0026, 0x0027,
+         0x0028, 0x0029, 0x002a, 0x002b, 0x002c, 0x002d, 0x002e, 0x002f,
+         0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
+         0x0038, 0x0039, 0x003a, 0x003b, 0x003c, 0x003d, 0x003e, 0x003f,
+         0x0040, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047,
+         0x0048, 0x0049, 0x004a, 0x004b, 0x004c, 0x004d, 0x004e, 0x004f,
+         0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057,
+         0x0058, 0x0059, 0x005a, 0x005b, 0x005c, 0x005d, 0x005e, 0x005f,
+         0x00a3, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,  // Pound Sterling (96)
+         0x0068, 0x0069, 0x006a, 0x006b, 0x006c, 0x006d, 0x006e, 0x006f,
+         0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+         0x0078, 0x0079, 0x007a, 0x007b, 0x007c, 0x007d, 0x007e,
+         0x00a9, // Copyright (c)    (127)
+         0x00e4, // a umlaut (128)
+         0x00e3, // a tilde  (129)
+         0x00e5, // a circle (130)
+         0x00e9, // e acute  (131)
+         0x00f6, // o umlaut (132)
+         0x00f5, // o tilde  (133)
+         0x00f8, // o with / (134)
+         0x00fc, // u umlaut (135)
+         0x00e7, // c cedilla    (136)
+         0x00f1, // n tilde  (137)
+         0x00e6, // ae ligature  (138)
+         0x0153, // oe Ligature (Deprecated in Unicode)  (139)
+         0x00e1, // a acute  (140)
+         0x00e0, // a grave  (141)
+         0x00e2, // a circumflex (a^)    (142)
+         0x00eb, // e umlaut (143)
+         0x00e8, // e grave  (144)
+         0x00ea, // e circumflex (145)
+         0x00ef, // i umlaut (146)
+         0x00ed, // i acute  (147)
+         0x00ec, // i grave  (148)
+         0x00ee, // i circumflex (149)
+         0x00f3, // o acute  (150)
+         0x00f2, // o grave  (151)
+         0x00f4, // o circumflex (152)
+         0x00fa, // u acute  (153)
+         0x00f9, // u grave  (154)
+         0x00fb, // u circumflex (155)
+         0x00df, // sz ligature (German B?)  (156)
+         0x00a2, // cent (157)
+         0x00a5, // Yen  (158)
+         0x00b4, // acute    (159)
+         0x00c4, // A umlaut (160)
+         0x00c3, // A tilde  (161)
+         0x00c2, // A circumflex (162)
+         0x00c9, // E acute  (163)
+         0x00d6, // O umlaut (164)
+         0x00d5, // O tilde  (165)
+         0x00d8, // O with / (166)
+         0x00dc, // U umlaut (167)
+         0x00c7, // C cedilla    (168)
+         0x00d1, // N tilde  (169)
+         0x00c6, // AE ligature  (170)
+         0x0152, // OE Ligature (Deprecated in Unicode)  (171)
+         0x03b1, // Lower case alpha. (172)
+         0x03b4, // Lower case delta  (173)
+         0x0398, // Upper case theta  (174)
+         0x03bb, // Lower case lambda (175)
+         0x03bc, // Lower case Mu (micro as in u) (176)
+         0x03c6, // Lower case phi (as in p)  (177)
+         0x03a6, // Upper case phi    (178)
+         0x00a1, // iexclamation (upside down !) (179)
+         0x00bf, // iquestion (upside down ?)    (180)
+         0x20ac, // Euro  (181)
+         0x00a7, // Section marker   (182)
+         0x2295, // Cross circle ???????????????????????????  (183)
+         0x00ab, // French Quote <<  (184)
+         0x00bb, // French Quote >>  (185)
+         0x00b0, // Degree   (186)
+         0x00f7, // Divide  (187)
+         0x00bc, 0x00bd, 0x00be, 0x00bf, 0x00c0, 0x00c1, 0x00c2, 0x00c3,
+         0x00c4, 0x00c5, 0x00c6, 0x00c7, 0x00c8, 0x00c9, 0x00ca, 0x00cb,
+         0x00cc, 0x00cd, 0x00ce, 0x00cf, 0x00d0, 0x00d1, 0x00d2, 0x00d3,
+         0x00d4, 0x00d5, 0x00d6, 0x00d7, 0x00d8, 0x00d9, 0x00da, 0x00db,
+         0x00dc, 0x00dd, 0x00de, 0x00df, 0x00e0, 0x00e1, 0x00e2, 0x00e3,
+         0x00e4, 0x00e5, 0x00e6, 0x00e7, 0x00e8, 0x00e9, 0x00ea, 0x00eb,
+         0x00ec, 0x00ed, 0x00ee, 0x00ef, 0x00f0, 0x00f1, 0x00f2, 0x00f3,
+         0x00f4, 0x00f5, 0x00f6, 0x00f7, 0x00f8, 0x00f9, 0x00fa, 0x00fb,
+         0x00fc, 0x00fd, 0x00fe, 0x00ff
+    };
+};
+
+struct DOSDialect {
+    static const bool littleEndian = true;          // Like the 8088.
+
+    typedef layoutTableDOS layoutTable;
+
+    // A DOS file is "supposed" to be in Code Page 437 encoding, so the
+    // following table converts any DOS CP437 character into a suitable
+    // Unicode character. I'm not sure what the EURO will do as that was
+    // never part of CP437!
+    //
+    // Stolen from http://svn.openmoko.org/trunk/src/host/qemu-neo1973/phonesim/lib/serial/qatutils.cpp
+    static constexpr char16_t translation[256] = {
+         0x0000, 0x0001, 0x0002, 0x0003, 0x0004, 0x0005, 0x0006, 0x0007,
+         0x0008, 0x0009, 0x000a, 0x000b, 0x000c, 0x000d, 0x000e, 0x000f,
+         0x0010, 0x0011, 0x0012, 0x0013, 0x0014, 0x0015, 0x0016, 0x0017,
+         0x0018, 0x0019, 0x001c, 0x001b, 0x007f, 0x001d, 0x001e, 0x001f,
+         0x0020, 0x0021, 0x0022, 0x0023, 0x0024, 0x0025, 0x0026, 0x0027,
+         0x0028, 0x0029, 0x002a, 0x002b, 0x002c, 0x002d, 0x002e, 0x002f,
+         0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
+         0x0038, 0x0039, 0x003a, 0x003b, 0x003c, 0x003d, 0x003e, 0x003f,
+         0x0040, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047,
+         0x0048, 0x0049, 0x004a, 0x004b, 0x004c, 0x004d, 0x004e, 0x004f,
+         0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057,
+         0x0058, 0x0059, 0x005a, 0x005b, 0x005c, 0x005d, 0x005e, 0x005f,
+         0x0060, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
+         0x0068, 0x0069, 0x006a, 0x006b, 0x006c, 0x006d, 0x006e, 0x006f,
+         0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+         0x0078, 0x0079, 0x007a, 0x007b, 0x007c, 0x007d, 0x007e, 0x001a,
+         0x00c7, 0x00fc, 0x00e9, 0x00e2, 0x00e4, 0x00e0, 0x00e5, 0x00e7,
+         0x00ea, 0x00eb, 0x00e8, 0x00ef, 0x00ee, 0x00ec, 0x00c4, 0x00c5,
+         0x00c9, 0x00e6, 0x00c6, 0x00f4, 0x00f6, 0x00f2, 0x00fb, 0x00f9,
+         0x00ff, 0x00d6, 0x00dc, 0x00a2, 0x00a3, 0x00a5, 0x20a7, 0x0192,
+         0x00e1, 0x00ed, 0x00f3, 0x00fa, 0x00f1, 0x00d1, 0x00aa, 0x00ba,
+         0x00bf, 0x2310, 0x00ac, 0x00bd, 0x00bc, 0x00a1, 0x00ab, 0x00bb,
+         0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
+         0x2555, 0x2563, 0x2551, 0x2557, 0x255d, 0x255c, 0x255b, 0x2510,
+         0x2514, 0x2534, 0x252c, 0x251c, 0x2500, 0x253c, 0x255e, 0x255f,
+         0x255a, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256c, 0x2567,
+         0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256b,
+         0x256a, 0x2518, 0x250c, 0x2588, 0x2584, 0x258c, 0x2590, 0x2580,
+         0x03b1, 0x00df, 0x0393, 0x03c0, 0x03a3, 0x03c3, 0x03bc, 0x03c4,
+         0x03a6, 0x0398, 0x03a9, 0x03b4, 0x221e, 0x03c6, 0x03b5, 0x2229,
+         0x2261, 0x00b1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00f7, 0x2248,
+         0x00b0, 0x2219, 0x00b7, 0x221a, 0x207f, 0x00b2, 0x25a0, 0x00a0
+    };
+};
+
+constexpr char16_t QLDialect::translation[256];
+constexpr char16_t DOSDialect::translation[256];
+
+
+//------------------------------------------------------------------------------
+// Translates a whole span of characters into Unicode in one go.
+//------------------------------------------------------------------------------
+template <typename Dialect>
+static void transcodeAs(const quint8 *source, size_t length, char16_t *dest)
+{
+    for (size_t x = 0; x < length; ++x) {
+        dest[x] = Dialect::translation[source[x]];
+    }
+}
+
 
 QuillDoc::~QuillDoc()
 {
     // If we have a current document, delete it.
     if (document) delete document;
+
+    // Hand our buffers back for the next document.
+    if (fBuffers) {
+        qSwap(fBuffers->text, fText);
+        qSwap(fBuffers->runs, fRuns);
+        qSwap(fBuffers->paragraphs, fParagraphs);
+    }
 }
 
 //------------------------------------------------------------------------------
 // Constructor - opens the filename and reads in the raw data. As the data is
 // in QDOS format, it is converted to 'proper' ASCII format as it is read. This
 //is done with a simple translation table.
+//
+// Headless documents only decode the text into runs. The QTextDocument isn't
+// built until somebody calls getDocument(), which batch exports of text etc
+// never need to do.
+//
+// Buffers, if supplied, are decoded into rather than allocating new ones, and
+// are given back, to be used again, by the destructor.
 //------------------------------------------------------------------------------
-QuillDoc::QuillDoc(const QString FileName)
+QuillDoc::QuillDoc(const QString FileName, const bool Headless, quillBuffers *Buffers)
+{
+    initialise();
+    fBuffers = Buffers;
+    fFile.setFileName(FileName);
+
+    // Try to load the file as raw data after performing a few checks to
+    // see if it may be a Quill document.
+    loadFile(FileName);
+    if (fValid) {
+        //Build a document from the raw contents.
+        parseFile();
+    }
+
+    // Not headless? Build the QTextDocument now, as we always used to.
+    if (!Headless) {
+        getDocument();
+    }
+}
+
+//------------------------------------------------------------------------------
+// Does this look like a Quill document? Only the header length and the magic
+// are checked, so only the first 20 bytes are needed. A document that passes
+// can still be rejected by checkHeader(), but one that fails never will be.
+//------------------------------------------------------------------------------
+bool QuillDoc::looksLikeQuill(const uchar *Header, const qint64 Size)
+{
+    if (Size < 20) {
+        return false;
+    }
+
+    // 20 if read big endian = QL, 5,120 if it's a PC file.
+    const quint16 headerLength = headerView(Header, false).headerLength();
+    if (headerLength != 20 && headerLength != 5120) {
+        return false;
+    }
+
+    return memcmp(Header + 2, "vrm1qdf0", 8) == 0;
+}
+
+bool QuillDoc::looksLikeQuill(const QString &FileName)
+{
+    QFile file(FileName);
+    if (!file.open(QFile::ReadOnly)) {
+        return false;
+    }
+
+    uchar header[20];
+    const qint64 got = file.read(reinterpret_cast<char *>(header), sizeof(header));
+    return looksLikeQuill(header, got);
+}
+
+//------------------------------------------------------------------------------
+// A hash of the parts of a Quill file that matter: the header, the text and the
+// tables. Quill rounds files up to a multiple of 512 bytes, and whatever was in
+// memory goes into the padding, so two saves of the same document can differ
+// after the tables. Returns an empty hash if it isn't a Quill file.
+//------------------------------------------------------------------------------
+QByteArray QuillDoc::contentHash(const QString &FileName)
+{
+    QFile file(FileName);
+    if (!file.open(QFile::ReadOnly)) {
+        return QByteArray();
+    }
+
+    uchar header[20];
+    if (file.read(reinterpret_cast<char *>(header), sizeof(header)) != 20 ||
+        !looksLikeQuill(header, 20)) {
+        return QByteArray();
+    }
+
+    headerView view(header, false);
+    if (view.headerLength() == 5120) {
+        view = headerView(header, true);
+    }
+
+    // The tables follow the text. Broken lengths just hash to the end.
+    quint64 end = quint64(view.textLength()) + view.paraTableLength() +
+                  view.freeSpaceLength() + view.layoutTableLength();
+    end = qMin(end, quint64(file.size()));
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(reinterpret_cast<const char *>(header), sizeof(header));
+
+    quint64 done = sizeof(header);
+    while (done < end) {
+        QByteArray block = file.read(qint64(qMin(end - done, quint64(64 * 1024))));
+        if (block.isEmpty()) {
+            break;
+        }
+
+        hash.addData(block);
+        done += quint64(block.size());
+    }
+
+    return hash.result();
+}
+
+//------------------------------------------------------------------------------
+// Used by fromBytes() only.
+//------------------------------------------------------------------------------
+QuillDoc::QuillDoc()
+{
+    initialise();
+}
+
+//------------------------------------------------------------------------------
+// Create a QuillDoc from bytes that have already been read from somewhere,
+// stdin, an archive, whatever. Exactly the same checks are made as for a file,
+// and Buffers are used the same way too. The caller owns the returned document.
+//------------------------------------------------------------------------------
+QuillDoc *QuillDoc::fromBytes(const QByteArray &Contents, const bool Headless, quillBuffers *Buffers)
+{
+    QuillDoc *doc = new QuillDoc();
+    doc->fBuffers = Buffers;
+
+    doc->fRawFileContents = Contents;
+    doc->fRawData = reinterpret_cast<const uchar *>(doc->fRawFileContents.constData());
+    doc->fRawSize = doc->fRawFileContents.size();
+
+    doc->checkHeader();
+    if (doc->fValid) {
+        doc->parseFile();
+    }
+
+    if (!Headless) {
+        doc->getDocument();
+    }
+
+    return doc;
+}
+
+//------------------------------------------------------------------------------
+// Initialise everything.
+//------------------------------------------------------------------------------
+void QuillDoc::initialise()
 {
-    // Initialise everything.
     fHeaderLength = 0;
     fQuillMagic.clear();
     fHeader.clear();
     fFooter.clear();
-    document = new QTextDocument();     // We need to delete this!
+    document = nullptr;                 // Built by getDocument().
     fTextLength = 0;
     fParaTableLength = 0;
     fFreeSpaceLength = 0;
@@ -44,41 +363,54 @@ QuillDoc::QuillDoc(const QString FileName)
     fValid = false;
     fErrorMessage.clear();
     fPCFile = false;
-    fLayoutTableQL = nullptr;
-    fLayoutTableDOS = nullptr;
-    fParagraphTable = nullptr;
+    fRawData = nullptr;
+    fRawSize = 0;
     fTabTable = nullptr;
-
-    // Try to load the file as raw data after performing a few checks to
-    // see if it may be a Quill document.
-    loadFile(FileName);
-    if (fValid) {
-        //Build a document from the raw contents.
-        parseFile();
-    }
+    fBuffers = nullptr;
 }
 
 //------------------------------------------------------------------------------
 // Open the supplied file and check if it is actually a valid Quill document. If
-// so, read in the header data and the raw bytes. The file is closed here as
-// well. Everything else happens with the raw data.
+// so, pick up the header data. The raw bytes are mapped straight from the file
+// where possible, so the header, tables and text are all decoded from the one
+// place without a second open or a copy. Everything else happens with the raw
+// data.
 //------------------------------------------------------------------------------
 
 void QuillDoc::loadFile(const QString FileName)
 {
-    // Make sure we read integers and stuff in BigEndian mode - like the QL does :o)
-    QFile file(FileName);
-    file.open(QIODevice::ReadOnly);
-    QDataStream in(&file);
-    in.setByteOrder(QDataStream::BigEndian);
+    fValid = false;
+
+    if (!mapFile()) {
+        fErrorMessage = QString("Cannot read file %1: %2").arg(FileName).arg(fFile.errorString());
+        return;
+    }
+
+    checkHeader();
+}
+
+//------------------------------------------------------------------------------
+// Check the header of the raw data, and that everything it says fits inside
+// the raw data. This is the only place offsets and lengths from the file are
+// checked, so everything after this can trust them. Junk is rejected here,
+// having only looked at the header, and the header and footer terminators.
+//------------------------------------------------------------------------------
+void QuillDoc::checkHeader()
+{
+    fValid = false;
+
+    if (fRawSize < 20) {
+        fErrorMessage = QString("File is too small to be a Quill document, only %1 bytes").arg(fRawSize);
+        return;
+    }
 
     // The first two bytes are 0x00 and 0x14 = 20 = Size of header block. (QL)
     // or 0x14 and 0x00 = 5,120 if we are reading a PC Quill document. (PC)
-    fValid = false;
-    in >> fHeaderLength;
+    // Integers are BigEndian - like the QL does :o) - unless it's a PC file.
+    fHeaderView = headerView(fRawData, false);
+    fHeaderLength = fHeaderView.headerLength();
 
     if (fHeaderLength != 20 && fHeaderLength != 5120) {  // 20 = QL, 5,120 = PC
-        fValid = false;
         fErrorMessage = QString("Header block length not equal 20 bytes, actually = %1").arg(fHeaderLength);
         return;
     }
@@ -87,39 +419,86 @@ void QuillDoc::loadFile(const QString FileName)
     if (fHeaderLength == 5120) {
         fHeaderLength = 20;
         fPCFile = true;
-        in.setByteOrder(QDataStream::LittleEndian);
+        fHeaderView = headerView(fRawData, true);
     }
 
     // The next 8 bytes are "vrm1qdf0"
-    fQuillMagic.clear();
-    quint8 Char;
-    for (int x = 0; x < 8; ++x) {
-       in >> Char;
-       fQuillMagic.append(Char);
-    }
+    const QByteArray magic = fHeaderView.magic();
+    fQuillMagic = QString::fromLatin1(magic.constData(), magic.size());
 
     if (fQuillMagic != "vrm1qdf0") {
-        fValid = false;
         fErrorMessage = QString("Header flag bytes not equal 'vrm1qdf0', actually = '%1'").arg(fQuillMagic);
         return;
     }
 
-    // The next 4 bytes are the text length.
-    in >> fTextLength;
+    // The next 4 bytes are the text length, then the three 2 byte pointers.
+    fTextLength = fHeaderView.textLength();
+    fParaTableLength = fHeaderView.paraTableLength();
+    fFreeSpaceLength = fHeaderView.freeSpaceLength();
+    fLayoutTableLength = fHeaderView.layoutTableLength();
+
+    // The text area must fit in the file, after the header.
+    if (fTextLength < 20 || fTextLength > fRawSize) {
+        fErrorMessage = QString("Text length of %1 bytes doesn't fit in a file of %2 bytes")
+                        .arg(fTextLength).arg(fRawSize);
+        return;
+    }
 
-    // Fetch the three 2 byte pointers.
-    in >> fParaTableLength;
-    in >> fFreeSpaceLength;
-    in >> fLayoutTableLength;
+    // And so must the tables, after the text.
+    quint64 tablesEnd = quint64(fTextLength) + fParaTableLength + fFreeSpaceLength + fLayoutTableLength;
+    if (tablesEnd > quint64(fRawSize)) {
+        fErrorMessage = QString("Tables end at offset %1, past the end of a file of %2 bytes")
+                        .arg(tablesEnd).arg(fRawSize);
+        return;
+    }
+
+    // The text area always starts with the header and footer paragraphs,
+    // each of which must be terminated by a zero byte.
+    const void *headerEnd = memchr(fRawData + 20, 0, fTextLength - 20);
+    const void *footerEnd = nullptr;
+    if (headerEnd) {
+        const uchar *footerStart = static_cast<const uchar *>(headerEnd) + 1;
+        footerEnd = memchr(footerStart, 0, size_t(fRawData + fTextLength - footerStart));
+    }
+
+    if (!footerEnd) {
+        fErrorMessage = QString("Page header and footer are not terminated within the text area");
+        return;
+    }
 
-    file.close();
     fValid = true;
     fErrorMessage = "";
+}
+
+//------------------------------------------------------------------------------
+// Map the whole file into memory. Pipes and other special files can't be
+// mapped, so for those we fall back to reading it all into fRawFileContents.
+// The raw data is only ever read, never written. Returns false if the file
+// can't be opened at all.
+//------------------------------------------------------------------------------
+bool QuillDoc::mapFile()
+{
+    if (!fFile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    uchar *mapped = nullptr;
+    if (!fFile.isSequential() && fFile.size() > 0) {
+        mapped = fFile.map(0, fFile.size());
+    }
+
+    if (mapped) {
+        // The file has to stay open, or the mapping goes away.
+        fRawData = mapped;
+        fRawSize = fFile.size();
+        return true;
+    }
 
-    // Now, read in the entire file as a QByteArray.
-    file.open(QIODevice::ReadOnly);
-    fRawFileContents = file.readAll();
-    file.close();
+    fRawFileContents = fFile.readAll();
+    fFile.close();
+    fRawData = reinterpret_cast<const uchar *>(fRawFileContents.constData());
+    fRawSize = fRawFileContents.size();
+    return true;
 }
 
 //------------------------------------------------------------------------------
@@ -127,20 +506,32 @@ void QuillDoc::loadFile(const QString FileName)
 //------------------------------------------------------------------------------
 void QuillDoc::parseFile()
 {
-    parseParagraphTable();      // Sets pointers to the raw data's paragraph table.
-    parseFreeSpaceTable();      // Does nothing!!!
-    parseLayoutTable();         // Sets pointers to the raw data's layout table.
-    parseText();                // Actually reads the text!
+    if (fPCFile) {
+        parseFileAs<DOSDialect>();
+    } else {
+        parseFileAs<QLDialect>();
+    }
+}
+
+template <typename Dialect>
+void QuillDoc::parseFileAs()
+{
+    parseParagraphTable<Dialect>(); // Builds the paragraph index.
+    parseFreeSpaceTable<Dialect>(); // Sets a view of the free space table.
+    parseLayoutTable<Dialect>();    // Sets a view of the layout table.
+    parseText<Dialect>();           // Actually reads the text!
 }
 
 //------------------------------------------------------------------------------
 // Extract the text including headers and footers.
 //------------------------------------------------------------------------------
+template <typename Dialect>
 void QuillDoc::parseText()
 {
     // The text area always starts at offset 20. The first two paragraphs are
     // the header and footer - which may be blank. The terminating byte of zero
-    // will always be found. (All paragraphs are terminated by a zero byte.)
+    // will always be found, checkHeader() made sure of that. (All paragraphs
+    // are terminated by a zero byte.)
     quint8 Char;
     QChar qChar;
 
@@ -148,23 +539,268 @@ void QuillDoc::parseText()
     fRawPointer = 20;       // Always the start of the text area.
 
      do {
-       Char = fRawFileContents[fRawPointer++];  // Points to NEXT character now.
+       Char = fRawData[fRawPointer++];  // Points to NEXT character now.
        if (Char == 0) break;
-       qChar = translate(Char);
+       qChar = QChar(ushort(Dialect::translation[Char]));
        fHeader.append(qChar);
     } while (1);
 
     // Footer next.
     do {
-       Char = fRawFileContents[fRawPointer++];  // Points to NEXT character now.
+       Char = fRawData[fRawPointer++];  // Points to NEXT character now.
        if (Char == 0) break;
-       qChar = translate(Char);
+       qChar = QChar(ushort(Dialect::translation[Char]));
        fFooter.append(qChar);
     } while (1);
 
     // The actual text comes next. We stop when we reach offset fTextLength as
     // that is the first byte of the following Paragraph table.
+    //
+    // Rather than feeding the QTextDocument one character at a time, the text
+    // is translated into fText and split up into runs of characters that all
+    // share the same attributes. Each paragraph is a range of those runs.
+    //
+    // A zero byte resets every attribute, so each paragraph can be decoded on
+    // its own. Big documents are split into chunks of whole paragraphs, which
+    // are decoded in parallel and then stitched back together, in order.
+    QVector<textChunk> chunks = splitText(fRawPointer, fTextLength);
+
+    // Any recycled buffers from the last document get decoded into.
+    if (fBuffers) {
+        qSwap(fText, fBuffers->text);
+        qSwap(fRuns, fBuffers->runs);
+        qSwap(fParagraphs, fBuffers->paragraphs);
+    }
+
+    if (chunks.size() == 1) {
+        qSwap(chunks[0].text, fText);
+        qSwap(chunks[0].runs, fRuns);
+        qSwap(chunks[0].paragraphs, fParagraphs);
+        decodeText<Dialect>(chunks[0]);
+        qSwap(fText, chunks[0].text);
+        qSwap(fRuns, chunks[0].runs);
+        qSwap(fParagraphs, chunks[0].paragraphs);
+        return;
+    }
+
+    QtConcurrent::blockingMap(chunks, [this](textChunk &chunk) { decodeText<Dialect>(chunk); });
+
+    int textSize = 0;
+    int runCount = 0;
+    int paragraphCount = 0;
+    for (const textChunk &chunk : chunks) {
+        textSize += chunk.text.size();
+        runCount += chunk.runs.size();
+        paragraphCount += chunk.paragraphs.size();
+    }
+
+    // resize(0) rather than clear(), which would throw the capacity away.
+    fText.resize(0);
+    fText.reserve(textSize);
+    fRuns.resize(0);
+    fRuns.reserve(runCount);
+    fParagraphs.resize(0);
+    fParagraphs.reserve(paragraphCount);
+
+    for (int c = 0; c < chunks.size(); ++c) {
+        const textChunk &chunk = chunks.at(c);
+        const quint32 textOffset = quint32(fText.size());
+        const quint32 runOffset = quint32(fRuns.size());
+
+        fText.append(chunk.text);
+
+        for (textRun run : chunk.runs) {
+            run.start += textOffset;
+            fRuns.append(run);
+        }
+
+        // Every chunk but the last ends with a zero byte, which leaves an
+        // empty paragraph on the end. The next chunk's first paragraph is
+        // really that one.
+        int paragraphs = chunk.paragraphs.size();
+        if (c < chunks.size() - 1) {
+            paragraphs--;
+        }
+
+        for (int p = 0; p < paragraphs; ++p) {
+            textParagraph paragraph = chunk.paragraphs.at(p);
+            paragraph.firstRun += runOffset;
+            fParagraphs.append(paragraph);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Split the text from 'from' to 'to' into chunks for decoding. Small documents
+// get a single chunk. Big ones get a chunk per thread, each chunk ending just
+// after a zero byte, so they all start with a fresh paragraph.
+//------------------------------------------------------------------------------
+QVector<textChunk> QuillDoc::splitText(const quint32 from, const quint32 to)
+{
+    QVector<textChunk> chunks;
+    const quint32 length = (to > from) ? to - from : 0;
+
+    int chunkCount = 1;
+    if (length >= PARALLEL_THRESHOLD) {
+        chunkCount = qMax(1, qMin(QThread::idealThreadCount(), int(length / PARALLEL_CHUNK_SIZE)));
+    }
+
+    quint32 start = from;
+    for (int c = 1; c < chunkCount && start < to; ++c) {
+        // Aim for equal chunks, then find the end of that paragraph.
+        quint32 target = qMax(start, from + quint32(quint64(length) * quint64(c) / quint64(chunkCount)));
+        const void *zero = memchr(fRawData + target, 0, to - target);
+        if (!zero) {
+            break;
+        }
+
+        quint32 end = quint32(static_cast<const uchar *>(zero) - fRawData) + 1;
+        if (end >= to) {
+            break;
+        }
+
+        textChunk chunk;
+        chunk.from = start;
+        chunk.to = end;
+        chunks.append(chunk);
+        start = end;
+    }
+
+    textChunk last;
+    last.from = start;
+    last.to = to;
+    chunks.append(last);
+
+    return chunks;
+}
+
+//------------------------------------------------------------------------------
+// Decode one chunk of the text area into runs and paragraphs. This only reads
+// the raw data and the translation table, so chunks can be decoded at the same
+// time, in different threads.
+//------------------------------------------------------------------------------
+template <typename Dialect>
+void QuillDoc::decodeText(textChunk &chunk) const
+{
+    QString &text = chunk.text;
+    text.resize(0);
+    chunk.runs.resize(0);
+    chunk.paragraphs.resize(0);
+    text.reserve(int(chunk.to - chunk.from));
+
+    // The current attributes, and where the current run started.
+    quint8 attributes = 0;
+    int runStart = 0;
+    textParagraph paragraph = {0, 0};
+
+    // Sub and superscript share the vertical alignment, so we need to know
+    // which of them has been toggled on, not just what's currently showing.
+    bool SuperOn = false;
+    bool SubOn = false;
+
+    quint32 pointer = chunk.from;
+
+    while (pointer < chunk.to) {
+       // Everything up to the next control code is plain text, and goes
+       // into the current run in one go.
+       quint32 plainEnd = findControlByte(fRawData, pointer, chunk.to);
+       if (plainEnd > pointer) {
+           int oldSize = text.size();
+           text.resize(oldSize + int(plainEnd - pointer));
+           transcodeAs<Dialect>(fRawData + pointer, plainEnd - pointer, reinterpret_cast<char16_t *>(text.data() + oldSize));
+           pointer = plainEnd;
+           continue;
+       }
+
+       quint8 Char = fRawData[pointer++];
+
+       // Process each control code.
+       switch (Char) {
+         case 0 : // Paragraph end & reset attributes.
+             closeRun(chunk, runStart, attributes, paragraph);
+             chunk.paragraphs.append(paragraph);
+             paragraph.firstRun = quint32(chunk.runs.size());
+             paragraph.runCount = 0;
+
+             // Quill doesn't need a toggle off for each toggle on, a new
+             // paragraph turns *everything* off. (Derek Stewart reported
+             // the rogue formatting this used to cause.)
+             attributes = 0;
+             SuperOn = SubOn = false;
+             break;
+
+         case 12: break;                                  // Form Feed - ignored.
+
+         case 15: closeRun(chunk, runStart, attributes, paragraph);
+                  attributes ^= ATTR_BOLD;
+                  break;
+
+         case 16: closeRun(chunk, runStart, attributes, paragraph);
+                  attributes ^= ATTR_UNDERLINE;
+                  break;
+
+         case 17: closeRun(chunk, runStart, attributes, paragraph);
+                  attributes &= ~(ATTR_SUBSCRIPT | ATTR_SUPERSCRIPT);
+                  if (!SubOn) {
+                      attributes |= ATTR_SUBSCRIPT;
+                  }
+                  SubOn = !SubOn;
+                  break;
+
+         case 18: closeRun(chunk, runStart, attributes, paragraph);
+                  attributes &= ~(ATTR_SUBSCRIPT | ATTR_SUPERSCRIPT);
+                  if (!SuperOn) {
+                      attributes |= ATTR_SUPERSCRIPT;
+                  }
+                  SuperOn = !SuperOn;
+                  break;
+
+         case 19: closeRun(chunk, runStart, attributes, paragraph);
+                  attributes ^= ATTR_ITALIC;
+                  break;
+
+         case 30: break;                        // Soft hyphen - ignored.
+       }
+    }
+
+    // Whatever is left is the final paragraph.
+    closeRun(chunk, runStart, attributes, paragraph);
+    chunk.paragraphs.append(paragraph);
+}
+
+//------------------------------------------------------------------------------
+// If any text has been added since the current run started, finish the run off
+// and add it to the paragraph. The next run starts at the end of the text.
+//
+// Toggling something on and straight back off again leaves two runs with the
+// same attributes next to each other. They get merged, just as QTextDocument
+// would merge the two fragments, so exporters see the same thing either way.
+//------------------------------------------------------------------------------
+void QuillDoc::closeRun(textChunk &chunk, int &runStart, const quint8 attributes, textParagraph &paragraph) const
+{
+    if (chunk.text.size() > runStart) {
+        if (paragraph.runCount && chunk.runs.last().attributes == attributes) {
+            chunk.runs.last().length += quint32(chunk.text.size() - runStart);
+            runStart = chunk.text.size();
+            return;
+        }
+
+        textRun run;
+        run.start = quint32(runStart);
+        run.length = quint32(chunk.text.size() - runStart);
+        run.attributes = attributes;
+        chunk.runs.append(run);
+        paragraph.runCount++;
+    }
+
+    runStart = chunk.text.size();
+}
 
+//------------------------------------------------------------------------------
+// Build the QTextDocument from the runs. Each run goes in with a single insert.
+//------------------------------------------------------------------------------
+void QuillDoc::buildDocument()
+{
     // We need a cursor to keep a handle on our insertion position.
     QTextCursor cursor(document);
 
@@ -212,99 +848,39 @@ void QuillDoc::parseText()
     // DOS files don't appear to have a text colour, so we use GREEN for those.
     defaultFormat.setForeground(Qt::black); // Because paper is pale yellow!
 
-    // The current *character* format in this paragraph...
-    QTextCharFormat charFormat;
-
-    // Flags that toggle formatting of characters.
-    bool SuperOn = false;
-    bool SubOn = false;
-    bool BoldOn = false;
-    bool UnderOn = false;
-    bool ItalicOn = false;
+    // One character format for every combination of attributes.
+    QTextCharFormat charFormats[ATTR_ALL + 1];
+    for (int x = 0; x <= ATTR_ALL; ++x) {
+        QTextCharFormat &charFormat = charFormats[x];
+        charFormat = defaultFormat;
+        charFormat.setFontWeight((x & ATTR_BOLD) ? QFont::Bold : QFont::Normal);
+        charFormat.setFontUnderline(x & ATTR_UNDERLINE);
+        charFormat.setFontItalic(x & ATTR_ITALIC);
+
+        if (x & ATTR_SUBSCRIPT) {
+            charFormat.setVerticalAlignment(QTextCharFormat::AlignSubScript);
+        } else if (x & ATTR_SUPERSCRIPT) {
+            charFormat.setVerticalAlignment(QTextCharFormat::AlignSuperScript);
+        }
+    }
 
     // Set the current formats, plural, for the first (system created) paragraph.
     cursor.setBlockFormat(defaultBlockFormat);
     cursor.setCharFormat(defaultFormat);
 
-    // And read the format for later too.
-    charFormat = cursor.charFormat();
-
-    // And now, process the text contents.
-    while (fRawPointer < fTextLength) {
-       Char = fRawFileContents[fRawPointer++];
-       qChar = translate(Char);
-
-       // Process each character to see if it is a control code or not.
-       switch (Char) {
-         case 0 : // Paragraph end & reset attributes.
-             BoldOn = UnderOn = SuperOn = SubOn = ItalicOn = false;
-             cursor.insertBlock(defaultBlockFormat, defaultFormat);
-
-             // Because we may still have bold etc in the charFormat we need
-             // to reinitialise it to the defaultFormat settings. We can do this
-             // by reading the current format from the cursor. This stops rogue
-             // formatting when the file doesn't *explicitly* turn off some
-             // formatting between paragraphs. (Derek Stewart reported this bug.)
-             charFormat = cursor.charFormat();
-             break;
-
-         case 12: break;                                  // Form Feed - ignored.
-
-         case 15: if (BoldOn) {
-                    charFormat.setFontWeight(QFont::Normal);
-                } else {
-                    charFormat.setFontWeight(QFont::Bold);
-                }
-
-                BoldOn = !BoldOn;
-                cursor.setCharFormat(charFormat);
-                continue;
-
-         case 16: if (UnderOn) {
-                    charFormat.setFontUnderline(false);
-                } else {
-                    charFormat.setFontUnderline(true);
-                }
-                UnderOn = !UnderOn;
-
-                cursor.setCharFormat(charFormat);
-                continue;
-
-         case 17: if (SubOn) {
-                    charFormat.setVerticalAlignment(QTextCharFormat::AlignNormal);
-                  } else {
-                    charFormat.setVerticalAlignment(QTextCharFormat::AlignSubScript);
-                  }
-                  SubOn = !SubOn;
-
-                cursor.setCharFormat(charFormat);
-                continue;
-
-         case 18: if (SuperOn) {
-                    charFormat.setVerticalAlignment(QTextCharFormat::AlignNormal);
-                  } else {
-                    charFormat.setVerticalAlignment(QTextCharFormat::AlignSuperScript);
-                  }
-                  SuperOn = !SuperOn;
-
-                cursor.setCharFormat(charFormat);
-                continue;
+    for (int p = 0; p < fParagraphs.size(); ++p) {
+        const textParagraph &paragraph = fParagraphs.at(p);
 
-         case 19: if (ItalicOn) {
-                    charFormat.setFontItalic(false);
-                  } else {
-                    charFormat.setFontItalic(true);
-                  }
-
-                  ItalicOn = !ItalicOn;
-                  cursor.setCharFormat(charFormat);
-                  continue;
-
-         case 30: continue;                     // Soft hyphen - ignored.
-
-         default: cursor.insertText(qChar);     // Everything else.
+        // The system created the first paragraph, we create the rest.
+        if (p > 0) {
+            cursor.insertBlock(defaultBlockFormat, defaultFormat);
+        }
 
-       }
+        for (quint32 r = paragraph.firstRun; r < paragraph.firstRun + paragraph.runCount; ++r) {
+            const textRun &run = fRuns.at(int(r));
+            cursor.insertText(QString::fromRawData(fText.constData() + run.start, int(run.length)),
+                              charFormats[run.attributes]);
+        }
     }
 
     // Position carat at the start. It will become visible if you use the arrow keys!
@@ -312,63 +888,105 @@ void QuillDoc::parseText()
 }
 
 //------------------------------------------------------------------------------
-// Extract the paragraph table.
+// Extract the paragraph table into fParagraphIndex. The table starts with the
+// standard Psion header: entry size, header size, entries used and entries
+// allocated, all 16 bits. Entry zero is never used, so paragraph 'n' is in
+// entry 'n + 1'. The first two paragraphs are the header and the footer.
+//
+// If the table doesn't make sense, the index is left empty. The text can still
+// be read without it.
 //------------------------------------------------------------------------------
+template <typename Dialect>
 void QuillDoc::parseParagraphTable()
 {
-    // Set internal pointer to the paragraph table.
-    if (fValid) {
-        fParagraphTable = (paraTable *)(fRawFileContents.constData() + fTextLength);
+    fParagraphIndex.clear();
+
+    if (!fValid) {
+        return;
+    }
 
-        // Convert the contents to Windows/Linux little endian format.
-        // Anything that's not 8 bit anyway!
-        fParagraphTable->textOffset = big2Little32(fParagraphTable->textOffset);
-        fParagraphTable->textLength = big2Little16(fParagraphTable->textLength);
+    fParaTableView = paraTableView(tableData(fTextLength, fParaTableLength),
+                                   fParaTableLength, Dialect::littleEndian);
+    if (fParaTableView.isNull() || !fParaTableView.isUsable()) {
+        return;
+    }
+
+    const int paragraphCount = fParaTableView.paragraphCount();
+    fParagraphIndex.reserve(paragraphCount);
+
+    for (int x = 0; x < paragraphCount; ++x) {
+        const quint32 textOffset = fParaTableView.textOffset(x);
+        const quint16 textLength = fParaTableView.textLength(x);
+
+        // Every paragraph must be inside the text area.
+        if (textOffset < 20 || quint64(textOffset) + textLength > fTextLength) {
+            fParagraphIndex.clear();
+            return;
+        }
+
+        fParagraphIndex.textOffset.append(textOffset);
+        fParagraphIndex.textLength.append(textLength);
+        fParagraphIndex.leftMargin.append(fParaTableView.leftMargin(x));
+        fParagraphIndex.indentMargin.append(fParaTableView.indentMargin(x));
+        fParagraphIndex.rightMargin.append(fParaTableView.rightMargin(x));
+        fParagraphIndex.justification.append(fParaTableView.justification(x));
+        fParagraphIndex.tabTableEntry.append(fParaTableView.tabTableEntry(x));
     }
 }
 
 //------------------------------------------------------------------------------
-// Extract the free space table - which is ignored.
+// Extract the free space table - which is otherwise ignored.
 //------------------------------------------------------------------------------
+template <typename Dialect>
 void QuillDoc::parseFreeSpaceTable()
 {
-    // Do nothing.
+    if (fValid) {
+        quint32 offset = fTextLength + fParaTableLength;
+        fFreeSpaceView = psionTableView(tableData(offset, fFreeSpaceLength),
+                                        fFreeSpaceLength, Dialect::littleEndian);
+    }
 }
 
 //------------------------------------------------------------------------------
 // Extract the layout table.
 //------------------------------------------------------------------------------
+template <typename Dialect>
 void QuillDoc::parseLayoutTable()
 {
+    // Don't bother with a layout table that's too short to be one.
+    if (fValid && fLayoutTableLength >= offsetof(typename Dialect::layoutTable, docTabs)) {
+        quint32 offset = fTextLength + fParaTableLength + fFreeSpaceLength;
+        setLayout(layoutView<typename Dialect::layoutTable>(tableData(offset, fLayoutTableLength),
+                                                            fLayoutTableLength, Dialect::littleEndian));
+    }
+}
 
-    // Set internal pointer to the layout table. Assume QL format.
-    if (fValid) {
-        if (!fPCFile) {
-            fLayoutTableQL = (layoutTableQL *)(fRawFileContents.constData() + fTextLength +
-                                               fParaTableLength +
-                                               fFreeSpaceLength);
-
-            // Convert the contents to Windows/Linux little endian format.
-            // Anything that's not 8 bit anyway!
-            fLayoutTableQL->wordCount = big2Little16(fLayoutTableQL->wordCount);
-            fLayoutTableQL->tabAreaSize = big2Little16(fLayoutTableQL->tabAreaSize);
-            fLayoutTableQL->tabAreaUsed = big2Little16(fLayoutTableQL->tabAreaUsed);
-        } else {
-            fLayoutTableDOS = (layoutTableDOS *)(fRawFileContents.constData() + fTextLength +
-                                                 fParaTableLength +
-                                                 fFreeSpaceLength);
-
-            // DOS format files are already in little Endian format!
-        }
-
+//------------------------------------------------------------------------------
+// Returns the address of a table in the raw data, or nullptr if it doesn't fit
+// entirely inside the raw data.
+//------------------------------------------------------------------------------
+const uchar *QuillDoc::tableData(const quint32 offset, const quint32 length)
+{
+    if (quint64(offset) + length > quint64(fRawSize)) {
+        return nullptr;
     }
+
+    return fRawData + offset;
 }
 
 //------------------------------------------------------------------------------
-// return a pointer to the text edit's document.
+// return a pointer to the text edit's document. It gets built from the runs the
+// first time it is asked for.
 //------------------------------------------------------------------------------
 QTextDocument *QuillDoc::getDocument()
 {
+    if (!document) {
+        document = new QTextDocument();     // We need to delete this!
+        if (fValid) {
+            buildDocument();
+        }
+    }
+
     return document;
 }
 
@@ -379,155 +997,111 @@ QTextDocument *QuillDoc::getDocument()
 //------------------------------------------------------------------------------
 QChar  QuillDoc::translate(const quint8 c)
 {
-    // Stolen from http://svn.openmoko.org/trunk/src/host/qemu-neo1973/phonesim/lib/serial/qatutils.cpp
+    return QChar(ushort(fPCFile ? DOSDialect::translation[c] : QLDialect::translation[c]));
+}
 
-    // The following table converts any DOS CP437 character into
-    // a suitable Unicode character. I'm not sure what the EURO will
-    // do as that was never part of CP437!
 
-    static ushort DOS2Unicode[256] = {
-         0x0000, 0x0001, 0x0002, 0x0003, 0x0004, 0x0005, 0x0006, 0x0007,
-         0x0008, 0x0009, 0x000a, 0x000b, 0x000c, 0x000d, 0x000e, 0x000f,
-         0x0010, 0x0011, 0x0012, 0x0013, 0x0014, 0x0015, 0x0016, 0x0017,
-         0x0018, 0x0019, 0x001c, 0x001b, 0x007f, 0x001d, 0x001e, 0x001f,
-         0x0020, 0x0021, 0x0022, 0x0023, 0x0024, 0x0025, 0x0026, 0x0027,
-         0x0028, 0x0029, 0x002a, 0x002b, 0x002c, 0x002d, 0x002e, 0x002f,
-         0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
-         0x0038, 0x0039, 0x003a, 0x003b, 0x003c, 0x003d, 0x003e, 0x003f,
-         0x0040, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047,
-         0x0048, 0x0049, 0x004a, 0x004b, 0x004c, 0x004d, 0x004e, 0x004f,
-         0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057,
-         0x0058, 0x0059, 0x005a, 0x005b, 0x005c, 0x005d, 0x005e, 0x005f,
-         0x0060, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
-         0x0068, 0x0069, 0x006a, 0x006b, 0x006c, 0x006d, 0x006e, 0x006f,
-         0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
-         0x0078, 0x0079, 0x007a, 0x007b, 0x007c, 0x007d, 0x007e, 0x001a,
-         0x00c7, 0x00fc, 0x00e9, 0x00e2, 0x00e4, 0x00e0, 0x00e5, 0x00e7,
-         0x00ea, 0x00eb, 0x00e8, 0x00ef, 0x00ee, 0x00ec, 0x00c4, 0x00c5,
-         0x00c9, 0x00e6, 0x00c6, 0x00f4, 0x00f6, 0x00f2, 0x00fb, 0x00f9,
-         0x00ff, 0x00d6, 0x00dc, 0x00a2, 0x00a3, 0x00a5, 0x20a7, 0x0192,
-         0x00e1, 0x00ed, 0x00f3, 0x00fa, 0x00f1, 0x00d1, 0x00aa, 0x00ba,
-         0x00bf, 0x2310, 0x00ac, 0x00bd, 0x00bc, 0x00a1, 0x00ab, 0x00bb,
-         0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
-         0x2555, 0x2563, 0x2551, 0x2557, 0x255d, 0x255c, 0x255b, 0x2510,
-         0x2514, 0x2534, 0x252c, 0x251c, 0x2500, 0x253c, 0x255e, 0x255f,
-         0x255a, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256c, 0x2567,
-         0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256b,
-         0x256a, 0x2518, 0x250c, 0x2588, 0x2584, 0x258c, 0x2590, 0x2580,
-         0x03b1, 0x00df, 0x0393, 0x03c0, 0x03a3, 0x03c3, 0x03bc, 0x03c4,
-         0x03a6, 0x0398, 0x03a9, 0x03b4, 0x221e, 0x03c6, 0x03b5, 0x2229,
-         0x2261, 0x00b1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00f7, 0x2248,
-         0x00b0, 0x2219, 0x00b7, 0x221a, 0x207f, 0x00b2, 0x25a0, 0x00a0
-    };
+//------------------------------------------------------------------------------
+// Translates a whole span of PC/QDOS characters into Unicode in one go.
+//------------------------------------------------------------------------------
+void QuillDoc::transcode(const quint8 *source, size_t length, char16_t *dest) const
+{
+    if (fPCFile) {
+        transcodeAs<DOSDialect>(source, length, dest);
+    } else {
+        transcodeAs<QLDialect>(source, length, dest);
+    }
+}
 
 
+//------------------------------------------------------------------------------
+// Returns a QString holding the body text from the original Quill document.
+//------------------------------------------------------------------------------
+QString QuillDoc::getText()
+{
+    // If the document has been built, it may have been edited too.
+    if (document) {
+        return document->toPlainText();
+    }
 
-    // MOST of the QL Character set is valid ASCII, so anything under 127 or over
-    // 188 should be returned as a QChar with the same ASCII code.
-    // Anything else needs converting to Unicode.
-
-    static ushort QL2Unicode[] = {  // QL char, Windows char
-         169, // Copyright (c)    (127)
-         228, // a umlaut (128)
-         227, // a tilde  (129)
-         229, // a circle (130)
-         233, // e acute  (131)
-         246, // o umlaut (132)
-         245, // o tilde  (133)
-         248, // o with / (134)
-         252, // u umlaut (135)
-         231, // c cedilla    (136)
-         241, // n tilde  (137)
-         230, // ae ligature  (138)
-         339, // oe Ligature (Deprecated in Unicode)  (139)
-         225, // a acute  (140)
-         224, // a grave  (141)
-         226, // a circumflex (a^)    (142)
-         235, // e umlaut (143)
-         232, // e grave  (144)
-         234, // e circumflex (145)
-         239, // i umlaut (146)
-         237, // i acute  (147)
-         236, // i grave  (148)
-         238, // i circumflex (149)
-         243, // o acute  (150)
-         242, // o grave  (151)
-         244, // o circumflex (152)
-         250, // u acute  (153)
-         249, // u grave  (154)
-         251, // u circumflex (155)
-         223, // sz ligature (German B?)  (156)
-         162, // cent (157)
-         165, // Yen  (158)
-         180, // acute    (159)
-         196, // A umlaut (160)
-         195, // A tilde  (161)
-         194, // A circumflex (162)
-         201, // E acute  (163)
-         214, // O umlaut (164)
-         213, // O tilde  (165)
-         216, // O with / (166)
-         220, // U umlaut (167)
-         199, // C cedilla    (168)
-         209, // N tilde  (169)
-         198, // AE ligature  (170)
-         338, // OE Ligature (Deprecated in Unicode)  (171)
-         0x03B1, // Lower case alpha. (172)
-         0x03B4, // Lower case delta  (173)
-         0x0398, // Upper case theta  (174)
-         0x03BB, // Lower case lambda (175)
-         0x03BC, // Lower case Mu (micro as in u) (176)
-         0x03C6, // Lower case phi (as in p)  (177)
-         0x03A6, // Upper case phi    (178)
-         161, // iexclamation (upside down !) (179)
-         191, // iquestion (upside down ?)    (180)
-         0x20AC, // Euro  (181)
-         167, // Section marker   (182)
-         0x2295, // Cross circle ???????????????????????????  (183)
-         171, // French Quote <<  (184)
-         187, // French Quote >>  (185)
-         176, // Degree   (186)
-         247  // Divide  (187)
-    };
+    return getRunText();
+}
 
 
-    // A DOS file is "supposed" to be in Code Page 437 encoding. If we have
-    // a DOS file, then the DOS2Unicode table above should (!) be correct.
+//------------------------------------------------------------------------------
+// Returns the body text as decoded, from the runs. This does what toPlainText()
+// would do, but never touches the QTextDocument, so exporters on other threads
+// can use it while the document is being built or printed.
+//------------------------------------------------------------------------------
+QString QuillDoc::getRunText() const
+{
+    QString text;
+    text.reserve(fText.size() + fParagraphs.size());
 
+    for (int p = 0; p < fParagraphs.size(); ++p) {
+        const textParagraph &paragraph = fParagraphs.at(p);
 
-    quint8 cc = c;
+        if (p > 0) {
+            text.append(QChar('\n'));
+        }
 
-    // Usually, I suspect, we have to convert a QL file, not PC:
-    if (!fPCFile) {
-        if (cc == 96) return QChar(163);                // Pound Sterling.
-        if (cc < 127 || cc > 187) return QChar(cc);     // Unchanged.
-        return QChar(QL2Unicode[(cc - 127)]);           // Translated.
-    } else {
-        // Must be a PC file.
-        return QChar(DOS2Unicode[cc]);
+        if (paragraph.runCount) {
+            // The runs in a paragraph are contiguous in fText.
+            const textRun &first = fRuns.at(int(paragraph.firstRun));
+            const textRun &last = fRuns.at(int(paragraph.firstRun + paragraph.runCount - 1));
+            text.append(QString::fromRawData(fText.constData() + first.start,
+                                             int(last.start + last.length - first.start)));
+        }
     }
+
+    text.replace(QChar::Nbsp, QChar(' '));
+    return text;
 }
 
 
 //------------------------------------------------------------------------------
-// Returns a QString holding the body text from the original Quill document.
+// Returns the entire contents of the Quill document as a QByteArray. One that
+// won't fit, 2GB or more, comes back empty, with the reason in getError().
 //------------------------------------------------------------------------------
-QString QuillDoc::getText()
+QByteArray QuillDoc::getRawText()
+{
+    if (fRawSize > INT_MAX) {
+        fErrorMessage = QString("File is too big to copy, %1 bytes").arg(fRawSize);
+        return QByteArray();
+    }
+
+    return QByteArray(reinterpret_cast<const char *>(fRawData), int(fRawSize));
+}
+
+//------------------------------------------------------------------------------
+// Returns the translated body text. The runs index into this.
+//------------------------------------------------------------------------------
+const QString &QuillDoc::getTextBuffer()
 {
-    return document->toPlainText();
+    return fText;
 }
 
 
 //------------------------------------------------------------------------------
-// Returns the entire contents of the Quill document as a QByteArray.
+// Returns the runs of text, in document order.
 //------------------------------------------------------------------------------
-QByteArray QuillDoc::getRawText()
+const QVector<textRun> &QuillDoc::getRuns()
 {
-    return fRawFileContents;
+    return fRuns;
 }
 
+
 //------------------------------------------------------------------------------
-// Returns a QString holding the body text from the original Quill document.
+// Returns the paragraphs, each one being a range of runs.
+//------------------------------------------------------------------------------
+const QVector<textParagraph> &QuillDoc::getParagraphs()
+{
+    return fParagraphs;
+}
+
+
+//------------------------------------------------------------------------------
+// Returns the size of the text area in the original Quill document.
 //------------------------------------------------------------------------------
 quint32 QuillDoc::getTextLength()
 {
@@ -561,6 +1135,14 @@ bool QuillDoc::isValid()
   return fValid;
 }
 
+//------------------------------------------------------------------------------
+// Is it a PC (DOS) Quill document, rather than a QL one?
+//------------------------------------------------------------------------------
+bool QuillDoc::isPCFile()
+{
+  return fPCFile;
+}
+
 
 //------------------------------------------------------------------------------
 // What was the last error that occurred ?
@@ -572,29 +1154,50 @@ QString QuillDoc::getError()
 
 
 //------------------------------------------------------------------------------
-// Big Endian to Little Endian 16 bit word conversion.
+// Returns the index built from the paragraph table. Empty if there wasn't a
+// usable paragraph table in the document.
 //------------------------------------------------------------------------------
-quint16 QuillDoc::big2Little16(quint16 big)
+const paraIndex &QuillDoc::getParagraphIndex()
 {
-    ushort le;
+    return fParagraphIndex;
+}
+
 
-    le =  ((0x00ff & big) << 8);
-    le |= ((0xff00 & big) >> 8);
+//------------------------------------------------------------------------------
+// Returns a view of the layout table. It will be null if the document doesn't
+// have one, or is the other dialect, so check isNull() and isUsable() first.
+//------------------------------------------------------------------------------
+const layoutViewQL &QuillDoc::getLayoutQL()
+{
+    return fLayoutQL;
+}
 
-    return le;
+const layoutViewDOS &QuillDoc::getLayoutDOS()
+{
+    return fLayoutDOS;
 }
 
+
 //------------------------------------------------------------------------------
-// Big Endian to Little Endian 32 bit long word conversion.
+// Returns the plain text of paragraph 'n', straight from the raw data, using the
+// paragraph index. Control codes are dropped. Paragraphs 0 and 1 are the header
+// and footer. Returns an empty string if there's no such paragraph.
 //------------------------------------------------------------------------------
-quint32 QuillDoc::big2Little32(quint32 big)
+QString QuillDoc::getParagraphText(const int n)
 {
-    unsigned le;
+    if (n < 0 || n >= fParagraphIndex.count()) {
+        return QString();
+    }
 
-    le =  ((0x000000ff & big) << 24);
-    le |= ((0x0000ff00 & big) << 8);
-    le |= ((0x00ff0000 & big) >> 8);
-    le |= ((0xff000000 & big) >> 24);
+    QString text;
+    const quint32 start = fParagraphIndex.textOffset.at(n);
+    const quint32 end = start + fParagraphIndex.textLength.at(n);
+
+    for (quint32 x = start; x < end; ++x) {
+        if (!isControlByte(fRawData[x])) {
+            text.append(translate(fRawData[x]));
+        }
+    }
 
-    return le;
+    return text;
 }
@@ -26,6 +26,7 @@ class QTextDocument;
 
 #include <QtGui>
 #include <QObject>
+#include <cstddef>
 
 // Some stuff for the paragraph table.
 
@@ -39,6 +40,10 @@ const quint8    JUSTIFY_CENTRE_DOS = 5;
 const quint8    JUSTIFY_RIGHT_DOS = 6;
 
 
+// The layout of one paragraph table entry, as it is in the file. The struct
+// gets padded, so use PARA_ENTRY_SIZE for the real size.
+const quint16   PARA_ENTRY_SIZE = 14;
+
 typedef struct paraTable {
     quint32 textOffset;
     quint16 textLength;
@@ -51,7 +56,81 @@ typedef struct paraTable {
     quint16 unused_2;
 } paraTable;
 
-
+// Every paragraph table entry, decoded. One array per field, all the same
+// size, so paragraph 'n' is element 'n' of each of them.
+typedef struct paraIndex {
+    QVector<quint32> textOffset;    // Offset of the paragraph in the file.
+    QVector<quint16> textLength;    // Length, including the terminating zero.
+    QVector<quint8>  leftMargin;
+    QVector<quint8>  indentMargin;
+    QVector<quint8>  rightMargin;
+    QVector<quint8>  justification; // JUSTIFY_xxx_QL or JUSTIFY_xxx_DOS.
+    QVector<quint8>  tabTableEntry;
+
+    int  count() const { return textOffset.size(); }
+
+    void clear() {
+        textOffset.clear(); textLength.clear();
+        leftMargin.clear(); indentMargin.clear(); rightMargin.clear();
+        justification.clear(); tabTableEntry.clear();
+    }
+
+    void reserve(int size) {
+        textOffset.reserve(size); textLength.reserve(size);
+        leftMargin.reserve(size); indentMargin.reserve(size); rightMargin.reserve(size);
+        justification.reserve(size); tabTableEntry.reserve(size);
+    }
+} paraIndex;
+
+
+
+
+// Text attributes for a run of text. Sub and superscript share the vertical
+// alignment, so a run never has both of them set.
+const quint8    ATTR_BOLD = 0x01;
+const quint8    ATTR_UNDERLINE = 0x02;
+const quint8    ATTR_SUBSCRIPT = 0x04;
+const quint8    ATTR_SUPERSCRIPT = 0x08;
+const quint8    ATTR_ITALIC = 0x10;
+const quint8    ATTR_ALL = 0x1f;
+
+// A run of text, in the translated text buffer, where every character has the
+// same attributes.
+typedef struct textRun {
+    quint32 start;                  // Offset into the text buffer.
+    quint32 length;                 // Number of characters.
+    quint8  attributes;             // ATTR_xxx flags.
+} textRun;
+
+// A paragraph is a range of runs. Empty paragraphs have no runs.
+typedef struct textParagraph {
+    quint32 firstRun;               // Index of the first run.
+    quint32 runCount;               // Number of runs.
+} textParagraph;
+
+// Part of the text area, decoded on its own. Chunks always start at the start
+// of a paragraph. Runs and paragraphs are relative to the chunk.
+typedef struct textChunk {
+    quint32 from;                   // Raw data offset of the first byte.
+    quint32 to;                     // And just past the last.
+    QString text;
+    QVector<textRun> runs;
+    QVector<textParagraph> paragraphs;
+} textChunk;
+
+// The decoded text, runs and paragraphs of a document, kept for the next one.
+// A batch worker lends these to each QuillDoc it parses, and gets them back,
+// with whatever capacity they grew to, when the QuillDoc is destroyed.
+typedef struct quillBuffers {
+    QString text;
+    QVector<textRun> runs;
+    QVector<textParagraph> paragraphs;
+} quillBuffers;
+
+// Text areas at least this big are decoded in parallel, in chunks of at least
+// this size.
+const quint32   PARALLEL_THRESHOLD = 512 * 1024;
+const quint32   PARALLEL_CHUNK_SIZE = 128 * 1024;
 
 
 // A couple of structs for the layout table.
@@ -136,6 +215,157 @@ typedef struct layoutTableDOS {
 } layoutTableDOS;
 
 
+// Read only views of the raw data. Nothing in the raw data is ever changed, or
+// read through a struct pointer, so it can be mapped, shared between threads
+// and doesn't need to be aligned. Values are read where they are used, in QL
+// (big endian) or DOS (little endian) order. The owner of the view makes sure
+// it fits inside the raw data.
+
+class rawView {
+
+public:
+    rawView() : fData(nullptr), fSize(0), fLittleEndian(false) {}
+    rawView(const uchar *data, const quint32 size, const bool littleEndian)
+        : fData(data), fSize(data ? size : 0), fLittleEndian(littleEndian) {}
+
+    bool    isNull() const { return fData == nullptr; }
+    quint32 size() const { return fSize; }
+    const uchar *data() const { return fData; }
+
+    quint8  byte(const quint32 offset) const {
+        return fData[offset];
+    }
+
+    quint16 word(const quint32 offset) const {
+        return fLittleEndian ? qFromLittleEndian<quint16>(fData + offset)
+                             : qFromBigEndian<quint16>(fData + offset);
+    }
+
+    quint32 longWord(const quint32 offset) const {
+        return fLittleEndian ? qFromLittleEndian<quint32>(fData + offset)
+                             : qFromBigEndian<quint32>(fData + offset);
+    }
+
+protected:
+    const uchar *fData;
+    quint32 fSize;
+    bool    fLittleEndian;
+};
+
+
+// The 20 byte file header.
+class headerView : public rawView {
+
+public:
+    headerView() {}
+    headerView(const uchar *data, const bool littleEndian) : rawView(data, 20, littleEndian) {}
+
+    quint16 headerLength() const { return word(0); }
+    QByteArray magic() const { return QByteArray(reinterpret_cast<const char *>(fData + 2), 8); }
+    quint32 textLength() const { return longWord(10); }
+    quint16 paraTableLength() const { return word(14); }
+    quint16 freeSpaceLength() const { return word(16); }
+    quint16 layoutTableLength() const { return word(18); }
+};
+
+
+// The paragraph and free space tables both start with the standard Psion
+// table header: entry size, header size, entries used and entries allocated.
+class psionTableView : public rawView {
+
+public:
+    psionTableView() {}
+    psionTableView(const uchar *data, const quint32 size, const bool littleEndian)
+        : rawView(data, size, littleEndian) {}
+
+    // Is there room for the table header?
+    bool    hasHeader() const { return fSize >= 8; }
+
+    quint16 entrySize() const { return word(0); }
+    quint16 headerSize() const { return word(2); }
+    quint16 entriesUsed() const { return word(4); }
+    quint16 entriesAllocated() const { return word(6); }
+
+    // Offset of entry 'n' from the start of the table.
+    quint32 entry(const quint32 n) const { return headerSize() + n * entrySize(); }
+};
+
+
+// The paragraph table. Entry zero is never used, so paragraph 'n' is entry 'n + 1'.
+class paraTableView : public psionTableView {
+
+public:
+    paraTableView() {}
+    paraTableView(const uchar *data, const quint32 size, const bool littleEndian)
+        : psionTableView(data, size, littleEndian) {}
+
+    // Do all the used entries fit in the table?
+    bool    isUsable() const {
+        return hasHeader() && entrySize() == PARA_ENTRY_SIZE && headerSize() == 8 &&
+               quint64(headerSize()) + quint64(entriesUsed() + 1) * PARA_ENTRY_SIZE <= fSize;
+    }
+
+    quint16 paragraphCount() const { return entriesUsed(); }
+
+    quint32 textOffset(const int n) const { return longWord(paragraph(n) + offsetof(paraTable, textOffset)); }
+    quint16 textLength(const int n) const { return word(paragraph(n) + offsetof(paraTable, textLength)); }
+    quint8  leftMargin(const int n) const { return byte(paragraph(n) + offsetof(paraTable, leftMargin)); }
+    quint8  indentMargin(const int n) const { return byte(paragraph(n) + offsetof(paraTable, indentMargin)); }
+    quint8  rightMargin(const int n) const { return byte(paragraph(n) + offsetof(paraTable, rightMargin)); }
+    quint8  justification(const int n) const { return byte(paragraph(n) + offsetof(paraTable, justification)); }
+    quint8  tabTableEntry(const int n) const { return byte(paragraph(n) + offsetof(paraTable, tabTableEntry)); }
+
+private:
+    quint32 paragraph(const int n) const { return entry(quint32(n) + 1); }
+};
+
+
+// The layout table, over layoutTableQL or layoutTableDOS. The offsets are
+// all fixed at compile time, so nothing here has to check which it is.
+template <typename Table>
+class layoutView : public rawView {
+
+public:
+    layoutView() {}
+    layoutView(const uchar *data, const quint32 size, const bool littleEndian)
+        : rawView(data, size, littleEndian) {}
+
+    // Is there room for everything up to the tabs?
+    bool    isUsable() const { return fSize >= offsetof(Table, docTabs); }
+
+    quint8  bottomMargin() const { return byte(offsetof(Table, bottomMargin)); }
+    quint8  lineGap() const { return byte(offsetof(Table, lineGap)); }
+    quint8  pageLength() const { return byte(offsetof(Table, pageLength)); }
+    quint8  firstPage() const { return byte(offsetof(Table, firstPage)); }
+    quint8  topMargin() const { return byte(offsetof(Table, topMargin)); }
+    quint16 wordCount() const { return word(offsetof(Table, wordCount)); }
+    quint16 tabAreaSize() const { return word(offsetof(Table, tabAreaSize)); }
+    quint16 tabAreaUsed() const { return word(offsetof(Table, tabAreaUsed)); }
+    quint8  headerJustification() const { return byte(offsetof(Table, headerJustification)); }
+    quint8  footerJustification() const { return byte(offsetof(Table, footerJustification)); }
+    quint8  headerMargin() const { return byte(offsetof(Table, headerMargin)); }
+    quint8  footerMargin() const { return byte(offsetof(Table, footerMargin)); }
+    quint8  headerBold() const { return byte(offsetof(Table, headerBold)); }
+    quint8  footerBold() const { return byte(offsetof(Table, footerBold)); }
+
+    // QL files only, see below. DOS files are always 80 columns and GREEN.
+    quint8  displayMode() const;
+    quint8  textColour() const;
+};
+
+template <>
+inline quint8 layoutView<layoutTableQL>::displayMode() const { return byte(offsetof(layoutTableQL, displayMode)); }
+template <>
+inline quint8 layoutView<layoutTableQL>::textColour() const { return byte(offsetof(layoutTableQL, textColour)); }
+template <>
+inline quint8 layoutView<layoutTableDOS>::displayMode() const { return LAYOUT_80; }
+template <>
+inline quint8 layoutView<layoutTableDOS>::textColour() const { return LAYOUT_TEXT_GREEN; }
+
+typedef layoutView<layoutTableQL> layoutViewQL;
+typedef layoutView<layoutTableDOS> layoutViewDOS;
+
+
 
 class QuillDoc {
 
@@ -144,9 +374,16 @@ private:
     QString fQuillMagic;                    // Quill 'magic' flag = 'vrm1qdf0'.
     QString fHeader;                        // Document header text.
     QString fFooter;                        // Document footer text.
-    QByteArray fRawFileContents;            // Bytes of the document, as read.
+    QFile   fFile;                          // Stays open while mapped.
+    QByteArray fRawFileContents;            // Bytes of the document, if not mapped.
+    const uchar *fRawData;                  // Raw bytes, mapped or read.
+    qint64  fRawSize;                       // Size of the above.
     quint32 fRawPointer;                    // Used when scanning the raw document.
     QTextDocument *document;                // The raw text reformatted as "RTF"
+    QString fText;                          // The body text, translated.
+    QVector<textRun> fRuns;                 // Runs of text in fText.
+    QVector<textParagraph> fParagraphs;     // Paragraphs of runs.
+    quillBuffers *fBuffers;                 // Recycled buffers, if any.
     quint32 fTextLength;                    // Size of the above.
     quint16 fParaTableLength;               // Size of Paragraph table.
     quint16 fFreeSpaceLength;               // Size of free space table.
@@ -154,36 +391,69 @@ private:
     bool    fValid;                         // Is this a valid Quill document?
     QString fErrorMessage;                  // What went wrong ?
     bool    fPCFile;                        // This is a PC Quill file, or not.
-    layoutTableQL *fLayoutTableQL;          // QL layout table address.  }
-    layoutTableDOS *fLayoutTableDOS;        // DOS layout table address. } One or other, not both!
-    paraTable *fParagraphTable;             // Address of paragraph table.
+    headerView fHeaderView;                 // The file header.
+    paraTableView fParaTableView;           // The paragraph table.
+    psionTableView fFreeSpaceView;          // The free space table.
+    layoutViewQL fLayoutQL;                 // The layout table, if a QL file.
+    layoutViewDOS fLayoutDOS;               // Or if a DOS file.
+    paraIndex fParagraphIndex;              // The decoded paragraph table.
     tabTable *fTabTable;                    // Tab table for the document.
 
+    QuillDoc();                             // For fromBytes().
+    void    initialise();                   // Set everything to empty.
     void    loadFile(const QString FileName); // Load a valid Quill file?
+    void    checkHeader();                  // Is the raw data a valid Quill file?
+    bool    mapFile();                      // Map it, or read it if we can't.
     void    parseFile();                    // Parse it into a document.
-    void    parseText();                    // The next 4 do as they say!
-    void    parseParagraphTable();          // Parse the paragraph table.
-    void    parseFreeSpaceTable();          // Ignore the free space table.
-    void    parseLayoutTable();             // Parse the layout table.
 
-    QChar  translate(const quint8 c);      // Convert from QDOS to Win/Lin chars.
+    // These are all templates over QLDialect or DOSDialect, see quill.cpp.
+    template <typename Dialect> void parseFileAs();
+    template <typename Dialect> void parseText();           // The next 4 do as they say!
+    template <typename Dialect> void parseParagraphTable(); // Parse the paragraph table.
+    template <typename Dialect> void parseFreeSpaceTable(); // View the free space table.
+    template <typename Dialect> void parseLayoutTable();    // View the layout table.
+    template <typename Dialect> void decodeText(textChunk &chunk) const;
+    const uchar *tableData(const quint32 offset, const quint32 length);
+    void    setLayout(const layoutViewQL &view) { fLayoutQL = view; }
+    void    setLayout(const layoutViewDOS &view) { fLayoutDOS = view; }
+    QVector<textChunk> splitText(const quint32 from, const quint32 to);
+    void    closeRun(textChunk &chunk, int &runStart, const quint8 attributes, textParagraph &paragraph) const;
+    void    buildDocument();                // Runs to QTextDocument.
+
+    QChar  translate(const quint8 c);      // Convert from QDOS to Win/Lin chars, for outside callers.
+    void   transcode(const quint8 *source, size_t length, char16_t *dest) const;
 
-    // Convert from QL big end to PC/Linux Little end.
-    quint16 big2Little16(quint16 big);
-    quint32 big2Little32(quint32 big);
 
 public :
-    QuillDoc(const QString FileName);
+    QuillDoc(const QString FileName, const bool Headless = false, quillBuffers *Buffers = nullptr);
+    static QuillDoc *fromBytes(const QByteArray &Contents, const bool Headless = false,
+                               quillBuffers *Buffers = nullptr);
+
+    // Quick checks, on the 20 byte header only, for scanning directories.
+    static bool looksLikeQuill(const uchar *Header, const qint64 Size);
+    static bool looksLikeQuill(const QString &FileName);
+
+    // Hash of the header, text and tables, but not the padding after them.
+    static QByteArray contentHash(const QString &FileName);
     ~QuillDoc();
 
     QString getText();
+    QString getRunText() const;
+    const QString &getTextBuffer();
+    const QVector<textRun> &getRuns();
+    const QVector<textParagraph> &getParagraphs();
     QByteArray getRawText();
     quint32 getTextLength();
     QString getHeader();
     QString getFooter();
     bool    isValid();
+    bool    isPCFile();
     QString getError();
     QTextDocument *getDocument();
+    const paraIndex &getParagraphIndex();
+    const layoutViewQL &getLayoutQL();      // Only the one for isPCFile()
+    const layoutViewDOS &getLayoutDOS();    // is ever filled in.
+    QString getParagraphText(const int n);
 };
 
 #endif
@@ -0,0 +1,638 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#include <QtGui>
+
+#include "quillexport.h"
+#include "quill.h"
+
+//------------------------------------------------------------------------------
+// Export from a Quill document. Text formats come from the runs.
+//------------------------------------------------------------------------------
+QuillExporter::QuillExporter(QuillDoc *Doc)
+{
+    fQuill = Doc;
+    fDocument = nullptr;
+}
+
+//------------------------------------------------------------------------------
+// Export from a QTextDocument, which may have been edited.
+//------------------------------------------------------------------------------
+QuillExporter::QuillExporter(QTextDocument *Document)
+{
+    fQuill = nullptr;
+    fDocument = Document;
+}
+
+void QuillExporter::setTitle(const QString &Title)
+{
+    fTitle = Title;
+}
+
+//------------------------------------------------------------------------------
+// Write the document, in the requested format, to an already open device.
+//------------------------------------------------------------------------------
+bool QuillExporter::write(const Format format, QIODevice *device)
+{
+    fErrorString.clear();
+
+    switch (format) {
+        case Text: return writeText(device);
+        case HTML: return writeWithWriter("HTML", device);
+        case ODF: return writeWithWriter("odf", device);
+        case PDF: return writePDF(device);
+        case Docbook: return writeDocbook(device);
+        case RST: return writeRST(device);
+        case ASC: return writeASC(device);
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// Write the document, in the requested format, to a file.
+//------------------------------------------------------------------------------
+bool QuillExporter::writeFile(const Format format, const QString &fileName)
+{
+    fErrorString.clear();
+
+#if QT_VERSION < 0x050000
+    // QPrinter can only write PDFs to a file, so let it.
+    if (format == PDF) {
+        QPrinter Pdf(QPrinter::HighResolution);
+        Pdf.setOutputFormat(QPrinter::PdfFormat);
+        Pdf.setOutputFileName(fileName);
+        document()->print(&Pdf);
+        return true;
+    }
+#endif
+
+    // The formats we stream ourselves get line end translation, as always.
+    QIODevice::OpenMode mode = QFile::WriteOnly;
+    if (format == Docbook || format == RST || format == ASC) {
+        mode |= QFile::Text;
+    }
+
+    QFile file(fileName);
+    if (!file.open(mode)) {
+        fErrorString = QString("Cannot write %1 file %2:\n%3.")
+                       .arg(description(format))
+                       .arg(fileName)
+                       .arg(file.errorString());
+        return false;
+    }
+
+    if (!write(format, &file)) {
+        return false;
+    }
+
+    file.close();
+    if (file.error() != QFile::NoError) {
+        fErrorString = QString("Cannot write %1 file %2:\n%3.")
+                       .arg(description(format))
+                       .arg(fileName)
+                       .arg(file.errorString());
+        return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Plain text, in UTF-8 as we need this for accented European characters.
+//------------------------------------------------------------------------------
+bool QuillExporter::writeText(QIODevice *device)
+{
+    if (fDocument) {
+        if (device->write(fDocument->toPlainText().toUtf8()) < 0) {
+            fErrorString = device->errorString();
+            return false;
+        }
+
+        return true;
+    }
+
+    // From the runs, a paragraph at a time, so a pipe never has to hold more
+    // than one paragraph of output. Same text as toPlainText() would give.
+    const int count = paragraphCount();
+    for (int p = 0; p < count; ++p) {
+        QVector<textFragment> Fragments = paragraph(p);
+
+        QString line;
+        if (p > 0) {
+            line = "\n";
+        }
+
+        for (int f = 0; f < Fragments.size(); ++f) {
+            line += Fragments.at(f).text;
+        }
+
+        line.replace(QChar::Nbsp, QChar(' '));
+        if (device->write(line.toUtf8()) < 0) {
+            fErrorString = device->errorString();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// HTML and ODF are done by Qt.
+//------------------------------------------------------------------------------
+bool QuillExporter::writeWithWriter(const QByteArray &writerFormat, QIODevice *device)
+{
+    QTextDocumentWriter writer(device, writerFormat);
+    if (writerFormat == "HTML") {
+        writer.setCodec(QTextCodec::codecForName("UTF-8"));
+    }
+
+    if (!writer.write(document())) {
+        fErrorString = device->errorString();
+        return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// PDF, via the document's own print() function.
+//------------------------------------------------------------------------------
+bool QuillExporter::writePDF(QIODevice *device)
+{
+#if QT_VERSION >= 0x050000
+    // Set up like the QPrinter(QPrinter::HighResolution) the GUI always used,
+    // so the PDFs come out the same: the locale's paper, at 1200 dpi, with
+    // the PDF engine's 10 point margins.
+    QPdfWriter Pdf(device);
+    Pdf.setResolution(1200);
+    Pdf.setPageSize(QPageSize(QLocale::system().measurementSystem() == QLocale::ImperialUSSystem
+                              ? QPageSize::Letter : QPageSize::A4));
+    Pdf.setPageMargins(QMarginsF(10, 10, 10, 10), QPageLayout::Point);
+    document()->print(&Pdf);
+    return true;
+#else
+    // QPrinter needs a file, so print to a temporary one and copy it.
+    QTemporaryFile temp;
+    if (!temp.open()) {
+        fErrorString = temp.errorString();
+        return false;
+    }
+
+    QPrinter Pdf(QPrinter::HighResolution);
+    Pdf.setOutputFormat(QPrinter::PdfFormat);
+    Pdf.setOutputFileName(temp.fileName());
+    document()->print(&Pdf);
+
+    temp.seek(0);
+    if (device->write(temp.readAll()) < 0) {
+        fErrorString = device->errorString();
+        return false;
+    }
+
+    return true;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// DocBook XML, in ISO 8859-15.
+//------------------------------------------------------------------------------
+bool QuillExporter::writeDocbook(QIODevice *device)
+{
+    QString ArticleTitle = fTitle;
+    if (ArticleTitle.isEmpty()) {
+       ArticleTitle = "**** PUT YOUR TITLE HERE PLEASE ****";
+    }
+
+    QTextStream out(device);
+    out.setCodec(QTextCodec::codecForName("ISO 8859-15"));
+
+    // XML header first.
+    out << "<?xml version=\"1.0\" encoding=\"iso-8859-15\"?>\n";
+    out << "<!DOCTYPE article PUBLIC \"-//OASIS//DTD DocBook XML V4.2//EN\"\n";
+    out << "\"http://www.oasis-open.org/docbook/xml/4.2/docbookx.dtd\">\n";
+
+    // Make this an article, with the title.
+    out << "<article>\n";
+    out << "<title>" << ArticleTitle << "</title>\n";
+
+    // Iterate over all paragraphs in the document and process each one.
+    // Empty paragraphs are ignored.
+    const int count = paragraphCount();
+    for (int p = 0; p < count; ++p) {
+        QString Paragraph = DocBookParagraph(paragraph(p));
+        if (!Paragraph.isEmpty()) {
+            out << "<para>" << Paragraph << "</para>\n";
+        }
+    }
+
+    // Finish off the article.
+    out << "</article>\n";
+    out.flush();
+
+    if (out.status() != QTextStream::Ok) {
+        fErrorString = device->errorString();
+        return false;
+    }
+
+    return true;
+}
+
+
+// For each and every paragraph, iterate over each fragment of text,
+// where we build up an XML 'statement'.
+QString QuillExporter::DocBookParagraph(const QVector<textFragment> &Fragments)
+{
+    QString Paragraph;
+    for (int f = 0; f < Fragments.size(); ++f) {
+      Paragraph += DocBookFragment(Fragments.at(f));
+    }
+
+    return Paragraph;
+}
+
+// This is where we process each paragraph's text fragments and remove
+// invalid XML characters.
+//
+// TODO : Foreign character translation isn't working yet and can cause
+//        illegal characters in the XML file.
+QString QuillExporter::DocBookFragment(const textFragment &Fragment)
+{
+    QString ThisText = Fragment.text;
+
+    // We've got hard spaces, +/- etc in the text to translate.
+    unsigned char Nbsp = 0xA0;
+    unsigned char PlusMinus = 0xB1;
+
+    if (!ThisText.isEmpty()) {
+         // Do '&' first - so we don't change '&lt;' to '&amp;lt;' !
+         ThisText.replace(QString("&"), QString("&amp;"));
+         ThisText.replace(QString("<"), QString("&lt;"));
+         ThisText.replace(QString(">"), QString("&gt;"));
+         ThisText.replace(QString("\t"), QString("    "));
+         ThisText.replace(QString(PlusMinus), QString("&plusmn;"));
+         ThisText.replace(QString(Nbsp), QString(" "));
+    }
+
+    // Here we try to decode what text attributes have been applied
+    // and return a suitable XML 'statment' to accomodate them.
+    if (Fragment.attributes & ATTR_ITALIC)
+       return "<emphasis>" + ThisText + "</emphasis>";
+
+    if (Fragment.attributes & ATTR_UNDERLINE)
+       return "<emphasis role=\"underline\">" + ThisText + "</emphasis>";
+
+    if (Fragment.attributes & ATTR_BOLD)
+       return "<emphasis role=\"bold\">" + ThisText + "</emphasis>";
+
+    if (Fragment.attributes & ATTR_SUPERSCRIPT)
+       return "<superscript>" + ThisText + "</superscript>";
+
+    if (Fragment.attributes & ATTR_SUBSCRIPT)
+       return "<subscript>" + ThisText + "</supbscript>";
+
+    return ThisText;
+}
+
+
+//------------------------------------------------------------------------------
+// ReStructuredText, in UTF8 encoding.
+//------------------------------------------------------------------------------
+bool QuillExporter::writeRST(QIODevice *device)
+{
+    QString ArticleTitle = fTitle;
+    if (ArticleTitle.isEmpty()) {
+       ArticleTitle = "==========\n"
+                      "YOUR TITLE\n"
+                      "==========\n\n";
+    } else {
+        // Work out under and overlines for the title.
+        int titleSize = ArticleTitle.size();
+        QString overUnderLine = QString().fill('=', titleSize) + "\n";
+        ArticleTitle = overUnderLine + ArticleTitle + "\n" + overUnderLine;
+    }
+
+    QTextStream out(device);
+
+    // Pandoc and other converters require UTF8.
+    out.setCodec(QTextCodec::codecForName("UTF-8"));
+
+    // Make this an article, with the title.
+    out << ArticleTitle;
+
+    // Iterate over all paragraphs in the document and process each one.
+    // Empty paragraphs are ignored.
+    const int count = paragraphCount();
+    for (int p = 0; p < count; ++p) {
+        QString Paragraph = RSTParagraph(paragraph(p));
+        if (!Paragraph.isEmpty())
+            out << "\n" << Paragraph << "\n";
+    }
+
+    // Finish off the article.
+    out << "\n";
+    out.flush();
+
+    if (out.status() != QTextStream::Ok) {
+        fErrorString = device->errorString();
+        return false;
+    }
+
+    return true;
+}
+
+
+// For each and every paragraph, iterate over each fragment of text.
+QString QuillExporter::RSTParagraph(const QVector<textFragment> &Fragments)
+{
+    QString Paragraph;
+    for (int f = 0; f < Fragments.size(); ++f) {
+      Paragraph += RSTFragment(Fragments.at(f));
+    }
+
+    return Paragraph;
+}
+
+// This is where we process each paragraph's text fragments and remove
+// invalid RST characters.
+QString QuillExporter::RSTFragment(const textFragment &Fragment)
+{
+    QString ThisText = Fragment.text;
+
+    if (!ThisText.isEmpty()) {
+         // Do '\' first or else you get all sorts of stuff going wrong!
+         // And '\' needs to be escaped, so becomes '\\' - don't forget!
+         ThisText.replace(QString("\\"), QString("\\\\"));
+         ThisText.replace(QString("_"), QString("\\_"));
+         ThisText.replace(QString("*"), QString("\\*"));
+         ThisText.replace(QString("$"), QString("\\$"));
+         ThisText.replace(QString("`"), QString("\\`"));
+    }
+
+    // Here we try to decode what text attributes have been applied
+    // and return a suitable RST 'statment' to accomodate them.
+    // BEWARE: if an italic fragment has leading whitspace, the
+    //         italics wont work in RST as no whitespace is permitted.
+    if (Fragment.attributes & ATTR_ITALIC)
+       ThisText = "*" + ThisText + "*\\ ";
+
+    // There is no underline in RST. :-(
+
+    // BEWARE: if a bold fragment has leading whitspace, the bold
+    //         wont work in RST as no whitespace is permitted.
+    if (Fragment.attributes & ATTR_BOLD)
+       ThisText = "**" + ThisText + "**\\ ";
+
+    // These are mutually exclusive.
+    if (Fragment.attributes & ATTR_SUPERSCRIPT)
+       return ":sup:`" + ThisText + "`\\ ";
+
+    if (Fragment.attributes & ATTR_SUBSCRIPT)
+       return ":sub:`" + ThisText + "`\\ ";
+
+    return ThisText;
+}
+
+
+//------------------------------------------------------------------------------
+// ASCIIDoc[tor], in UTF8 encoding.
+//------------------------------------------------------------------------------
+bool QuillExporter::writeASC(QIODevice *device)
+{
+    QString ArticleTitle = fTitle;
+    if (ArticleTitle.isEmpty()) {
+       ArticleTitle = "= YOUR TITLE\n";
+    } else {
+        ArticleTitle = "= " + ArticleTitle + "\n";
+    }
+
+    QTextStream out(device);
+
+    // Pandoc and other converters require UTF8.
+    out.setCodec(QTextCodec::codecForName("UTF-8"));
+
+    // Make this an article, with the title.
+    out << ArticleTitle;
+
+    // Iterate over all paragraphs in the document and process each one.
+    // Empty paragraphs are ignored.
+    const int count = paragraphCount();
+    for (int p = 0; p < count; ++p) {
+        QString Paragraph = ASCParagraph(paragraph(p));
+        if (!Paragraph.isEmpty())
+            out << "\n" << Paragraph << "\n";
+    }
+
+    // Finish off the article.
+    out << "\n";
+    out.flush();
+
+    if (out.status() != QTextStream::Ok) {
+        fErrorString = device->errorString();
+        return false;
+    }
+
+    return true;
+}
+
+
+// For each and every paragraph, iterate over each fragment of text.
+QString QuillExporter::ASCParagraph(const QVector<textFragment> &Fragments)
+{
+    QString Paragraph;
+    for (int f = 0; f < Fragments.size(); ++f) {
+      Paragraph += ASCFragment(Fragments.at(f));
+    }
+
+    return Paragraph;
+}
+
+// This is where we process each paragraph's text fragments and remove
+// invalid ASCIIdoctor characters.
+QString QuillExporter::ASCFragment(const textFragment &Fragment)
+{
+    QString ThisText = Fragment.text;
+
+    // Here we try to decode what text attributes have been applied
+    // and return a suitable ASCIIdoctor 'statment' to accomodate them.
+    // BEWARE: if an italic fragment has leading whitespace, the
+    //         italics wont work in ASCIIdoctor as no whitespace is permitted.
+    if (Fragment.attributes & ATTR_ITALIC) {
+       ThisText = "__" + ThisText + "__";
+    }
+
+    // There is no underline in ASCIIdoctor. :-(
+
+    // BEWARE: if a bold fragment has leading whitspace, the bold
+    //         won't work in RST as no whitespace is permitted.
+    if (Fragment.attributes & ATTR_BOLD) {
+       ThisText =  "**" + ThisText + "**";
+    }
+
+    if (Fragment.attributes & ATTR_SUPERSCRIPT)
+       return "^" + ThisText + "^";
+
+    if (Fragment.attributes & ATTR_SUBSCRIPT)
+       return "~" + ThisText + "~";
+
+    return ThisText;
+}
+
+
+//------------------------------------------------------------------------------
+// How many paragraphs are there to export?
+//------------------------------------------------------------------------------
+int QuillExporter::paragraphCount()
+{
+    if (fDocument) {
+        return fDocument->blockCount();
+    }
+
+    return fQuill->getParagraphs().size();
+}
+
+//------------------------------------------------------------------------------
+// Returns the fragments of paragraph 'n'. A fragment of a QTextDocument has its
+// format turned back into attributes. A Quill document's runs already are.
+//------------------------------------------------------------------------------
+QVector<textFragment> QuillExporter::paragraph(const int n)
+{
+    QVector<textFragment> Fragments;
+    textFragment Fragment;
+
+    if (fDocument) {
+        QTextBlock block = fDocument->findBlockByNumber(n);
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it) {
+            QTextFragment tf = it.fragment();
+            QTextCharFormat Format = tf.charFormat();
+
+            Fragment.text = tf.text();
+            Fragment.attributes = 0;
+
+            if (Format.font().bold()) Fragment.attributes |= ATTR_BOLD;
+            if (Format.font().underline()) Fragment.attributes |= ATTR_UNDERLINE;
+            if (Format.font().italic()) Fragment.attributes |= ATTR_ITALIC;
+
+            if (Format.verticalAlignment() == QTextCharFormat::AlignSubScript) {
+                Fragment.attributes |= ATTR_SUBSCRIPT;
+            } else if (Format.verticalAlignment() == QTextCharFormat::AlignSuperScript) {
+                Fragment.attributes |= ATTR_SUPERSCRIPT;
+            }
+
+            Fragments.append(Fragment);
+        }
+
+        return Fragments;
+    }
+
+    const textParagraph &Paragraph = fQuill->getParagraphs().at(n);
+    const QVector<textRun> &Runs = fQuill->getRuns();
+    const QString &Text = fQuill->getTextBuffer();
+
+    Fragments.reserve(int(Paragraph.runCount));
+    for (quint32 r = Paragraph.firstRun; r < Paragraph.firstRun + Paragraph.runCount; ++r) {
+        const textRun &Run = Runs.at(int(r));
+        Fragment.text = Text.mid(int(Run.start), int(Run.length));
+        Fragment.attributes = Run.attributes;
+        Fragments.append(Fragment);
+    }
+
+    return Fragments;
+}
+
+//------------------------------------------------------------------------------
+// The QTextDocument to export. A Quill document builds it on first use.
+//------------------------------------------------------------------------------
+QTextDocument *QuillExporter::document()
+{
+    return fDocument ? fDocument : fQuill->getDocument();
+}
+
+
+//------------------------------------------------------------------------------
+// HTML, ODF and PDF need a QTextDocument, and that needs fonts.
+//------------------------------------------------------------------------------
+bool QuillExporter::needsDocument(const Format format)
+{
+    return format == HTML || format == ODF || format == PDF;
+}
+
+//------------------------------------------------------------------------------
+// Convert a command line option to an export format.
+//------------------------------------------------------------------------------
+bool QuillExporter::formatFromOption(const QString &option, Format &format)
+{
+    QString lower = option.toLower();
+
+    if (lower == "--pdf") { format = PDF; return true; }
+    if (lower == "--docbook") { format = Docbook; return true; }
+    if (lower == "--text") { format = Text; return true; }
+    if (lower == "--odf") { format = ODF; return true; }
+    if (lower == "--rst") { format = RST; return true; }
+    if (lower == "--asc" || lower == "--adoc") { format = ASC; return true; }
+    if (lower == "--html") { format = HTML; return true; }
+
+    return false;
+}
+
+QString QuillExporter::extension(const Format format)
+{
+    switch (format) {
+        case Text: return "txt";
+        case HTML: return "html";
+        case PDF: return "pdf";
+        case ODF: return "odf";
+        case Docbook: return "xml";
+        case RST: return "rst";
+        case ASC: return "adoc";
+    }
+
+    return QString();
+}
+
+QString QuillExporter::description(const Format format)
+{
+    switch (format) {
+        case Text: return "plain text";
+        case HTML: return "HTML";
+        case PDF: return "PDF";
+        case ODF: return "ODF";
+        case Docbook: return "DocBook XML";
+        case RST: return "ReStructuredText (RST)";
+        case ASC: return "ASCIIdoctor (ASC)";
+    }
+
+    return QString();
+}
+
+//------------------------------------------------------------------------------
+// Exported files go in the same folder as the input file. QL style names, like
+// "letter_doc", lose the "_doc" the same way "letter.doc" loses the ".doc".
+//------------------------------------------------------------------------------
+QString QuillExporter::outputFileName(const QString &inputFile, const Format format)
+{
+    QFileInfo info(inputFile);
+    QString baseName = info.baseName();
+
+    if (info.suffix().isEmpty() && baseName.size() > 4 &&
+        baseName.endsWith("_doc", Qt::CaseInsensitive)) {
+        baseName.chop(4);
+    }
+
+    return info.path() + "/" + baseName + "." + extension(format);
+}
@@ -0,0 +1,105 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#ifndef QUILLEXPORT_H
+#define QUILLEXPORT_H
+
+#include <QString>
+#include <QVector>
+
+class QIODevice;
+class QTextDocument;
+class QuillDoc;
+
+// A fragment of a paragraph. Some text, all with the same ATTR_xxx attributes.
+typedef struct textFragment {
+    QString text;
+    quint8  attributes;
+} textFragment;
+
+
+// Writes a document out in one of the export formats. There are no widgets or
+// dialogs in here, so this is shared by the GUI and the command line version.
+//
+// The source is either a QuillDoc, or a QTextDocument that may have been edited
+// in the GUI. For a QuillDoc, the text, RST, ASCIIdoctor and DocBook formats
+// are written straight from the runs, so headless documents never need to
+// build a QTextDocument. HTML, ODF and PDF always need one.
+
+class QuillExporter {
+
+public:
+    enum Format {
+        Text,
+        HTML,
+        PDF,
+        ODF,
+        Docbook,
+        RST,
+        ASC
+    };
+
+    QuillExporter(QuillDoc *Doc);
+    QuillExporter(QTextDocument *Document);
+
+    // Title for DocBook, RST and ASCIIdoctor. If not set, a placeholder is used.
+    void    setTitle(const QString &Title);
+
+    bool    write(const Format format, QIODevice *device);
+    bool    writeFile(const Format format, const QString &fileName);
+    QString errorString() const { return fErrorString; }
+
+    // Does this format need a QTextDocument, and so a GUI application?
+    static bool needsDocument(const Format format);
+
+    // "--pdf" etc, as used on the command line.
+    static bool formatFromOption(const QString &option, Format &format);
+
+    // The default extension, without the dot, and a name for messages.
+    static QString extension(const Format format);
+    static QString description(const Format format);
+
+    // Where the output goes by default - same folder, same name, new extension.
+    static QString outputFileName(const QString &inputFile, const Format format);
+
+private:
+    bool    writeText(QIODevice *device);
+    bool    writeWithWriter(const QByteArray &writerFormat, QIODevice *device);
+    bool    writePDF(QIODevice *device);
+    bool    writeDocbook(QIODevice *device);
+    bool    writeRST(QIODevice *device);
+    bool    writeASC(QIODevice *device);
+
+    int     paragraphCount();
+    QVector<textFragment> paragraph(const int n);
+    QTextDocument *document();
+
+    QString DocBookParagraph(const QVector<textFragment> &Fragments);
+    QString DocBookFragment(const textFragment &Fragment);
+    QString RSTParagraph(const QVector<textFragment> &Fragments);
+    QString RSTFragment(const textFragment &Fragment);
+    QString ASCParagraph(const QVector<textFragment> &Fragments);
+    QString ASCFragment(const textFragment &Fragment);
+
+    QuillDoc *fQuill;                   // One or other, not both.
+    QTextDocument *fDocument;
+    QString fTitle;
+    QString fErrorString;
+};
+
+#endif
@@ -0,0 +1,139 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#include "quillscan.h"
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define QUILLSCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 needs the compiler to let us switch it on for just the one function,
+// and to tell us, at run time, if the CPU has it.
+#if defined(QUILLSCAN_SSE2) && (defined(__x86_64__) || defined(__i386__))
+#define QUILLSCAN_AVX2
+#include <immintrin.h>
+#endif
+
+
+//------------------------------------------------------------------------------
+// One byte at a time. Used on CPUs without SSE2, and for the odd few bytes left
+// at the end of the vector loops.
+//------------------------------------------------------------------------------
+static quint32 findControlByteScalar(const uchar *data, quint32 from, quint32 to)
+{
+    while (from < to && !isControlByte(data[from])) {
+        ++from;
+    }
+
+    return from;
+}
+
+
+#ifdef QUILLSCAN_SSE2
+//------------------------------------------------------------------------------
+// 16 bytes at a time. The toggles 0x0F to 0x13 are found by subtracting 0x0F
+// and checking for an unsigned result of 4 or less. Everything else wraps round
+// to a big number.
+//------------------------------------------------------------------------------
+static quint32 findControlByteSSE2(const uchar *data, quint32 from, quint32 to)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i formFeed = _mm_set1_epi8(0x0C);
+    const __m128i softHyphen = _mm_set1_epi8(0x1E);
+    const __m128i toggleBase = _mm_set1_epi8(0x0F);
+    const __m128i toggleRange = _mm_set1_epi8(0x13 - 0x0F);
+
+    while (to - from >= 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + from));
+        __m128i toggles = _mm_sub_epi8(bytes, toggleBase);
+        __m128i hits = _mm_cmpeq_epi8(_mm_min_epu8(toggles, toggleRange), toggles);
+
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, zero));
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, formFeed));
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, softHyphen));
+
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) {
+            return from + quint32(__builtin_ctz(unsigned(mask)));
+        }
+
+        from += 16;
+    }
+
+    return findControlByteScalar(data, from, to);
+}
+#endif
+
+
+#ifdef QUILLSCAN_AVX2
+//------------------------------------------------------------------------------
+// As above, but 32 bytes at a time.
+//------------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static quint32 findControlByteAVX2(const uchar *data, quint32 from, quint32 to)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i formFeed = _mm256_set1_epi8(0x0C);
+    const __m256i softHyphen = _mm256_set1_epi8(0x1E);
+    const __m256i toggleBase = _mm256_set1_epi8(0x0F);
+    const __m256i toggleRange = _mm256_set1_epi8(0x13 - 0x0F);
+
+    while (to - from >= 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + from));
+        __m256i toggles = _mm256_sub_epi8(bytes, toggleBase);
+        __m256i hits = _mm256_cmpeq_epi8(_mm256_min_epu8(toggles, toggleRange), toggles);
+
+        hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(bytes, zero));
+        hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(bytes, formFeed));
+        hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(bytes, softHyphen));
+
+        unsigned mask = unsigned(_mm256_movemask_epi8(hits));
+        if (mask) {
+            return from + quint32(__builtin_ctz(mask));
+        }
+
+        from += 32;
+    }
+
+    return findControlByteSSE2(data, from, to);
+}
+#endif
+
+
+//------------------------------------------------------------------------------
+// Use the best we've got. The CPU check is only done the once.
+//------------------------------------------------------------------------------
+quint32 findControlByte(const uchar *data, quint32 from, quint32 to)
+{
+    if (from >= to) {
+        return to;
+    }
+
+#if defined(QUILLSCAN_AVX2)
+    static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+    if (hasAVX2) {
+        return findControlByteAVX2(data, from, to);
+    }
+    return findControlByteSSE2(data, from, to);
+#elif defined(QUILLSCAN_SSE2)
+    return findControlByteSSE2(data, from, to);
+#else
+    return findControlByteScalar(data, from, to);
+#endif
+}
@@ -0,0 +1,44 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#ifndef QUILLSCAN_H
+#define QUILLSCAN_H
+
+#include <QtGlobal>
+
+// Almost every byte in a Quill text area is plain text. The only ones that
+// need any special handling are these "control" bytes:
+//
+// 0x00         - End of paragraph.
+// 0x0C         - Form feed.
+// 0x0F to 0x13 - Bold, underline, subscript, superscript and italic toggles.
+// 0x1E         - Soft hyphen.
+//
+// findControlByte() returns the offset of the first control byte in
+// data[from] to data[to - 1], or 'to' if there isn't one. It uses SSE2 or
+// AVX2, where the CPU has them, to check 16 or 32 bytes at a time.
+
+quint32 findControlByte(const uchar *data, quint32 from, quint32 to);
+
+// Is this one of the above?
+inline bool isControlByte(const uchar c)
+{
+    return c == 0x00 || c == 0x0C || (c >= 0x0F && c <= 0x13) || c == 0x1E;
+}
+
+#endif
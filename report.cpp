@@ -0,0 +1,247 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#include <QFile>
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <time.h>
+#endif
+
+#include "report.h"
+#include "version.h"
+
+BatchReport::BatchReport()
+{
+    fFiles = 0;
+    fOK = 0;
+    fFailed = 0;
+    fSkipped = 0;
+    fInputBytes = 0;
+    fOutputBytes = 0;
+    fParseWall = 0;
+    fExportWall = 0;
+}
+
+bool BatchReport::open(const QString &fileName, const bool append, QString &error)
+{
+    fFile.setFileName(fileName);
+
+    QIODevice::OpenMode mode = QFile::WriteOnly | QFile::Truncate;
+    if (append) {
+        mode = QFile::WriteOnly | QFile::Append;
+    }
+
+    if (!fFile.open(mode)) {
+        error = QString("Cannot write report %1:\n%2.").arg(fileName).arg(fFile.errorString());
+        return false;
+    }
+
+    return true;
+}
+
+void BatchReport::clear(fileReport &report)
+{
+    report.status = "ok";
+    report.dialect.clear();
+    report.inputBytes = 0;
+    report.textBytes = 0;
+    report.paragraphs = 0;
+    report.parseWall = 0;
+    report.parseCPU = 0;
+    report.exportWall = 0;
+    report.exportCPU = 0;
+    report.wall = 0;
+    report.formats.clear();
+    report.errors.clear();
+}
+
+//------------------------------------------------------------------------------
+// One line per file, like this, but all on one line:
+//
+// {"file":"letter_doc","status":"ok","dialect":"QL","input_bytes":9025,
+//  "text_bytes":8190,"paragraphs":57,"parse":{"wall_us":310,"cpu_us":301},
+//  "export":{"wall_us":2200,"cpu_us":2150},"wall_us":2530,
+//  "outputs":[{"format":"pdf","ok":true,"bytes":20831,"wall_us":2200,"cpu_us":2150}],
+//  "errors":[]}
+//------------------------------------------------------------------------------
+void BatchReport::add(const QString &fileName, const fileReport &report)
+{
+    QByteArray line;
+
+    line += "{\"file\":" + jsonString(fileName);
+    line += ",\"status\":" + jsonString(report.status);
+    line += ",\"dialect\":" + (report.dialect.isEmpty() ? QByteArray("null") : jsonString(report.dialect));
+    line += ",\"input_bytes\":" + jsonNumber(report.inputBytes);
+    line += ",\"text_bytes\":" + jsonNumber(report.textBytes);
+    line += ",\"paragraphs\":" + jsonNumber(report.paragraphs);
+    line += ",\"parse\":{\"wall_us\":" + jsonNumber(report.parseWall) +
+            ",\"cpu_us\":" + jsonNumber(report.parseCPU) + "}";
+    line += ",\"export\":{\"wall_us\":" + jsonNumber(report.exportWall) +
+            ",\"cpu_us\":" + jsonNumber(report.exportCPU) + "}";
+    line += ",\"wall_us\":" + jsonNumber(report.wall);
+
+    line += ",\"outputs\":[";
+    for (int f = 0; f < report.formats.size(); f++) {
+        const formatReport &format = report.formats.at(f);
+
+        if (f) line += ',';
+        line += "{\"format\":" + jsonString(QuillExporter::extension(format.format));
+        line += ",\"ok\":" + QByteArray(format.ok ? "true" : "false");
+        line += ",\"bytes\":" + jsonNumber(format.bytes);
+        line += ",\"wall_us\":" + jsonNumber(format.wall);
+        line += ",\"cpu_us\":" + jsonNumber(format.cpu) + "}";
+
+        fOutputBytes += format.bytes;
+    }
+
+    line += "],\"errors\":[";
+    for (int e = 0; e < report.errors.size(); e++) {
+        if (e) line += ',';
+        line += jsonString(report.errors.at(e));
+    }
+    line += "]}\n";
+
+    fFile.write(line);
+    fFile.flush();
+
+    fFiles++;
+    if (report.status == "failed") {
+        fFailed++;
+    } else if (report.status == "skipped") {
+        fSkipped++;
+    } else {
+        fOK++;
+    }
+
+    fInputBytes += report.inputBytes;
+    fParseWall += report.parseWall;
+    fExportWall += report.exportWall;
+
+    if (report.status != "skipped") {
+        fLatencies.append(report.wall);
+    }
+}
+
+//------------------------------------------------------------------------------
+// The last line. Skipped files aren't in the latencies, they'd drag them all
+// down to nothing.
+//------------------------------------------------------------------------------
+bool BatchReport::close(const qint64 wall, QString &error)
+{
+    QVector<qint64> sorted = fLatencies;
+    std::sort(sorted.begin(), sorted.end());
+
+    QByteArray line;
+    line += "{\"summary\":true,\"version\":" + jsonString(QSTRIPPER_VERSION);
+    line += ",\"files\":" + jsonNumber(fFiles);
+    line += ",\"ok\":" + jsonNumber(fOK);
+    line += ",\"failed\":" + jsonNumber(fFailed);
+    line += ",\"skipped\":" + jsonNumber(fSkipped);
+    line += ",\"input_bytes\":" + jsonNumber(fInputBytes);
+    line += ",\"output_bytes\":" + jsonNumber(fOutputBytes);
+    line += ",\"parse_wall_us\":" + jsonNumber(fParseWall);
+    line += ",\"export_wall_us\":" + jsonNumber(fExportWall);
+    line += ",\"wall_us\":" + jsonNumber(wall);
+    line += ",\"latency_us\":{\"p50\":" + jsonNumber(percentile(sorted, 50));
+    line += ",\"p90\":" + jsonNumber(percentile(sorted, 90));
+    line += ",\"p99\":" + jsonNumber(percentile(sorted, 99));
+    line += ",\"max\":" + jsonNumber(sorted.isEmpty() ? 0 : sorted.last()) + "}}\n";
+
+    fFile.write(line);
+    fFile.close();
+
+    if (fFile.error() != QFile::NoError) {
+        error = QString("Cannot write report %1:\n%2.").arg(fFile.fileName()).arg(fFile.errorString());
+        return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Nearest rank, so it's always a time some file actually took.
+//------------------------------------------------------------------------------
+qint64 BatchReport::percentile(const QVector<qint64> &sorted, const int percent) const
+{
+    if (sorted.isEmpty()) {
+        return 0;
+    }
+
+    int rank = (sorted.size() * percent + 99) / 100;
+    return sorted.at(qBound(0, rank - 1, sorted.size() - 1));
+}
+
+QByteArray BatchReport::jsonString(const QString &text)
+{
+    QByteArray utf8 = text.toUtf8();
+    QByteArray quoted;
+    quoted.reserve(utf8.size() + 2);
+    quoted += '"';
+
+    for (int c = 0; c < utf8.size(); c++) {
+        const uchar ch = uchar(utf8.at(c));
+
+        switch (ch) {
+        case '"':  quoted += "\\\""; break;
+        case '\\': quoted += "\\\\"; break;
+        case '\n': quoted += "\\n"; break;
+        case '\r': quoted += "\\r"; break;
+        case '\t': quoted += "\\t"; break;
+        default:
+            if (ch < 0x20) {
+                quoted += "\\u00" + QByteArray::number(ch, 16).rightJustified(2, '0');
+            } else {
+                quoted += char(ch);
+            }
+        }
+    }
+
+    quoted += '"';
+    return quoted;
+}
+
+// Unknown CPU times are -1, which is null in the report.
+QByteArray BatchReport::jsonNumber(const qint64 number)
+{
+    return number < 0 ? QByteArray("null") : QByteArray::number(number);
+}
+
+//------------------------------------------------------------------------------
+// CPU time used by this thread so far. Linux only, -1 elsewhere.
+//------------------------------------------------------------------------------
+qint64 BatchReport::threadCPU()
+{
+#ifdef Q_OS_LINUX
+    struct timespec now;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) == 0) {
+        return qint64(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+    }
+#endif
+    return -1;
+}
+
+// CPU used by this thread since threadCPU() gave start.
+qint64 BatchReport::cpuSince(const qint64 start)
+{
+    if (start < 0) {
+        return -1;
+    }
+
+    return threadCPU() - start;
+}
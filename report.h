@@ -0,0 +1,104 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "quillexport.h"
+
+// All times are in microseconds. CPU times are for the thread that did the
+// work, or -1 if we can't tell on this system.
+
+// How one format went, for one file.
+typedef struct formatReport {
+    QuillExporter::Format format;
+    bool    ok;
+    qint64  bytes;                  // Written, to the file or the bundle.
+    qint64  wall;
+    qint64  cpu;
+} formatReport;
+
+// How one input file went.
+typedef struct fileReport {
+    QString status;                 // "ok", "failed", or "skipped" by the cache
+                                    // or an aborted batch.
+    QString dialect;                // "QL" or "DOS", empty if never parsed.
+    qint64  inputBytes;
+    qint64  textBytes;
+    int     paragraphs;
+    qint64  parseWall;              // Reading and decoding.
+    qint64  parseCPU;
+    qint64  exportWall;             // All the formats.
+    qint64  exportCPU;              // Total of the formats' CPU.
+    qint64  wall;                   // The whole file.
+    QVector<formatReport> formats;  // In the order asked for.
+    QStringList errors;
+} fileReport;
+
+
+// Writes --report, a JSON Lines file. One record per input file, in command
+// line order, then a summary with the totals and the spread of the time taken
+// per file. Records are written, and flushed, as each file is reported, so a
+// batch that dies part way through still says how far it got.
+//
+// JSON is written by hand, Qt 4 doesn't have QJsonDocument.
+
+class BatchReport {
+
+public:
+    BatchReport();
+
+    // Append, rather than start again, for --watch, a batch at a time.
+    bool    open(const QString &fileName, const bool append, QString &error);
+
+    // Called in order, by one thread at a time.
+    void    add(const QString &fileName, const fileReport &report);
+
+    // Write the summary. Wall is the time the whole batch took.
+    bool    close(const qint64 wall, QString &error);
+
+    static void clear(fileReport &report);
+    static qint64 threadCPU();
+    static qint64 cpuSince(const qint64 start);
+
+    // Quoted and escaped, UTF-8.
+    static QByteArray jsonString(const QString &text);
+
+private:
+    static QByteArray jsonNumber(const qint64 number);
+    qint64  percentile(const QVector<qint64> &sorted, const int percent) const;
+
+    QFile   fFile;
+    QVector<qint64> fLatencies;     // Wall time of each file.
+    int     fFiles;
+    int     fOK;
+    int     fFailed;
+    int     fSkipped;
+    qint64  fInputBytes;
+    qint64  fOutputBytes;
+    qint64  fParseWall;
+    qint64  fExportWall;
+};
+
+#endif
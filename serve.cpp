@@ -0,0 +1,501 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+//------------------------------------------------------------------------------
+// The protocol. Requests are lines of tab separated fields, in UTF-8:
+//
+//   FILE<tab>formats<tab>input[<tab>output]
+//        Export a Quill file. Formats is a comma separated list, like
+//        "pdf,html". The outputs go next to the input, as in a batch, unless
+//        an output is given, which is only allowed for one format.
+//
+//   BYTES<tab>format<tab>length
+//        Followed by length bytes of Quill document. Converted in memory.
+//
+//   PING
+//   SHUTDOWN
+//        Stop taking requests, finish what's running, then quit.
+//
+// Replies are lines too:
+//
+//   OK<tab>output[<tab>output...]          For FILE.
+//   OK<tab>length                          For BYTES, then length bytes.
+//   PONG                                   For PING and SHUTDOWN.
+//   ERROR<tab>message
+//------------------------------------------------------------------------------
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QFontDatabase>
+#include <QRunnable>
+#include <QSocketNotifier>
+#include <QTextStream>
+
+#include "quill.h"
+#include "serve.h"
+
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Biggest BYTES request we'll take. Quill documents are nowhere near this.
+static const qint64 maxRequestBytes = Q_INT64_C(64) * 1024 * 1024;
+
+// Longest request line. Plenty for two paths, and stops a client that never
+// sends a newline from filling up our memory.
+static const int maxLineBytes = 64 * 1024;
+
+static QByteArray errorReply(QString message)
+{
+    message.replace('\t', ' ');
+    message.replace('\n', ' ');
+    return "ERROR\t" + message.toUtf8() + "\n";
+}
+
+
+// Does the conversion on the server's thread pool, then hands the reply back
+// to the connection, on the main thread.
+class serveJob : public QRunnable {
+public:
+    serveJob(ServeConnection *Connection, const serveRequest &Request)
+    {
+        fConnection = Connection;
+        fRequest = Request;
+    }
+
+    void run()
+    {
+        QByteArray reply = fRequest.kind == serveRequest::File ? convertFile() : convertBytes();
+        QMetaObject::invokeMethod(fConnection, "jobFinished", Qt::QueuedConnection,
+                                  Q_ARG(QByteArray, reply));
+    }
+
+private:
+    QByteArray convertFile()
+    {
+        QuillDoc Input(fRequest.input, true);
+        if (!Input.isValid()) {
+            return errorReply(fRequest.input + ": This is not a Quill file. " + Input.getError());
+        }
+
+        QByteArray reply = "OK";
+        for (int f = 0; f < fRequest.formats.size(); f++) {
+            QuillExporter::Format format = fRequest.formats.at(f);
+            QString output = fRequest.output.isEmpty()
+                           ? QuillExporter::outputFileName(fRequest.input, format)
+                           : fRequest.output;
+
+            QuillExporter exporter(&Input);
+            if (!exporter.writeFile(format, output)) {
+                return errorReply(fRequest.input + ": " + exporter.errorString());
+            }
+
+            reply += "\t" + output.toUtf8();
+        }
+
+        return reply + "\n";
+    }
+
+    QByteArray convertBytes()
+    {
+        QuillDoc *Input = QuillDoc::fromBytes(fRequest.bytes, true);
+        if (!Input->isValid()) {
+            QByteArray reply = errorReply("This is not a Quill file. " + Input->getError());
+            delete Input;
+            return reply;
+        }
+
+        QBuffer buffer;
+        buffer.open(QBuffer::WriteOnly);
+
+        QuillExporter exporter(Input);
+        bool ok = exporter.write(fRequest.formats.at(0), &buffer);
+        delete Input;
+
+        if (!ok) {
+            return errorReply(exporter.errorString());
+        }
+
+        return "OK\t" + QByteArray::number(buffer.data().size()) + "\n" + buffer.data();
+    }
+
+    ServeConnection *fConnection;
+    serveRequest fRequest;
+};
+
+
+//------------------------------------------------------------------------------
+// A client connection.
+//------------------------------------------------------------------------------
+ServeConnection::ServeConnection(QLocalSocket *Socket, LocalServer *Server)
+    : QObject(Server)
+{
+    fSocket = Socket;
+    fSocket->setParent(this);
+    fServer = Server;
+    fBusy = false;
+    fGone = false;
+
+    connect(fSocket, SIGNAL(readyRead()), this, SLOT(readRequests()));
+    connect(fSocket, SIGNAL(disconnected()), this, SLOT(disconnected()));
+}
+
+void ServeConnection::readRequests()
+{
+    fBuffer += fSocket->readAll();
+
+    // Even while busy, or the buffer could grow for as long as the job runs.
+    if (!checkLineLength()) {
+        return;
+    }
+
+    while (!fBusy && !fGone && nextRequest()) {
+        // Keep going.
+    }
+}
+
+//------------------------------------------------------------------------------
+// Deal with the first request in the buffer. Returns false if there isn't a
+// whole one there yet.
+//------------------------------------------------------------------------------
+bool ServeConnection::nextRequest()
+{
+    if (!checkLineLength()) {
+        return false;
+    }
+
+    const int eol = fBuffer.indexOf('\n');
+    if (eol < 0) {
+        return false;
+    }
+
+    QStringList fields = QString::fromUtf8(fBuffer.constData(), eol).split('\t');
+    const QString command = fields.at(0).trimmed().toUpper();
+    int used = eol + 1;
+
+    serveRequest request;
+
+    if (command == "PING") {
+        fBuffer.remove(0, used);
+        reply("PONG\n");
+        return true;
+    }
+
+    if (command == "SHUTDOWN") {
+        fBuffer.remove(0, used);
+        reply("PONG\n");
+        fServer->drain();
+        return true;
+    }
+
+    if (command == "BYTES") {
+        bool ok = false;
+        qint64 length = fields.size() == 3 ? fields.at(2).toLongLong(&ok) : 0;
+
+        if (!ok || length < 0 || length > maxRequestBytes) {
+            // We can't tell where the bytes end, so the stream is unusable.
+            reply(errorReply("BYTES needs a format and a length."));
+            fBuffer.clear();
+            fSocket->disconnectFromServer();
+            return false;
+        }
+
+        if (fBuffer.size() - used < length) {
+            return false;               // Wait for the rest.
+        }
+
+        request.kind = serveRequest::Bytes;
+        request.bytes = fBuffer.mid(used, int(length));
+        used += int(length);
+    } else if (command == "FILE") {
+        if (fields.size() < 3 || fields.size() > 4) {
+            fBuffer.remove(0, used);
+            reply(errorReply("FILE needs formats, an input and, maybe, an output."));
+            return true;
+        }
+
+        request.kind = serveRequest::File;
+        request.input = fields.at(2);
+        if (fields.size() == 4) {
+            request.output = fields.at(3);
+        }
+    } else {
+        fBuffer.remove(0, used);
+        reply(errorReply("Unknown request " + command + "."));
+        return true;
+    }
+
+    fBuffer.remove(0, used);
+
+    batchOptions Options;
+    QString error;
+    if (!QuillBatch::parseFormatList(fields.at(1), Options, error) || Options.formats.isEmpty()) {
+        reply(errorReply(error.isEmpty() ? QString("No formats given.") : error));
+        return true;
+    }
+
+    request.formats = Options.formats;
+    if ((request.kind == serveRequest::Bytes || !request.output.isEmpty()) &&
+        request.formats.size() != 1) {
+        reply(errorReply("Only one format can be written to one output."));
+        return true;
+    }
+
+    if (fServer->isDraining()) {
+        reply(errorReply("The server is shutting down."));
+        return true;
+    }
+
+    fBusy = true;
+    fServer->startJob(this, request);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// The buffer always starts with a request line. One that's too long, with or
+// without its newline, is rubbish, and like a bad BYTES we can't tell where the
+// next request starts, so the client is cut off. Returns false if it was.
+//------------------------------------------------------------------------------
+bool ServeConnection::checkLineLength()
+{
+    const int eol = fBuffer.indexOf('\n');
+    if (eol > maxLineBytes || (eol < 0 && fBuffer.size() > maxLineBytes)) {
+        reply(errorReply(QString("Requests can't be longer than %1 bytes.").arg(maxLineBytes)));
+        fBuffer.clear();
+        fSocket->disconnectFromServer();
+        return false;
+    }
+
+    return true;
+}
+
+void ServeConnection::reply(const QByteArray &reply)
+{
+    fSocket->write(reply);
+    fSocket->flush();
+}
+
+void ServeConnection::jobFinished(const QByteArray &reply)
+{
+    fBusy = false;
+
+    if (fGone) {
+        deleteLater();
+    } else {
+        this->reply(reply);
+    }
+
+    fServer->jobDone();
+
+    if (fGone) {
+        return;
+    }
+
+    if (fServer->isDraining()) {
+        closeIfIdle();
+        return;
+    }
+
+    // Anything else already sent?
+    while (!fBusy && nextRequest()) {
+        // Keep going.
+    }
+}
+
+void ServeConnection::closeIfIdle()
+{
+    if (!fBusy && !fGone) {
+        fSocket->disconnectFromServer();
+    }
+}
+
+void ServeConnection::disconnected()
+{
+    fGone = true;
+    fServer->connectionClosed(this);
+
+    // If a conversion is running, it still needs us. jobFinished() tidies up.
+    if (!fBusy) {
+        deleteLater();
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// The server.
+//------------------------------------------------------------------------------
+#ifdef Q_OS_UNIX
+// Signals arrive on a socket, so they can be handled in the event loop.
+static int signalSockets[2];
+
+static void signalHandler(int)
+{
+    char c = 1;
+    ssize_t written = ::write(signalSockets[0], &c, sizeof(c));
+    Q_UNUSED(written);
+}
+#endif
+
+LocalServer::LocalServer(const batchOptions &Options, QObject *parent)
+    : QObject(parent)
+{
+    fOptions = Options;
+    fSignalNotifier = nullptr;
+    fActive = 0;
+    fDraining = false;
+
+    fPool.setMaxThreadCount(qMax(1, fOptions.jobs));
+    connect(&fServer, SIGNAL(newConnection()), this, SLOT(newConnection()));
+}
+
+LocalServer::~LocalServer()
+{
+    fPool.waitForDone();
+}
+
+bool LocalServer::start(QString &error)
+{
+    // A server that died leaves its socket behind, which has to go before we
+    // can listen. But if something answers, it's a live server, leave it be.
+    QLocalSocket probe;
+    probe.connectToServer(fOptions.serverName);
+    if (probe.waitForConnected(1000)) {
+        probe.disconnectFromServer();
+        error = "A server is already running on " + fOptions.serverName + ".";
+        return false;
+    }
+
+    QLocalServer::removeServer(fOptions.serverName);
+
+    // Any client can have us read and write files as we like, so only the
+    // user who started us gets to be one. Qt 4 leaves it to the umask.
+#if QT_VERSION >= 0x050000
+    fServer.setSocketOptions(QLocalServer::UserAccessOption);
+#endif
+
+    if (!fServer.listen(fOptions.serverName)) {
+        error = "Cannot listen on " + fOptions.serverName + ": " + fServer.errorString();
+        return false;
+    }
+
+#ifdef Q_OS_UNIX
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, signalSockets) == 0) {
+        fSignalNotifier = new QSocketNotifier(signalSockets[1], QSocketNotifier::Read, this);
+        connect(fSignalNotifier, SIGNAL(activated(int)), this, SLOT(signalReceived()));
+
+        struct sigaction action;
+        action.sa_handler = signalHandler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+    }
+
+    // A client that goes away mid reply mustn't take us with it.
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    // Load the fonts now, rather than on the first PDF.
+    QFontDatabase fonts;
+    fonts.families();
+
+    QTextStream(stdout) << "Serving on " << fServer.fullServerName() << "\n";
+    return true;
+}
+
+void LocalServer::newConnection()
+{
+    while (fServer.hasPendingConnections()) {
+        QLocalSocket *socket = fServer.nextPendingConnection();
+
+        if (fDraining) {
+            socket->disconnectFromServer();
+            socket->deleteLater();
+            continue;
+        }
+
+        fConnections.append(new ServeConnection(socket, this));
+    }
+}
+
+void LocalServer::startJob(ServeConnection *connection, const serveRequest &request)
+{
+    fActive++;
+    fPool.start(new serveJob(connection, request));
+}
+
+void LocalServer::jobDone()
+{
+    fActive--;
+    checkDrained();
+}
+
+void LocalServer::connectionClosed(ServeConnection *connection)
+{
+    fConnections.removeAll(connection);
+}
+
+void LocalServer::signalReceived()
+{
+#ifdef Q_OS_UNIX
+    char c;
+    ssize_t got = ::read(signalSockets[1], &c, sizeof(c));
+    Q_UNUSED(got);
+#endif
+    drain();
+}
+
+//------------------------------------------------------------------------------
+// Stop taking new work. Idle clients are disconnected now, busy ones once
+// their conversion has been replied to.
+//------------------------------------------------------------------------------
+void LocalServer::drain()
+{
+    if (fDraining) {
+        return;
+    }
+
+    fDraining = true;
+    fServer.close();
+    QTextStream(stdout) << "Shutting down\n";
+
+    QList<ServeConnection *> connections = fConnections;
+    for (int c = 0; c < connections.size(); c++) {
+        connections.at(c)->closeIfIdle();
+    }
+
+    checkDrained();
+}
+
+void LocalServer::checkDrained()
+{
+    if (fDraining && fActive == 0) {
+        // Replies may still be on their way out.
+        QList<QLocalSocket *> sockets = findChildren<QLocalSocket *>();
+        for (int s = 0; s < sockets.size(); s++) {
+            while (sockets.at(s)->bytesToWrite() > 0 &&
+                   sockets.at(s)->waitForBytesWritten(1000)) {
+                // Wait.
+            }
+        }
+
+        QCoreApplication::quit();
+    }
+}
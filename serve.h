@@ -0,0 +1,118 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QObject>
+#include <QThreadPool>
+
+#include "batch.h"
+
+class QSocketNotifier;
+class LocalServer;
+
+// One request from a client. See serve.cpp for the protocol.
+typedef struct serveRequest {
+    enum Kind { File, Bytes } kind;
+    QList<QuillExporter::Format> formats;
+    QString input;                  // File: the Quill file.
+    QString output;                 // File: optional, one format only.
+    QByteArray bytes;               // Bytes: the Quill document.
+} serveRequest;
+
+
+// One client. Requests are answered in the order they arrive, one at a time,
+// so a client can send several and match the replies up by order.
+
+class ServeConnection : public QObject
+{
+    Q_OBJECT
+
+public:
+    ServeConnection(QLocalSocket *Socket, LocalServer *Server);
+
+    void    closeIfIdle();
+
+public slots:
+    void    jobFinished(const QByteArray &reply);
+
+private slots:
+    void    readRequests();
+    void    disconnected();
+
+private:
+    bool    nextRequest();
+    bool    checkLineLength();
+    void    reply(const QByteArray &reply);
+
+    QLocalSocket *fSocket;
+    LocalServer *fServer;
+    QByteArray fBuffer;             // Received, not yet handled.
+    bool fBusy;                     // A request is being converted.
+    bool fGone;                     // Client has disconnected.
+};
+
+
+// qstripper-cli --serve. Listens on a local socket (a Unix domain socket, or a
+// named pipe on Windows) and converts documents for whoever asks, without the
+// start up costs of a new process each time.
+//
+// No more than --jobs conversions run at once, the rest queue. On SIGINT or
+// SIGTERM, or a SHUTDOWN request, no more connections or requests are taken,
+// the conversions already running finish and are replied to, then we quit.
+
+class LocalServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    LocalServer(const batchOptions &Options, QObject *parent = nullptr);
+    ~LocalServer();
+
+    bool    start(QString &error);
+    bool    isDraining() const { return fDraining; }
+
+    void    startJob(ServeConnection *connection, const serveRequest &request);
+    void    jobDone();
+    void    connectionClosed(ServeConnection *connection);
+
+public slots:
+    void    drain();
+
+private slots:
+    void    newConnection();
+    void    signalReceived();
+
+private:
+    void    checkDrained();
+
+    batchOptions fOptions;
+    QLocalServer fServer;
+    QThreadPool fPool;
+    QList<ServeConnection *> fConnections;
+    QSocketNotifier *fSignalNotifier;
+    int fActive;                    // Conversions running or queued.
+    bool fDraining;
+};
+
+#endif
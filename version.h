@@ -2,9 +2,55 @@
 #define VERSION_H
 
 // Change this when you update things. It is used in Help->About.
-#define QSTRIPPER_VERSION "1.17"
+#define QSTRIPPER_VERSION "1.19"
 
 // Version History
+// 1.19 - New qstripper-cli, built from QStripperCli.pro. It exports from the
+//        command line, like "qstripper --export", but doesn't build the main
+//        window first, and doesn't need a display. The exporters have moved
+//        out of MdiChild into QuillExporter so both versions share them.
+//        Exports can ask for several formats at once, "--pdf --html --rst" or
+//        "--formats pdf,html,rst", and each file is only parsed once.
+//        Batch exports use all the cores, -j N to choose how many files are
+//        exported at once. Errors still come out in command line order.
+//        The biggest files are started first, and idle workers help out the
+//        busy ones, so the batch doesn't finish on one core.
+//        Batches no longer keep every document until they finish. Each one is
+//        freed after exporting, decode buffers are reused, and --max-rss holds
+//        back new files when memory is tight, for the Raspberry Pi. Opening a
+//        file over an existing one in the GUI no longer leaks the old one.
+//        --recursive dir exports a whole tree, with --include and --exclude
+//        globs. Only the first 20 bytes of each file are read to see if it's
+//        a Quill file. QL style "letter_doc" names export as "letter.pdf" etc.
+//        --cache dir keeps a manifest of exports, and files whose header, text
+//        and tables haven't changed aren't exported again. --prune deletes the
+//        exports of files that have gone.
+//        qstripper-cli --watch dir watches a hot folder and exports Quill files
+//        as they arrive, once they have finished being written.
+//        --from file --to format converts one file, or stdin, to stdout, for
+//        use in pipelines.
+//        qstripper-cli --serve runs a conversion server on a local socket, so
+//        build tools don't pay the start up costs for every document.
+//        --bundle out.zip, or out.tar, writes a whole batch into one archive
+//        as it goes, rather than thousands of little files.
+//        Quill files are read straight out of QXL.WIN and QL floppy disc
+//        images, and zip files, with no need to extract them first.
+//        --report out.jsonl writes a JSON Lines record per file, with parse
+//        and export times, output sizes and errors, and a summary at the end.
+//        Errors go through a reporter, stderr or --error-log for batches, a
+//        dialog only in the GUI, so an unattended export never stops to ask.
+//        --on-error abort stops a batch at the first error, exit code 3.
+//        qstripper-cli --isolate exports in a pool of worker processes, so a
+//        file that crashes the parser, or takes longer than --timeout, only
+//        fails itself. Its worker is replaced and the batch carries on.
+//
+// 1.18 - Quill files are now mapped into memory rather than being opened
+//        twice and read into a copy. Pipes etc still get read the old way.
+//        The text is decoded into runs of identically formatted characters
+//        first, and the document is built a run at a time, not a character
+//        at a time. Much faster on big documents. Really big documents, over
+//        512Kb of text, are decoded on all cores, a chunk of paragraphs each.
+//
 // 1.17 - Credited Cristian for his 'background.jpg' image aka QL 2001. Also
 //        fixed duplicate shortcut CTRL+SHIFT+R which exports RST and ASC.
 //        Now uses CTRL+SHIFT+A for ASC exports.
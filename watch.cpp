@@ -0,0 +1,206 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+#include <QTextStream>
+
+#include "container.h"
+#include "quill.h"
+#include "watch.h"
+
+// How often, in milliseconds, unsettled files are looked at again.
+static const int checkInterval = 250;
+
+HotFolder::HotFolder(const batchOptions &Options, ErrorReporter *Reporter, QObject *parent)
+    : QObject(parent)
+{
+    fOptions = Options;
+    fReporter = Reporter;
+
+    for (int g = 0; g < fOptions.include.size(); g++) {
+        fInclude.append(QRegExp(fOptions.include.at(g), Qt::CaseInsensitive, QRegExp::Wildcard));
+    }
+
+    for (int g = 0; g < fOptions.exclude.size(); g++) {
+        fExclude.append(QRegExp(fOptions.exclude.at(g), Qt::CaseInsensitive, QRegExp::Wildcard));
+    }
+
+    fTimer.setInterval(checkInterval);
+    connect(&fTimer, SIGNAL(timeout()), this, SLOT(checkArrivals()));
+    connect(&fWatcher, SIGNAL(directoryChanged(const QString &)),
+            this, SLOT(directoryChanged(const QString &)));
+}
+
+//------------------------------------------------------------------------------
+// Start watching. Anything already in the folder is treated as just arrived.
+//------------------------------------------------------------------------------
+bool HotFolder::start(QString &error)
+{
+    if (!QFileInfo(fOptions.watchDirectory).isDir()) {
+        error = fOptions.watchDirectory + " is not a directory.";
+        return false;
+    }
+
+    if (!fWatcher.addPath(fOptions.watchDirectory)) {
+        error = "Cannot watch " + fOptions.watchDirectory + ".";
+        return false;
+    }
+
+    QTextStream(stdout) << "Watching " << QDir(fOptions.watchDirectory).absolutePath() << "\n";
+
+    scan();
+    return true;
+}
+
+void HotFolder::directoryChanged(const QString &path)
+{
+    Q_UNUSED(path);
+    scan();
+}
+
+//------------------------------------------------------------------------------
+// Something in the folder changed. We aren't told what, so look at everything
+// that matches the globs, and note anything new, or different to how it was
+// when it was exported. Files that have gone are forgotten, or a folder that
+// runs for months would remember every file that ever passed through it.
+//------------------------------------------------------------------------------
+void HotFolder::scan()
+{
+    const QDateTime now = QDateTime::currentDateTime();
+    QFileInfoList entries = QDir(fOptions.watchDirectory).entryInfoList(QDir::Files | QDir::Readable);
+    QSet<QString> present;
+
+    for (int e = 0; e < entries.size(); e++) {
+        const QFileInfo &info = entries.at(e);
+        const QString name = info.fileName();
+
+        bool included = false;
+        for (int g = 0; g < fInclude.size() && !included; g++) {
+            included = fInclude.at(g).exactMatch(name);
+        }
+        for (int g = 0; g < fExclude.size() && included; g++) {
+            included = !fExclude.at(g).exactMatch(name);
+        }
+        if (!included) {
+            continue;
+        }
+
+        const QString path = info.absoluteFilePath();
+        present.insert(path);
+
+        QHash<QString, arrival>::const_iterator done = fDone.constFind(path);
+        if (done != fDone.constEnd() &&
+            done.value().size == info.size() &&
+            done.value().modified == info.lastModified()) {
+            continue;
+        }
+
+        if (!fArrivals.contains(path)) {
+            arrival a;
+            a.size = info.size();
+            a.modified = info.lastModified();
+            a.settled = now;
+            fArrivals.insert(path, a);
+        }
+    }
+
+    QHash<QString, arrival>::iterator it = fDone.begin();
+    while (it != fDone.end()) {
+        if (present.contains(it.key())) {
+            ++it;
+        } else {
+            it = fDone.erase(it);
+        }
+    }
+
+    if (!fArrivals.isEmpty() && !fTimer.isActive()) {
+        fTimer.start();
+    }
+}
+
+//------------------------------------------------------------------------------
+// Export every file that has stopped changing, all in one batch. Files still
+// being written wait for the next look.
+//------------------------------------------------------------------------------
+void HotFolder::checkArrivals()
+{
+    const QDateTime now = QDateTime::currentDateTime();
+    QStringList ready;
+
+    QHash<QString, arrival>::iterator it = fArrivals.begin();
+    while (it != fArrivals.end()) {
+        QFileInfo info(it.key());
+
+        // Gone again?
+        if (!info.exists()) {
+            it = fArrivals.erase(it);
+            continue;
+        }
+
+        // Still growing? Start the clock again.
+        if (info.size() != it.value().size || info.lastModified() != it.value().modified) {
+            it.value().size = info.size();
+            it.value().modified = info.lastModified();
+            it.value().settled = now;
+            ++it;
+            continue;
+        }
+
+        if (it.value().settled.msecsTo(now) < fOptions.settle) {
+            ++it;
+            continue;
+        }
+
+        // Settled. Whether it's a Quill file or not, we're done with it until
+        // it changes again. Disc images and zips are exported just as they
+        // are with --recursive, the Quill files in them to a folder each.
+        fDone.insert(it.key(), it.value());
+        if (QuillDoc::looksLikeQuill(it.key()) || QuillContainer::isContainer(it.key())) {
+            ready.append(it.key());
+        }
+
+        it = fArrivals.erase(it);
+    }
+
+    if (fArrivals.isEmpty()) {
+        fTimer.stop();
+    }
+
+    if (ready.isEmpty()) {
+        return;
+    }
+
+    ready.sort();
+
+    batchOptions Options = fOptions;
+    Options.files = ready;
+    Options.directories.clear();
+
+    QTextStream(stdout) << "Exporting " << ready.size() << (ready.size() == 1 ? " file" : " files") << "\n";
+
+    // --on-error abort means stop watching as well.
+    QuillBatch batch(Options);
+    batch.setReporter(fReporter);
+    if (batch.run() == EXIT_ABORTED) {
+        fTimer.stop();
+        QCoreApplication::exit(EXIT_ABORTED);
+    }
+}
@@ -0,0 +1,75 @@
+/****************************************************************************
+**
+** Copyright (C) 2006-2009 Dunbar IT Consultants Ltd.
+**
+** This file is part of the QStripper application.
+**
+** This file may be used under the terms of the GNU General Public
+** License version 2.0 as published by the Free Software Foundation
+** and appearing in the file LICENSE.GPL included in the packaging of
+** this file.  Please review the following information to ensure GNU
+** General Public Licensing requirements will be met:
+** http://www.trolltech.com/products/qt/opensource.html
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+****************************************************************************/
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <QDateTime>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QObject>
+#include <QRegExp>
+#include <QTimer>
+
+#include "batch.h"
+
+// A file that has turned up, or changed, but may still be being written.
+typedef struct arrival {
+    qint64 size;
+    QDateTime modified;
+    QDateTime settled;              // When size and time last changed.
+} arrival;
+
+
+// Watches a hot folder and exports Quill files as they arrive, along with the
+// Quill files in any disc images or zip files that arrive.
+//
+// Emulators write files in dribs and drabs, so a file is only exported once
+// its size and time have stayed the same for the settle time. Everything that
+// settles at the same time is exported as one batch, with all the usual batch
+// options. The process stays running, so there's no start up cost per file.
+
+class HotFolder : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Every batch reports to Reporter, which must outlive us.
+    HotFolder(const batchOptions &Options, ErrorReporter *Reporter, QObject *parent = nullptr);
+
+    bool    start(QString &error);
+
+private slots:
+    void    directoryChanged(const QString &path);
+    void    checkArrivals();
+
+private:
+    void    scan();
+
+    batchOptions fOptions;
+    ErrorReporter *fReporter;
+    QFileSystemWatcher fWatcher;
+    QTimer fTimer;
+    QList<QRegExp> fInclude;
+    QList<QRegExp> fExclude;
+
+    QHash<QString, arrival> fArrivals;  // Not settled yet.
+    QHash<QString, arrival> fDone;      // Exported, as they were then.
+};
+
+#endif